@@ -0,0 +1,178 @@
+// Per-call latency of the hot Database queries against a freshly seeded file.
+//
+//   cmake -S . -B build -DCOCKPIT_BUILD_BENCHMARKS=ON && cmake --build build --target db_bench
+//   ./build/db_bench [database path] [synchronous mode]
+//
+// The path defaults to db_bench.db in the working directory and is recreated
+// on every run. Each query is timed twice: through Database, with its cached
+// statements and default reader pool, and as the same SQL prepared and
+// finalized on every call, as Database did before it cached statements.
+// Inserts are single autocommit calls, so they mostly measure the commit.
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sqlite3.h>
+#include "database.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int USERS = 100;
+constexpr int GROUP_MEMBERS = 20;
+constexpr int MESSAGES = 500;
+
+void removeDatabase(const std::string& path) {
+    for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+        unlink((path + suffix).c_str());
+    }
+}
+
+// Runs a tenth of the calls untimed to warm the caches, then the rest timed
+double measure(int calls, const std::function<void(int)>& call) {
+    for (int i = 0; i < calls / 10; i++) {
+        call(i);
+    }
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < calls; i++) {
+        call(i);
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / calls;
+}
+
+void report(const char* name, int calls, const std::function<void(int)>& uncached,
+            const std::function<void(int)>& cached) {
+    double before = measure(calls, uncached);
+    double after = measure(calls, cached);
+    std::printf("%-22s %10.2f %10.2f\n", name, before, after);
+}
+
+// Prepares, binds, steps through every row (copying text columns out, as
+// Database does) and finalizes
+void runUncached(sqlite3* db, const char* sql, const std::function<void(sqlite3_stmt*)>& bind) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    bind(stmt);
+    std::string text;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        for (int column = 0; column < sqlite3_column_count(stmt); column++) {
+            if (const unsigned char* value = sqlite3_column_text(stmt, column)) {
+                text = reinterpret_cast<const char*>(value);
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+bool seed(Database& db) {
+    for (int i = 1; i <= USERS; i++) {
+        std::string name = "bench" + std::to_string(i);
+        if (!db.createUser(name, name + "@example.com", "hash", "key") ||
+            !db.saveSession("token" + std::to_string(i), i, "2099-01-01 00:00:00")) {
+            return false;
+        }
+    }
+    if (!db.createGroup("bench", "benchmark group", 1)) {
+        return false;
+    }
+    for (int i = 1; i <= GROUP_MEMBERS; i++) {
+        db.addUserToGroup(1, i);
+    }
+
+    Message message{};
+    message.sender_id = 1;
+    message.receiver_id = 2;
+    message.content = "hello";
+    message.encrypted_content = "hello";
+    message.message_type = "text";
+    std::vector<Message> messages(MESSAGES, message);
+    std::vector<int> ids;
+    return db.saveMessages(messages, ids);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    DatabaseConfig config;
+    config.path = argc > 1 ? argv[1] : "db_bench.db";
+    if (argc > 2 && !parseSyncMode(argv[2], config.synchronous)) {
+        std::cerr << "Unknown synchronous mode: " << argv[2] << std::endl;
+        return 1;
+    }
+
+    removeDatabase(config.path);
+    Database db(config);
+    if (!db.initialize() || !seed(db)) {
+        std::cerr << "Failed to seed " << config.path << std::endl;
+        return 1;
+    }
+
+    sqlite3* raw;
+    if (sqlite3_open(config.path.c_str(), &raw) != SQLITE_OK) {
+        std::cerr << "Failed to open " << config.path << std::endl;
+        return 1;
+    }
+    std::string synchronous = std::string("PRAGMA synchronous = ") + syncModeName(config.synchronous);
+    sqlite3_exec(raw, synchronous.c_str(), nullptr, nullptr, nullptr);
+    sqlite3_exec(raw, "PRAGMA foreign_keys = ON", nullptr, nullptr, nullptr);
+
+    std::printf("%-22s %10s %10s   us/call\n", "", "uncached", "Database");
+    report("getUserById", 200000, [&](int i) {
+        runUncached(raw, "SELECT id, username, email, password_hash, public_key, created_at, is_online "
+                         "FROM users WHERE id = ?",
+                    [&](sqlite3_stmt* stmt) { sqlite3_bind_int(stmt, 1, 1 + i % USERS); });
+    }, [&](int i) { db.getUserById(1 + i % USERS); });
+
+    report("getUserIdFromSession", 200000, [&](int i) {
+        std::string token = "token" + std::to_string(1 + i % USERS);
+        runUncached(raw, "SELECT user_id FROM sessions WHERE token = ? AND expires_at > datetime('now')",
+                    [&](sqlite3_stmt* stmt) { sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_STATIC); });
+    }, [&](int i) { db.getUserIdFromSession("token" + std::to_string(1 + i % USERS)); });
+
+    report("getUserGroups", 200000, [&](int i) {
+        runUncached(raw, "SELECT g.id, g.name, g.description, g.creator_id, g.created_at FROM groups g "
+                         "JOIN group_members gm ON g.id = gm.group_id WHERE gm.user_id = ?",
+                    [&](sqlite3_stmt* stmt) { sqlite3_bind_int(stmt, 1, 1 + i % GROUP_MEMBERS); });
+    }, [&](int i) { db.getUserGroups(1 + i % GROUP_MEMBERS); });
+
+    report("getMessages(50)", 20000, [&](int) {
+        runUncached(raw, "SELECT id, sender_id, receiver_id, group_id, content, encrypted_content, timestamp, "
+                         "is_read, message_type FROM messages WHERE (sender_id = ? AND receiver_id = ?) OR "
+                         "(sender_id = ? AND receiver_id = ?) ORDER BY timestamp DESC LIMIT ?",
+                    [&](sqlite3_stmt* stmt) {
+                        sqlite3_bind_int(stmt, 1, 1);
+                        sqlite3_bind_int(stmt, 2, 2);
+                        sqlite3_bind_int(stmt, 3, 2);
+                        sqlite3_bind_int(stmt, 4, 1);
+                        sqlite3_bind_int(stmt, 5, 50);
+                    });
+    }, [&](int) { db.getMessages(1, 2, 50); });
+
+    Message message{};
+    message.sender_id = 1;
+    message.receiver_id = 2;
+    message.content = "hello";
+    message.encrypted_content = "hello";
+    message.message_type = "text";
+    report("saveMessage", 2000, [&](int) {
+        runUncached(raw, "INSERT INTO messages (sender_id, receiver_id, group_id, content, encrypted_content, "
+                         "message_type) VALUES (?, ?, ?, ?, ?, ?)",
+                    [&](sqlite3_stmt* stmt) {
+                        sqlite3_bind_int(stmt, 1, message.sender_id);
+                        sqlite3_bind_int(stmt, 2, message.receiver_id);
+                        sqlite3_bind_null(stmt, 3);
+                        sqlite3_bind_text(stmt, 4, message.content.c_str(), -1, SQLITE_STATIC);
+                        sqlite3_bind_text(stmt, 5, message.encrypted_content.c_str(), -1, SQLITE_STATIC);
+                        sqlite3_bind_text(stmt, 6, message.message_type.c_str(), -1, SQLITE_STATIC);
+                    });
+    }, [&](int) { db.saveMessage(message); });
+
+    sqlite3_close(raw);
+    removeDatabase(config.path);
+    return 0;
+}
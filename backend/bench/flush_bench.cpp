@@ -0,0 +1,134 @@
+// Counts the send calls an I/O backend makes for bursts of small frames, to
+// check that frames written during one event-loop pass leave in one write.
+//
+//   cmake -S . -B build -DCOCKPIT_BUILD_BENCHMARKS=ON && cmake --build build --target flush_bench
+//   ./build/flush_bench [epoll|uring] [clients] [rounds] [frames per round]
+//
+// Each client is one end of a socketpair attached to the backend the way the
+// server attaches accepted sockets. A round is a single loop task that writes
+// the given number of frames to every client, as a handler answering one
+// request with many frames would; the other ends are read until every frame
+// arrived, and the backend's send call count is reported.
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "event_loop.h"
+#include "io_backend.h"
+#include "websocket_handler.h"
+
+namespace {
+
+// An unmasked text frame, as servers send them
+std::string textFrame(const std::string& payload) {
+    std::string frame;
+    frame.push_back(static_cast<char>(0x81));
+    frame.push_back(static_cast<char>(payload.size()));  // payloads here stay under 126 bytes
+    frame += payload;
+    return frame;
+}
+
+// Reads and discards exactly size bytes
+void drain(int fd, size_t size) {
+    char chunk[65536];
+    while (size > 0) {
+        ssize_t n = recv(fd, chunk, std::min(size, sizeof(chunk)), 0);
+        if (n <= 0) {
+            std::cerr << "Connection closed" << std::endl;
+            exit(1);
+        }
+        size -= static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    IoBackendType type = IoBackendType::EPOLL;
+    if (argc > 1 && !parseIoBackendType(argv[1], type)) {
+        std::cerr << "Unknown I/O backend: " << argv[1] << std::endl;
+        return 1;
+    }
+    int clients = argc > 2 ? std::atoi(argv[2]) : 3;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 10;
+    int burst = argc > 4 ? std::atoi(argv[4]) : 100;
+
+    EventLoop loop;
+    IoCallbacks callbacks;
+    callbacks.onData = [](const std::shared_ptr<WebSocketConnection>& conn) { conn->inbound.clear(); };
+    callbacks.onDisconnect = [](const std::shared_ptr<WebSocketConnection>&) {};
+    std::unique_ptr<IoBackend> backend = IoBackend::create(type, &loop, callbacks);
+    if (!loop.initialize() || !backend || !backend->initialize()) {
+        std::cerr << "Failed to set up the " << ioBackendName(type) << " backend" << std::endl;
+        return 1;
+    }
+    std::thread thread([&loop]() { loop.run(); });
+
+    std::vector<int> peers;
+    std::vector<std::shared_ptr<WebSocketConnection>> connections;
+    for (int i = 0; i < clients; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+            std::cerr << "Failed to create socketpair: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        // Accepted sockets are non-blocking too
+        fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+        connections.push_back(std::make_shared<WebSocketConnection>(pair[0], "bench", backend.get()));
+        peers.push_back(pair[1]);
+    }
+    std::promise<void> attached;
+    loop.post([&]() {
+        for (const auto& conn : connections) {
+            backend->attach(conn);
+        }
+        attached.set_value();
+    });
+    attached.get_future().wait();
+
+    std::string frame = textFrame("{\"type\":\"echo\",\"body\":\"flush\"}");
+    uint64_t before = backend->sendCalls();
+    for (int round = 0; round < rounds; round++) {
+        loop.post([&]() {
+            for (const auto& conn : connections) {
+                for (int i = 0; i < burst; i++) {
+                    backend->write(conn, frame);
+                }
+            }
+        });
+        for (int peer : peers) {
+            drain(peer, frame.size() * burst);
+        }
+    }
+    uint64_t calls = backend->sendCalls() - before;
+
+    std::printf("%s: %d frames to %d clients in %llu send calls\n", ioBackendName(type),
+                rounds * burst * clients, clients, static_cast<unsigned long long>(calls));
+
+    std::promise<void> closed;
+    loop.post([&]() {
+        for (const auto& conn : connections) {
+            backend->close(conn);
+        }
+        closed.set_value();
+    });
+    closed.get_future().wait();
+    for (int peer : peers) {
+        close(peer);
+    }
+    // Let the backends see the peers go and release the sockets
+    usleep(100 * 1000);
+    loop.stop();
+    thread.join();
+    return 0;
+}
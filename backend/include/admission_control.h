@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Budgets for accepted connections; 0 means unlimited
+struct AdmissionLimits {
+    size_t maxConnections = 10000;       // open connections in total
+    size_t maxConnectionsPerIp = 256;    // open connections from one peer address
+    size_t maxPendingHandshakes = 1024;  // connections that have not completed a first request
+};
+
+// Decides at accept time whether a connection may take a slot, so a reconnect
+// storm is turned away cheaply instead of exhausting descriptors and memory
+// for the clients already connected. Connections from every I/O loop share
+// one budget.
+class AdmissionControl {
+public:
+    enum class Verdict {
+        ADMITTED,
+        OVER_CONNECTIONS,
+        OVER_PER_IP,
+        OVER_PENDING
+    };
+
+    struct Stats {
+        size_t active = 0;
+        size_t pending = 0;
+        size_t trackedAddresses = 0;
+        uint64_t admitted = 0;
+        uint64_t rejectedConnections = 0;
+        uint64_t rejectedPerIp = 0;
+        uint64_t rejectedPending = 0;
+    };
+
+    explicit AdmissionControl(const AdmissionLimits& limits = AdmissionLimits());
+
+    // Set before the server starts accepting
+    void setLimits(const AdmissionLimits& limits);
+    const AdmissionLimits& limits() const { return limits_; }
+
+    // remoteAddress is "ip:port"; an admitted connection counts as pending
+    // until handshakeDone() and holds its slot until release()
+    Verdict admit(const std::string& remoteAddress);
+    void handshakeDone();
+    void release(const std::string& remoteAddress, bool pending);
+
+    Stats stats() const;
+
+private:
+    AdmissionLimits limits_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, size_t> perIp_;
+    Stats stats_;
+
+    static std::string_view hostOf(const std::string& remoteAddress);
+};
+
+const char* admissionVerdictName(AdmissionControl::Verdict verdict);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+struct WebSocketConnection;
+
+// Every open connection by socket, and every authenticated connection by
+// user. A user may be connected from several devices at once, so the user
+// index maps to a set of connections. Both indexes are split into shards,
+// each behind its own reader-writer lock: lookups for delivery only take a
+// shared lock on one shard, and a connect or disconnect only blocks the one
+// shard its key hashes to.
+class ConnectionRegistry {
+public:
+    using ConnectionPtr = std::shared_ptr<WebSocketConnection>;
+
+    ConnectionRegistry() = default;
+    ConnectionRegistry(const ConnectionRegistry&) = delete;
+    ConnectionRegistry& operator=(const ConnectionRegistry&) = delete;
+
+    void addSocket(int socket, const ConnectionPtr& conn);
+    // Only removes the entry while it still refers to conn; the fd number may
+    // already belong to a newer connection
+    void removeSocket(int socket, const ConnectionPtr& conn);
+
+    void addUser(int userId, const ConnectionPtr& conn);
+    void removeUser(int userId, const ConnectionPtr& conn);
+    // Removes every device of the user and returns them
+    std::vector<ConnectionPtr> removeAllOfUser(int userId);
+
+    // Snapshot of the user's devices, in the order they signed in
+    std::vector<ConnectionPtr> connectionsOf(int userId) const;
+    // Appends the devices of each user to out
+    void collect(const std::vector<int>& userIds, std::vector<ConnectionPtr>& out) const;
+    std::vector<ConnectionPtr> allConnections() const;
+
+    size_t socketCount() const;
+    size_t userCount() const;
+
+private:
+    static constexpr size_t SHARDS = 64;  // power of two
+
+    struct SocketShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int, ConnectionPtr> connections;
+    };
+    struct UserShard {
+        mutable std::shared_mutex mutex;
+        // A handful of devices per user: a vector beats a set here
+        std::unordered_map<int, std::vector<ConnectionPtr>> devices;
+    };
+
+    SocketShard sockets_[SHARDS];
+    UserShard users_[SHARDS];
+
+    static size_t shardOf(int key);
+};
@@ -1,11 +1,35 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 #include <sqlite3.h>
 #include <mutex>
 
+// PRAGMA synchronous for the writer connection
+enum class SyncMode {
+    OFF,
+    NORMAL,  // in WAL mode a crash keeps the database intact but may lose the last commits
+    FULL,
+    EXTRA
+};
+
+bool parseSyncMode(const std::string& name, SyncMode& mode);
+const char* syncModeName(SyncMode mode);
+
+// The database is opened in WAL mode: one connection writes while up to
+// readers others read. With 0 readers, or when WAL is unavailable (an
+// in-memory database), reads share the writer connection.
+struct DatabaseConfig {
+    std::string path = "cockpit.db";
+    size_t readers = 4;
+    SyncMode synchronous = SyncMode::NORMAL;
+    int64_t mmapSize = 256 * 1024 * 1024;  // bytes per connection, 0 to read through the page cache
+    int64_t cacheSize = 16 * 1024;         // KiB of page cache per connection
+};
+
 struct User {
     int id;
     std::string username;
@@ -16,6 +40,13 @@ struct User {
     bool is_online;
 };
 
+// Online state as last known to the presence service
+struct PresenceRecord {
+    int user_id;
+    bool online;
+    int64_t last_seen;  // milliseconds since the epoch
+};
+
 struct Message {
     int id;
     int sender_id;
@@ -45,7 +76,38 @@ struct GroupMember {
 
 class Database {
 public:
-    Database(const std::string& dbPath = "cockpit.db");
+    // Every statement the class runs; the SQL is in database.cpp
+    enum class Query {
+        CREATE_USER,
+        USER_BY_USERNAME,
+        USER_BY_ID,
+        UPDATE_ONLINE_STATUS,
+        SAVE_PRESENCE,
+        USER_LAST_SEEN,
+        ALL_USERS,
+        SAVE_MESSAGE,
+        MESSAGES_BETWEEN,
+        GROUP_MESSAGES,
+        MARK_MESSAGE_READ,
+        DELETE_MESSAGE,
+        CREATE_GROUP,
+        ADD_GROUP_MEMBER,
+        REMOVE_GROUP_MEMBER,
+        USER_GROUPS,
+        GROUP_MEMBERS,
+        SAVE_SESSION,
+        SESSION_USER,
+        DELETE_SESSION,
+        COUNT
+    };
+
+    struct Stats {
+        size_t readers;      // read connections open
+        uint64_t reads;      // queries run on them
+        uint64_t readWaits;  // reads that found every reader busy
+    };
+
+    Database(const DatabaseConfig& config = DatabaseConfig());
     ~Database();
 
     bool initialize();
@@ -58,9 +120,17 @@ public:
     User getUserById(int id);
     bool updateUserOnlineStatus(int userId, bool online);
     std::vector<User> getAllUsers();
+    
+    // Presence (PresenceService); savePresence writes the batch in one transaction
+    bool savePresence(const std::vector<PresenceRecord>& records);
+    bool clearOnlineStatus();
+    int64_t getUserLastSeen(int userId);
 
     // Message operations
     bool saveMessage(const Message& message);
+    // One transaction for the batch (MessageWriter). ids gets each message's
+    // row id, or -1 for one that was not stored; false if none were.
+    bool saveMessages(const std::vector<Message>& messages, std::vector<int>& ids);
     std::vector<Message> getMessages(int userId, int otherUserId, int limit = 50);
     std::vector<Message> getGroupMessages(int groupId, int limit = 50);
     bool markMessageAsRead(int messageId);
@@ -78,13 +148,54 @@ public:
     int getUserIdFromSession(const std::string& token);
     bool deleteSession(const std::string& token);
 
+    Stats stats() const;
+
 private:
-    std::string dbPath_;
+    // One connection's statements, each prepared on first use and reused for
+    // the rest of the connection's life; finalized before it closes
+    class StatementCache {
+    public:
+        StatementCache() : db_(nullptr), statements_{} {}
+        ~StatementCache() { clear(); }
+        StatementCache(const StatementCache&) = delete;
+        StatementCache& operator=(const StatementCache&) = delete;
+
+        void attach(sqlite3* db) { db_ = db; }
+        // Null, after logging why, if the SQL does not prepare
+        sqlite3_stmt* get(Query query);
+        void clear();
+
+    private:
+        sqlite3* db_;
+        sqlite3_stmt* statements_[static_cast<size_t>(Query::COUNT)];
+    };
+
+    // A read-only connection, used by one query at a time
+    struct Reader {
+        std::mutex mutex;  // guards db and statements
+        sqlite3* db = nullptr;
+        StatementCache statements;
+    };
+
+    DatabaseConfig config_;
     sqlite3* db_;
     bool initialized_;
-    std::mutex dbMutex_;
+    std::mutex dbMutex_;  // guards db_ and statements_
+    StatementCache statements_;
+
+    std::vector<std::unique_ptr<Reader>> readers_;
+    std::atomic<size_t> nextReader_;
+    std::atomic<uint64_t> reads_;
+    std::atomic<uint64_t> readWaits_;
 
+    // Opens a connection and applies the per-connection tuning
+    sqlite3* open(int flags);
+    bool openReaders();
+    // Locks an idle reader into lock, waiting for one if all are busy; the
+    // writer when there are no readers
+    StatementCache& reader(std::unique_lock<std::mutex>& lock);
     bool createTables();
+    bool hasColumn(const char* table, const char* column);
     bool createIndexes();
     std::string encryptData(const std::string& data);
     std::string decryptData(const std::string& encryptedData);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "io_backend.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Readiness-based backend: every socket is registered edge-triggered for both
+// directions and reads drain until EAGAIN. Plaintext writes are queued in
+// WebSocketConnection::outbound and each connection written to during a loop
+// iteration is flushed once, right before the loop waits again, so a burst
+// of frames leaves in one sendmsg(); what the kernel refuses waits for the
+// next EPOLLOUT edge. With TLS the same edges drive OpenSSL, which reads and
+// writes the socket itself; once kTLS has taken over encryption, writes go
+// back to plain sendmsg().
+class EpollBackend : public IoBackend {
+public:
+    EpollBackend(EventLoop* loop, IoCallbacks callbacks);
+
+    bool initialize() override;
+    IoBackendType type() const override { return IoBackendType::EPOLL; }
+
+    bool addListener(int listenSocket, AcceptCallback onAccept) override;
+    bool attach(const std::shared_ptr<WebSocketConnection>& conn) override;
+    void close(const std::shared_ptr<WebSocketConnection>& conn) override;
+    void abort(const std::shared_ptr<WebSocketConnection>& conn) override;
+    bool writev(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count) override;
+    bool writeShared(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& buffer,
+                     uint64_t coalesceKey) override;
+
+private:
+    // Queued segments handed to one sendmsg() while draining outbound
+    static constexpr int FLUSH_IOVECS = 64;
+
+    std::vector<std::shared_ptr<WebSocketConnection>> scheduled_;  // loop thread only
+
+    void acceptConnections(int listenSocket, const AcceptCallback& onAccept);
+    void onSocketEvent(const std::shared_ptr<WebSocketConnection>& conn, uint32_t events);
+    bool readSocket(const std::shared_ptr<WebSocketConnection>& conn, bool discard);
+    bool readTls(const std::shared_ptr<WebSocketConnection>& conn, bool discard);
+    // Caller holds writeMutex. writeTlsDirect encrypts straight to the socket
+    // while nothing is queued and reports how far it got.
+    bool writeTls(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count);
+    bool writeTlsDirect(const std::shared_ptr<WebSocketConnection>& conn, const char* data, size_t size,
+                        size_t& offset);
+    // Caller holds writeMutex; queues the connection for flushScheduled()
+    void scheduleFlush(const std::shared_ptr<WebSocketConnection>& conn);
+    // Pre-wait hook: one flush per connection written to since the last wait
+    void flushScheduled();
+    bool flushTls(const std::shared_ptr<WebSocketConnection>& conn);
+    void flushOutbound(const std::shared_ptr<WebSocketConnection>& conn);
+    void finishClose(const std::shared_ptr<WebSocketConnection>& conn);
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include "timer_wheel.h"
+
+// Edge-triggered epoll reactor. One EventLoop is driven by exactly one thread;
+// fd registration and callbacks only happen on that thread. Other threads hand
+// work to the loop through post().
+class EventLoop {
+public:
+    using EventCallback = std::function<void(uint32_t events)>;
+    using Task = std::function<void()>;
+    using TimerId = TimerWheel::TimerId;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool initialize();
+    void run();
+    void stop();
+
+    // Must be called from the loop thread (use post() otherwise)
+    bool add(int fd, uint32_t events, EventCallback callback);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Queue a task to run on the loop thread and wake the loop
+    void post(Task task);
+    // Run immediately when already on the loop thread, otherwise post()
+    void runInLoop(Task task);
+    bool isInLoopThread() const { return std::this_thread::get_id() == threadId_; }
+
+    // Called on the loop thread right before every wait, e.g. to submit I/O
+    // that was queued while handling the previous batch
+    void setPreWaitHook(Task hook) { preWaitHook_ = std::move(hook); }
+
+    // One-shot timers on a 10ms wheel, loop thread only. Both calls are O(1);
+    // cancelling an id that already fired (or 0) does nothing.
+    TimerId runAfter(std::chrono::milliseconds delay, Task task);
+    void cancelTimer(TimerId id);
+    size_t timerCount() const { return timers_.size(); }
+
+    size_t watchedCount() const { return watchers_.size(); }
+
+private:
+    // epoll_event.data.ptr points at the watcher, so a stale event for an fd that
+    // was removed (and possibly reused) earlier in the same batch is skipped.
+    struct Watcher {
+        int fd;
+        EventCallback callback;
+        bool active;
+    };
+
+    int epollFd_;
+    int wakeFd_;
+    std::atomic<bool> running_;
+    std::thread::id threadId_;
+
+    std::unordered_map<int, std::unique_ptr<Watcher>> watchers_;
+    std::vector<std::unique_ptr<Watcher>> retired_;
+    std::vector<Task> pendingTasks_;
+    std::mutex tasksMutex_;
+    Task preWaitHook_;
+
+    using Clock = TimerWheel::Clock;
+    TimerWheel timers_;
+
+    int nextTimeoutMs() const;
+    void runExpiredTimers();
+    void wakeup();
+    void drainWakeup();
+    void runPendingTasks();
+};
@@ -3,12 +3,17 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
 #include "database.h"
 
 class GroupChat {
 public:
     GroupChat(std::shared_ptr<Database> database);
     
+    // Called after a member was added (true) or removed (false)
+    using MembershipCallback = std::function<void(int groupId, int userId, bool member)>;
+    void setMembershipCallback(MembershipCallback callback);
+    
     // Group management
     bool createGroup(const std::string& name, const std::string& description, int creatorId);
     bool deleteGroup(int groupId, int userId);
@@ -31,4 +36,5 @@ public:
 
 private:
     std::shared_ptr<Database> database_;
+    MembershipCallback membershipCallback_;
 }; 
\ No newline at end of file
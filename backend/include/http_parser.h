@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A parsed HTTP/1.x request. All views point into the buffer that was handed to
+// HttpParser::parse and stay valid until that buffer is modified.
+struct HttpRequest {
+    std::string_view method;
+    std::string_view target;   // path plus optional query, as sent
+    std::string_view path;
+    std::string_view query;    // without the leading '?'
+    int versionMinor = 1;      // HTTP/1.<versionMinor>
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+    std::string_view body;
+
+    // Case-insensitive lookup; empty when the header is absent
+    std::string_view header(std::string_view name) const;
+    // True if a comma-separated header (Connection, Upgrade, ...) lists token
+    bool headerHasToken(std::string_view name, std::string_view token) const;
+};
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+// Resumable HTTP/1.x request parser. The caller keeps appending received bytes
+// to one buffer and calls parse() with the whole buffer each time; scanning
+// resumes where the previous call stopped, so no byte is looked at twice.
+// Positions are kept as offsets so the buffer may reallocate between calls.
+class HttpParser {
+public:
+    enum class Result {
+        INCOMPLETE,  // need more bytes
+        COMPLETE,    // request() is valid, consumed() bytes belong to it
+        ERROR        // errorStatus() holds the HTTP status to answer with
+    };
+
+    explicit HttpParser(size_t maxHeaderSize = 8192, size_t maxBodySize = 1024 * 1024);
+
+    Result parse(const char* data, size_t size);
+
+    const HttpRequest& request() const { return request_; }
+    size_t consumed() const { return headerEnd_ + contentLength_; }
+    int errorStatus() const { return errorStatus_; }
+
+    // Ready for the next request on the same connection; the caller drops the
+    // consumed() bytes from the front of its buffer first.
+    void reset();
+
+private:
+    enum class State {
+        REQUEST_LINE,
+        HEADERS,
+        BODY,
+        COMPLETE,
+        ERROR
+    };
+
+    struct Span {
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    State state_;
+    size_t maxHeaderSize_;
+    size_t maxBodySize_;
+    size_t lineStart_;      // start of the line being scanned
+    size_t scanned_;        // bytes already searched for a line end
+    size_t headerEnd_;      // offset just past the blank line
+    size_t contentLength_;
+    bool hasContentLength_;
+    int errorStatus_;
+
+    Span method_;
+    Span target_;
+    std::vector<std::pair<Span, Span>> headerSpans_;
+    HttpRequest request_;
+
+    Result fail(int status);
+    bool parseRequestLine(const char* line, size_t offset, size_t length);
+    bool parseHeaderLine(const char* line, size_t offset, size_t length);
+    void buildRequest(const char* data);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+// Header blocks that never change, rendered once. Each line ends in CRLF.
+namespace HttpHeaders {
+extern const std::string_view JSON;            // Content-Type + CORS origin
+extern const std::string_view TEXT;            // Content-Type: text/plain
+extern const std::string_view CORS;            // full CORS set (origin, methods, headers, max-age)
+extern const std::string_view JSON_CORS;       // Content-Type + full CORS set
+}
+
+// An HTTP/1.1 response kept as separate pieces so it can go out with one
+// gather write: a small per-response head (status line, Content-Length,
+// Connection and any extra headers), a static header block, the blank line
+// and the body. The body is moved in, never copied to prepend headers.
+class HttpResponse {
+public:
+    static constexpr int IOVEC_COUNT = 4;
+
+    // status is "200 OK" style; staticHeaders must outlive the response
+    HttpResponse(std::string_view status, std::string_view staticHeaders = std::string_view());
+    HttpResponse(const HttpResponse&) = delete;
+    HttpResponse& operator=(const HttpResponse&) = delete;
+
+    void addHeader(std::string_view name, std::string_view value);
+    void setBody(std::string body);
+    void setStaticBody(std::string_view body);  // must outlive the response
+    void setKeepAlive(bool keepAlive) { keepAlive_ = keepAlive; }
+    bool keepAlive() const { return keepAlive_; }
+
+    // Completes the head and fills IOVEC_COUNT entries; the response must not
+    // change or go away until they have been written
+    int toIovecs(struct iovec* iov);
+
+private:
+    std::string head_;
+    std::string_view staticHeaders_;
+    std::string ownedBody_;
+    std::string_view body_;
+    bool keepAlive_;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <sys/uio.h>
+#include "outbound_queue.h"
+
+class EventLoop;
+class TlsContext;
+struct WebSocketConnection;
+
+enum class IoBackendType {
+    EPOLL,  // readiness-based recv()/send() on edge-triggered epoll
+    URING   // completion-based io_uring with multishot accept/recv
+};
+
+bool parseIoBackendType(const std::string& name, IoBackendType& type);
+const char* ioBackendName(IoBackendType type);
+bool ioBackendSupportsTls(IoBackendType type);
+
+// Hooks from the socket layer into the protocol layer. All of them run on the
+// connection's loop thread.
+struct IoCallbacks {
+    // New bytes were appended to conn->inbound
+    std::function<void(const std::shared_ptr<WebSocketConnection>&)> onData;
+    // The peer went away or the socket failed
+    std::function<void(const std::shared_ptr<WebSocketConnection>&)> onDisconnect;
+};
+
+// Socket I/O for every connection owned by one EventLoop. The protocol code only
+// sees WebSocketConnection::inbound and write()/close(), so it does not care
+// whether bytes move through recv()/send() or io_uring completions.
+class IoBackend {
+public:
+    using AcceptCallback = std::function<void(int clientSocket, const std::string& remoteAddress)>;
+
+    IoBackend(EventLoop* loop, IoCallbacks callbacks)
+        : loop_(loop), callbacks_(std::move(callbacks)), tls_(nullptr), sendCalls_(0) {}
+    virtual ~IoBackend() = default;
+
+    static std::unique_ptr<IoBackend> create(IoBackendType type, EventLoop* loop, IoCallbacks callbacks);
+
+    virtual bool initialize() = 0;
+    virtual IoBackendType type() const = 0;
+
+    // Loop thread only
+    virtual bool addListener(int listenSocket, AcceptCallback onAccept) = 0;
+    virtual bool attach(const std::shared_ptr<WebSocketConnection>& conn) = 0;
+    // Stops reading, flushes whatever is already queued, then closes the socket
+    virtual void close(const std::shared_ptr<WebSocketConnection>& conn) = 0;
+    // Drops whatever is queued and resets the connection without waiting on
+    // the peer; for peers that stopped reading or responding
+    virtual void abort(const std::shared_ptr<WebSocketConnection>& conn) = 0;
+
+    // Any thread. Returns false once the connection is closing. The pieces go
+    // out back to back in one gather write where the backend can; at most
+    // MAX_IOVECS of them.
+    static constexpr int MAX_IOVECS = 8;
+    virtual bool writev(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count) = 0;
+    
+    bool write(const std::shared_ptr<WebSocketConnection>& conn, const std::string& data) {
+        struct iovec iov = {const_cast<char*>(data.data()), data.size()};
+        return writev(conn, &iov, 1);
+    }
+    // Any thread. Like write(), but whatever cannot go out at once is queued
+    // by reference, so one buffer can be sent to many connections uncopied.
+    // A non-zero coalesceKey marks a droppable update (see OutboundQueue).
+    virtual bool writeShared(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& buffer,
+                             uint64_t coalesceKey = 0) = 0;
+
+    EventLoop* loop() const { return loop_; }
+    // Send system calls (or submissions) made so far, across connections
+    uint64_t sendCalls() const { return sendCalls_.load(std::memory_order_relaxed); }
+
+    // Terminate TLS on every connection attached from now on; set before
+    // listening, and only where ioBackendSupportsTls() says so
+    void setTls(TlsContext* tls) { tls_ = tls; }
+    TlsContext* tls() const { return tls_; }
+
+protected:
+    EventLoop* loop_;
+    IoCallbacks callbacks_;
+    TlsContext* tls_;
+    std::atomic<uint64_t> sendCalls_;
+};
@@ -5,6 +5,8 @@
 #include <functional>
 #include "database.h"
 #include "user_manager.h"
+#include "pubsub_hub.h"
+#include "message_writer.h"
 
 struct MessageEvent {
     std::string type;
@@ -17,17 +19,25 @@ struct MessageEvent {
 class MessageHandler {
 public:
     MessageHandler(std::shared_ptr<Database> database, 
-                  std::shared_ptr<UserManager> userManager);
+                  std::shared_ptr<UserManager> userManager,
+                  std::shared_ptr<PubSubHub> pubsub,
+                  std::shared_ptr<MessageWriter> writer);
     
-    // Message processing
+    // Called with the stored message's id, or -1 if it was not stored
+    using SendCallback = std::function<void(int messageId)>;
+    
+    // Message processing. Both return once the message is queued for the
+    // next group commit (false if it was rejected before that); the message
+    // is published, and done called, from the writer thread after the commit.
     bool sendMessage(int senderId, int receiverId, const std::string& content, 
-                    const std::string& messageType = "text");
+                    const std::string& messageType = "text", SendCallback done = nullptr);
     bool sendGroupMessage(int senderId, int groupId, const std::string& content,
-                         const std::string& messageType = "text");
+                         const std::string& messageType = "text", SendCallback done = nullptr);
     
     // Message retrieval
     std::vector<Message> getConversation(int userId, int otherUserId, int limit = 50);
     std::vector<Message> getGroupMessages(int groupId, int limit = 50);
+    std::vector<Group> getUserGroups(int userId);
     
     // Message status
     bool markMessageAsRead(int messageId);
@@ -40,9 +50,13 @@ public:
 private:
     std::shared_ptr<Database> database_;
     std::shared_ptr<UserManager> userManager_;
+    std::shared_ptr<PubSubHub> pubsub_;
+    std::shared_ptr<MessageWriter> writer_;
     std::function<void(const MessageEvent&)> messageCallback_;
     
     std::string encryptMessage(const std::string& content);
     std::string decryptMessage(const std::string& encryptedContent);
     bool isUserInGroup(int userId, int groupId);
+    // Delivers a stored message to everyone following the topic
+    void publish(const Topic& topic, uint32_t type, const Message& message);
 }; 
\ No newline at end of file
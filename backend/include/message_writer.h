@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "database.h"
+
+// How long inserts wait to share a commit
+struct MessageWriterConfig {
+    size_t maxBatch = 512;                      // messages per transaction
+    std::chrono::microseconds maxDelay{250};    // after the first message of a batch
+};
+
+// Group commit for message inserts. Callers queue a message with a
+// completion; a background thread gathers what arrives within maxDelay of the
+// first queued message, up to maxBatch, stores it in one transaction and
+// completes each message with its row id, or -1 if it was not stored. One
+// commit, and one sync of the log, then covers the whole batch.
+class MessageWriter {
+public:
+    // Runs on the writer thread, after the commit; must not block
+    using Callback = std::function<void(int id)>;
+
+    struct Stats {
+        size_t queued;
+        uint64_t saved;
+        uint64_t failed;
+        uint64_t batches;
+    };
+
+    MessageWriter(std::shared_ptr<Database> database, const MessageWriterConfig& config = MessageWriterConfig());
+    ~MessageWriter();
+    MessageWriter(const MessageWriter&) = delete;
+    MessageWriter& operator=(const MessageWriter&) = delete;
+
+    void start();
+    // Stores what is still queued and joins the thread
+    void stop();
+
+    // Before start() or after stop() the message is stored, and done
+    // called, on the caller's thread
+    void save(Message message, Callback done);
+    // The same with a future; waiting on it blocks for up to maxDelay plus a commit
+    std::future<int> save(Message message);
+
+    Stats stats() const;
+
+private:
+    struct Pending {
+        Message message;
+        Callback done;
+    };
+
+    std::shared_ptr<Database> database_;
+    MessageWriterConfig config_;
+
+    std::mutex mutex_;  // guards queue_, firstQueued_ and running_
+    std::condition_variable wakeup_;
+    std::vector<Pending> queue_;
+    std::chrono::steady_clock::time_point firstQueued_;
+    bool running_;
+    std::thread thread_;
+
+    std::atomic<size_t> queued_;
+    std::atomic<uint64_t> saved_;
+    std::atomic<uint64_t> failed_;
+    std::atomic<uint64_t> batches_;
+
+    void run();
+    void write(std::vector<Pending>& batch);
+};
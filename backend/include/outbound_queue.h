@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+// An immutable, reference-counted buffer such as a WebSocket frame built once
+// and queued on many connections
+using SharedBuffer = std::shared_ptr<const std::string>;
+
+// What a connection does once a peer falls so far behind that its queue
+// passes the high watermark
+enum class OverflowPolicy {
+    DROP_OLDEST,  // discard the oldest queued droppable updates down to the low watermark
+    COALESCE,     // a droppable update replaces the queued one with the same key
+    DISCONNECT    // give up on the peer straight away
+};
+
+bool parseOverflowPolicy(const std::string& name, OverflowPolicy& policy);
+const char* overflowPolicyName(OverflowPolicy policy);
+
+// Per-connection bounds on queued output. 0 for highWatermark means unbounded.
+struct OutboundLimits {
+    size_t highWatermark = 4 * 1024 * 1024;
+    size_t lowWatermark = 1024 * 1024;
+    OverflowPolicy policy = OverflowPolicy::DROP_OLDEST;
+};
+
+// Bytes waiting for a socket, as a list of segments. Small writes are copied
+// into a private tail segment; shared buffers are queued by reference, so a
+// broadcast frame costs each recipient one pointer rather than one copy.
+//
+// A write with a non-zero coalesce key is a droppable update: only the latest
+// one per key matters (a presence change, say), so the overflow policy may
+// discard it, or a newer update with the same key may replace it, as long as
+// none of it has gone out yet. Everything else is delivered or the queue
+// reports overflowed() and the connection has to be given up.
+// Not thread safe; WebSocketConnection::writeMutex guards it.
+class OutboundQueue {
+public:
+    struct Stats {
+        size_t queued;
+        size_t peak;         // deepest the queue has been
+        uint64_t dropped;    // updates discarded under DROP_OLDEST
+        uint64_t coalesced;  // updates replaced by a newer one under COALESCE
+    };
+
+    OutboundQueue() : bytes_(0), keyed_(0), peak_(0), dropped_(0), coalesced_(0), overflowed_(false) {}
+
+    void setLimits(const OutboundLimits& limits) { limits_ = limits; }
+
+    void append(const char* data, size_t size);
+    void append(SharedBuffer buffer, size_t offset = 0, uint64_t coalesceKey = 0);
+
+    bool empty() const { return bytes_ == 0; }
+    size_t size() const { return bytes_; }
+    Stats stats() const { return {bytes_, peak_, dropped_, coalesced_}; }
+    // Past the high watermark with nothing left the policy may drop
+    bool overflowed() const { return overflowed_; }
+
+    // Fills up to max iovecs from the front; returns how many were used
+    int gather(struct iovec* iov, int max) const;
+    // Drops size bytes from the front
+    void consume(size_t size);
+    // Discards everything behind the front segment and clears overflowed().
+    // The front is kept because it may finish a write the socket has
+    // already taken part of, even at offset 0: a backend queues what a
+    // direct send left over as a new segment.
+    void dropUnsent();
+    void clear();
+    void swap(OutboundQueue& other);
+
+private:
+    // Copied writes are packed into one tail segment up to this size
+    static constexpr size_t COPY_SEGMENT_SIZE = 64 * 1024;
+
+    struct Segment {
+        SharedBuffer shared;  // null for a private copy
+        std::string copy;
+        size_t offset = 0;    // bytes already sent
+        uint64_t key = 0;     // coalesce key of a droppable update
+
+        const std::string& data() const { return shared ? *shared : copy; }
+        size_t remaining() const { return data().size() - offset; }
+    };
+
+    std::deque<Segment> segments_;
+    size_t bytes_;
+    size_t keyed_;  // segments with a coalesce key
+    OutboundLimits limits_;
+    size_t peak_;
+    uint64_t dropped_;
+    uint64_t coalesced_;
+    bool overflowed_;
+
+    void erase(std::deque<Segment>::iterator it);
+    void enforceLimits();
+};
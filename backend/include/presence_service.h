@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "wire_protocol.h"
+
+class Database;
+class PubSubHub;
+
+// Who is online, kept in memory: the devices each user has signed in and
+// when the user was last seen. Subscribers of presence:{id} hear when a user
+// comes online or goes offline. Going offline waits OFFLINE_DEBOUNCE, so a
+// device that comes straight back (a page reload, a network handover) is
+// never reported. Changes reach the users table in one transaction every
+// FLUSH_INTERVAL from a background thread, never while a device signs in or out.
+class PresenceService {
+public:
+    static constexpr std::chrono::milliseconds OFFLINE_DEBOUNCE{5000};
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{1000};
+
+    struct Presence {
+        bool online;
+        int devices;
+        int64_t lastSeen;  // milliseconds since the epoch, 0 if never
+    };
+    struct Stats {
+        size_t online;
+        size_t pending;      // users going offline once the debounce passes
+        uint64_t published;  // online/offline changes
+        uint64_t persisted;  // rows written
+        uint64_t batches;
+    };
+
+    PresenceService(std::shared_ptr<Database> database, std::shared_ptr<PubSubHub> pubsub);
+    ~PresenceService();
+    PresenceService(const PresenceService&) = delete;
+    PresenceService& operator=(const PresenceService&) = delete;
+
+    // Marks everyone offline in the database (nobody is connected yet, and
+    // the last run may not have stopped cleanly) and starts the flush thread
+    void start();
+    // Marks everyone offline as of now, writes it and joins the thread
+    void stop();
+
+    // A device signs in or out. Changes are published with the user's shard
+    // locked, so neither may be called from within a delivery.
+    void connected(int userId);
+    void disconnected(int userId);
+
+    Presence get(int userId);
+    // The current state as a presence envelope, e.g. for a new subscriber
+    Envelope snapshot(int userId);
+
+    Stats stats() const;
+
+private:
+    static constexpr size_t SHARDS = 64;  // power of two
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        int devices = 0;
+        bool online = false;   // as last published
+        int64_t lastSeen = 0;
+        bool pending = false;  // in the shard's pending list
+        bool dirty = false;    // in the shard's dirty list
+        Clock::time_point offlineAt;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int, Entry> users;
+        std::vector<int> pending;  // devices dropped to 0, offline not yet published
+        std::vector<int> dirty;    // changed since the last flush
+    };
+
+    std::shared_ptr<Database> database_;
+    std::shared_ptr<PubSubHub> pubsub_;
+    Shard shards_[SHARDS];
+
+    std::mutex runMutex_;
+    std::condition_variable wakeup_;
+    bool running_;
+    std::thread thread_;
+
+    std::atomic<size_t> online_;
+    std::atomic<size_t> pending_;
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> persisted_;
+    std::atomic<uint64_t> batches_;
+
+    Shard& shardOf(int userId);
+    static Envelope envelopeFor(int userId, bool online, int64_t lastSeen);
+    void setOnline(Shard& shard, int userId, Entry& entry, bool online, bool publish);
+    void run();
+    // Publishes offlines whose debounce has passed
+    void expire();
+    void flush();
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "wire_protocol.h"
+
+struct WebSocketConnection;
+
+// A channel connections can follow: "group:{id}", "user:{id}" or "presence:{id}"
+struct Topic {
+    enum class Kind : uint8_t {
+        GROUP = 1,    // messages posted to a group
+        USER = 2,     // everything addressed to one user, on all their devices
+        PRESENCE = 3  // one user's online state
+    };
+
+    Kind kind;
+    int id;
+
+    static Topic group(int id) { return {Kind::GROUP, id}; }
+    static Topic user(int id) { return {Kind::USER, id}; }
+    static Topic presence(int id) { return {Kind::PRESENCE, id}; }
+
+    uint64_t key() const { return (static_cast<uint64_t>(kind) << 32) | static_cast<uint32_t>(id); }
+    std::string name() const;
+    static bool parse(std::string_view name, Topic& topic);
+};
+
+// In-process topic subscriptions. Subscriber lists are copy-on-write: a
+// publish takes a shared lock on one shard just long enough to copy a
+// pointer to the current list, then delivers to it unlocked, so publishing
+// costs O(subscribers) with no database access and never waits on a
+// subscribe elsewhere. Subscribing or unsubscribing rebuilds that topic's list.
+class PubSubHub {
+public:
+    using Subscriber = std::shared_ptr<WebSocketConnection>;
+    using Subscribers = std::vector<Subscriber>;
+    using SubscriberList = std::shared_ptr<const Subscribers>;
+    // Hands one published envelope to the subscribers, of which there may be
+    // none (the delivery can still keep it for them); installed by the
+    // WebSocket layer before the server starts
+    using Delivery = std::function<void(const Topic& topic, const Subscribers& subscribers,
+                                        const Envelope& envelope, uint64_t coalesceKey)>;
+
+    struct Stats {
+        size_t topics;
+        size_t subscriptions;
+        uint64_t published;
+        uint64_t delivered;  // envelopes handed to subscribers
+    };
+
+    PubSubHub();
+    PubSubHub(const PubSubHub&) = delete;
+    PubSubHub& operator=(const PubSubHub&) = delete;
+
+    void setDelivery(Delivery delivery) { delivery_ = std::move(delivery); }
+
+    // False if already subscribed / not subscribed
+    bool subscribe(const Topic& topic, const Subscriber& subscriber);
+    bool unsubscribe(const Topic& topic, const Subscriber& subscriber);
+    // Drops every subscription the connection holds, when it closes
+    void unsubscribeAll(const Subscriber& subscriber);
+
+    SubscriberList subscribers(const Topic& topic) const;
+    // Keys of the topics the connection follows
+    std::vector<uint64_t> topicsOf(const Subscriber& subscriber);
+    // Whether the connection follows the topic, without copying its topics
+    bool isSubscribed(const Topic& topic, const Subscriber& subscriber);
+    // Returns how many subscribers it went to. A non-zero coalesceKey makes
+    // it a droppable update for slow subscribers (OutboundQueue).
+    size_t publish(const Topic& topic, const Envelope& envelope, uint64_t coalesceKey = 0);
+
+    Stats stats() const;
+
+private:
+    static constexpr size_t SHARDS = 64;  // power of two
+
+    struct TopicShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint64_t, SubscriberList> topics;
+    };
+    // Each connection's topics, so closing does not scan every topic
+    struct MemberShard {
+        std::mutex mutex;
+        std::unordered_map<const WebSocketConnection*, std::vector<uint64_t>> topics;
+    };
+
+    TopicShard topics_[SHARDS];
+    MemberShard members_[SHARDS];
+    Delivery delivery_;
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> delivered_;
+
+    TopicShard& topicShard(uint64_t key);
+    const TopicShard& topicShard(uint64_t key) const;
+    MemberShard& memberShard(const WebSocketConnection* subscriber);
+    // Adds or removes one subscriber under the topic shard's lock
+    bool update(uint64_t key, const Subscriber& subscriber, bool add);
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct WebSocketConnection;
+struct HttpRequest;
+
+enum class HttpMethod : uint8_t {
+    GET,
+    HEAD,
+    POST,
+    PUT,
+    PATCH,
+    DELETE,
+    OPTIONS
+};
+
+constexpr size_t HTTP_METHOD_COUNT = 7;
+
+bool parseHttpMethod(std::string_view name, HttpMethod& method);
+const char* httpMethodName(HttpMethod method);
+
+// Path parameters captured by a match, e.g. {"id", "42"} for /messages/{id}.
+// Fixed capacity so a dispatch never allocates; the values point into the
+// request path.
+struct RouteParams {
+    static constexpr size_t MAX_PARAMS = 8;
+
+    std::pair<std::string_view, std::string_view> items[MAX_PARAMS];
+    size_t count = 0;
+
+    // Empty when the route has no such parameter
+    std::string_view get(std::string_view name) const;
+};
+
+// Method + path dispatch for every HTTP endpoint. Patterns are split into '/'
+// segments and stored in a trie whose nodes live in one vector; a segment is
+// either literal text or a {name} parameter, and literals win over
+// parameters. Routes are added during startup only, after which the table is
+// read-only and shared by all I/O loops without locking.
+class Router {
+public:
+    using Handler = std::function<void(const std::shared_ptr<WebSocketConnection>& conn,
+                                       const HttpRequest& request, const RouteParams& params)>;
+
+    enum class Status {
+        FOUND,
+        NOT_FOUND,
+        METHOD_NOT_ALLOWED  // path exists, allowedMethods says which methods do
+    };
+
+    struct Match {
+        Status status = Status::NOT_FOUND;
+        const Handler* handler = nullptr;
+        unsigned allowedMethods = 0;  // bit (1 << HttpMethod) per registered method
+    };
+
+    Router();
+
+    // Returns false (and logs) for malformed or conflicting patterns
+    bool add(HttpMethod method, const std::string& pattern, Handler handler);
+
+    Match match(std::string_view method, std::string_view path, RouteParams& params) const;
+
+    // "GET, POST" style list for an Allow header
+    static std::string allowHeaderValue(unsigned allowedMethods);
+
+private:
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    struct Node {
+        std::vector<std::pair<std::string, uint32_t>> literals;  // segment -> child
+        uint32_t paramChild = NO_NODE;
+        std::string paramName;
+        unsigned methods = 0;
+        Handler handlers[HTTP_METHOD_COUNT];
+    };
+
+    std::vector<Node> nodes_;  // nodes_[0] is the root, i.e. "/"
+
+    uint32_t find(uint32_t node, std::string_view rest, RouteParams& params) const;
+};
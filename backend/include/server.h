@@ -7,19 +7,48 @@
 #include <map>
 #include <mutex>
 #include <functional>
+#include <vector>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "account_integration.h"
+#include "io_backend.h"
+#include "admission_control.h"
+#include "database.h"
+#include "message_writer.h"
+#include "websocket_deflate.h"
+#include "router.h"
 
 class WebSocketHandler;
 class Database;
 class UserManager;
 class MessageHandler;
+class PubSubHub;
+class PresenceService;
+class GroupChat;
+class EventLoop;
+class TlsContext;
+struct HttpRequest;
+
+struct ServerConfig {
+    int port = 8080;
+    int ioThreads = 0;       // 0 = one I/O loop per hardware thread
+    bool reusePort = false;  // one SO_REUSEPORT listener per loop instead of a shared acceptor
+    bool pinThreads = false; // pin I/O loop i to CPU i (mod CPU count)
+    IoBackendType ioBackend = IoBackendType::EPOLL;
+    AdmissionLimits admission;
+    std::string tlsCertFile;  // PEM chain; TLS is on when this and tlsKeyFile are set
+    std::string tlsKeyFile;
+    bool ktls = false;        // let the kernel encrypt records after the handshake
+    DeflateConfig deflate;    // permessage-deflate for WebSocket clients that offer it
+    OutboundLimits outbound;  // per-connection send queue bounds and slow-consumer policy
+    DatabaseConfig database;  // file, read connections and SQLite tuning
+    MessageWriterConfig messageWriter;  // group commit for message inserts
+};
 
 class Server {
 public:
-    Server(int port = 8080);
+    Server(const ServerConfig& config = ServerConfig());
     ~Server();
 
     bool initialize();
@@ -31,21 +60,28 @@ public:
     std::shared_ptr<UserManager> getUserManager() const { return userManager_; }
     std::shared_ptr<MessageHandler> getMessageHandler() const { return messageHandler_; }
     std::shared_ptr<WebSocketHandler> getWebSocketHandler() const { return wsHandler_; }
+    std::shared_ptr<GroupChat> getGroupChat() const { return groupChat_; }
 
-    // HTTP request handling
-    void handleRequest(const std::string& request, std::string& response);
-    void parseRequest(const std::string& request, std::string& method, std::string& path, std::map<std::string, std::string>& headers, std::string& body);
+    // Route handlers; the JSON body they leave in response is sent with 200 OK
+    using RouteHandler = void (Server::*)(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleAuthRoutes(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleUserRoutes(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleMessageRoutes(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleGroupRoutes(const HttpRequest& request, const RouteParams& params, std::string& response);
+    
+    // Account integration routes
+    void handleGetAccounts(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleConnectGmail(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleConnectWhatsApp(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleGetUnifiedMessages(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleSyncAccount(const HttpRequest& request, const RouteParams& params, std::string& response);
     
-    // Route handlers
-    void handleAuthRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response);
-    void handleUserRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response);
-    void handleMessageRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response);
-    void handleGroupRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response);
-    void handleAccountIntegrationRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response);
+    // Operational counters
+    void handleConnectionStats(const HttpRequest& request, const RouteParams& params, std::string& response);
+    void handleQueueStats(const HttpRequest& request, const RouteParams& params, std::string& response);
     
-    // CORS and utility functions
-    void addCORSHeaders(std::string& response);
-    std::string getAuthToken(const std::map<std::string, std::string>& headers);
+    // Utility functions
+    std::string getAuthToken(const HttpRequest& request);
     bool validateToken(const std::string& token, std::string& userId);
     
     // JSON helpers
@@ -53,29 +89,45 @@ public:
     std::string createErrorResponse(const std::string& error);
 
 private:
+    static constexpr size_t MAX_LISTED_QUEUES = 100;  // per-connection entries in /status/queues
+    
+    ServerConfig config_;
     int port_;
-    int serverSocket_;
     std::atomic<bool> running_;
-    std::thread serverThread_;
     
     // Components
     std::shared_ptr<Database> database_;
     std::shared_ptr<UserManager> userManager_;
+    std::shared_ptr<PubSubHub> pubsub_;
+    std::shared_ptr<PresenceService> presence_;
+    std::shared_ptr<MessageWriter> messageWriter_;
     std::shared_ptr<MessageHandler> messageHandler_;
     std::shared_ptr<WebSocketHandler> wsHandler_;
+    std::shared_ptr<GroupChat> groupChat_;
     
-    // Connection management
-    std::map<int, std::thread> clientThreads_;
-    std::mutex clientMutex_;
+    // Shared by every backend and outlives them; null for plaintext
+    std::unique_ptr<TlsContext> tls_;
     
-    AccountIntegrationManager accountManager;
+    // I/O loops; loops_[0] runs on the thread that calls run(), the rest on
+    // ioThreads_. With reusePort every loop owns a listener, otherwise loops_[0]
+    // owns the only one and distributes accepted sockets.
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<std::unique_ptr<IoBackend>> backends_;  // backends_[i] drives loops_[i]
+    std::vector<int> listenSockets_;
+    std::vector<std::thread> ioThreads_;
+    size_t nextLoop_;
     
-    // Route mapping
-    std::map<std::string, std::function<void(const std::string&, const std::string&, const std::string&, std::string&)>> routes;
+    AccountIntegrationManager accountManager;
     
     bool setupSocket();
-    void acceptConnections();
-    void handleClient(int clientSocket);
+    void checkDescriptorLimit();
+    int createListener();
+    bool setupTls();
+    bool setupLoops();
+    void onAccept(int clientSocket, const std::string& remoteAddress, size_t loopIndex);
+    void pinCurrentThread(size_t loopIndex);
     void cleanup();
     void setupRoutes();
+    // A localOnly route answers 403 to anyone not connecting over loopback
+    void addRoute(HttpMethod method, const std::string& pattern, RouteHandler handler, bool localOnly = false);
 }; 
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "outbound_queue.h"
+#include "wire_protocol.h"
+
+// Each user's stream of reliable events (messages, as opposed to droppable
+// updates such as presence): a sequence number per event and a bounded ring
+// of the most recent ones, so a client that reconnects can name the last
+// sequence it saw and get exactly the gap replayed.
+//
+// A journal lives while the user has a device attached and for RESUME_WINDOW
+// after the last one detaches. While parked it keeps recording what is
+// published on the topics that device followed. Sequences start at the
+// microsecond clock when a journal is created, so they keep increasing across
+// restarts and expiry, and a stale sequence always reads as a gap.
+class SessionJournal {
+public:
+    static constexpr size_t MAX_EVENTS = 256;                   // per user
+    static constexpr size_t MAX_BYTES = 256 * 1024;             // of bodies, per user
+    static constexpr std::chrono::seconds RESUME_WINDOW{120};   // after the last device leaves
+
+    struct Stats {
+        size_t users;
+        size_t parked;  // users with no device attached, within the window
+        size_t events;
+    };
+
+    // Called with the user's journal locked, so events recorded for the user
+    // concurrently are either in missed or arrive after everything sent here
+    using AttachCallback = std::function<void(uint64_t lastSeq, bool resumed, const std::vector<Envelope>& missed)>;
+    using RecordCallback = std::function<void(const Envelope& stamped)>;
+
+    SessionJournal();
+    SessionJournal(const SessionJournal&) = delete;
+    SessionJournal& operator=(const SessionJournal&) = delete;
+
+    // A device signs in. With afterSeq 0 nothing is replayed; otherwise
+    // resumed says whether every event after afterSeq was still in the ring
+    // (they are in missed), or the client has to sync in full.
+    void attach(int userId, uint64_t afterSeq, const AttachCallback& callback);
+    // A device signs out. With no devices left, the journal is parked on the
+    // given topic keys (PubSubHub) until the resume window passes.
+    void detach(int userId, std::vector<uint64_t> topics);
+
+    // Stamps the next sequence on the envelope, keeps it and calls back with
+    // the journal still locked, so callers queue events in sequence order
+    void record(int userId, const Envelope& envelope, const RecordCallback& callback);
+    // Appends the parked users following the topic
+    void parkedOn(uint64_t topic, std::vector<int>& users);
+
+    Stats stats();
+
+private:
+    static constexpr size_t SHARDS = 64;  // power of two
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        Envelope envelope;     // body points into text
+        SharedBuffer text;
+    };
+    struct UserJournal {
+        uint64_t lastSeq;
+        std::deque<Event> events;  // oldest first
+        size_t bytes = 0;
+        int devices = 0;
+        std::vector<uint64_t> parkedTopics;
+        Clock::time_point parkedUntil;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int, UserJournal> users;
+    };
+
+    Shard shards_[SHARDS];
+
+    // Parked users by topic; locked after a shard, never before
+    std::mutex parkedMutex_;
+    std::unordered_map<uint64_t, std::vector<int>> parked_;
+    std::atomic<size_t> parkedUsers_;
+    std::atomic<int64_t> lastSweep_;  // milliseconds on Clock
+
+    Shard& shardOf(int userId);
+    UserJournal& journalFor(Shard& shard, int userId);
+    void unpark(int userId, UserJournal& journal);
+    // Drops parked journals past the window, at most once a second
+    void sweep();
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hierarchical hashed timer wheel (four levels of 64 slots, as in the classic
+// kernel timer design). Insert and cancel are O(1): a timer goes straight into
+// the slot for its expiry tick at the coarsest level that covers its delay, and
+// is moved to finer levels as that slot comes due. Timers live in a pooled
+// node array and a TimerId encodes the node index plus a generation, so
+// cancelling a timer that already fired or was cancelled is a harmless no-op.
+// Not thread safe; owned by one EventLoop.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Task = std::function<void()>;
+    using TimerId = uint64_t;  // never 0
+
+    explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(10));
+
+    TimerId schedule(Clock::time_point now, Clock::duration delay, Task task);
+    void cancel(TimerId id);
+
+    // Pops one timer that is due at now; call until it returns false
+    bool popExpired(Clock::time_point now, Task& task);
+
+    // Earliest time the wheel needs attention (an expiry or a cascade), or
+    // Clock::time_point::max() when it is empty
+    Clock::time_point nextDeadline() const;
+
+    size_t size() const { return count_; }
+
+private:
+    static constexpr unsigned LEVELS = 4;
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        Task task;
+        uint64_t expires = 0;      // tick
+        uint32_t generation = 1;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        bool linked = false;
+    };
+
+    Clock::time_point start_;
+    Clock::duration tick_;
+    uint64_t currentTick_;   // next tick to process
+    uint64_t cascadedTick_;  // last tick whose cascade has been done
+    size_t count_;
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> freeNodes_;
+    uint32_t heads_[LEVELS][SLOTS];
+    uint64_t occupied_[LEVELS];  // bit per non-empty slot
+
+    uint64_t tickAt(Clock::time_point time) const;
+    uint64_t nextEventTick() const;
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(uint64_t tick);
+};
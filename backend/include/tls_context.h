@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <openssl/ssl.h>
+
+class TlsSession;
+
+// Server-side TLS settings shared by every I/O loop. One SSL_CTX means one
+// session cache and one set of ticket keys, so a client resumes its session
+// no matter which loop accepts the reconnect.
+class TlsContext {
+public:
+    struct Stats {
+        uint64_t handshakes = 0;   // completed, full or resumed
+        uint64_t resumed = 0;      // from a session ticket or the session cache
+        uint64_t kernelSend = 0;   // sessions whose records the kernel encrypts
+    };
+
+    TlsContext();
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // enableKtls asks OpenSSL to hand record encryption to the kernel after
+    // the handshake; it quietly stays in userspace where that is unsupported
+    bool initialize(const std::string& certFile, const std::string& keyFile, bool enableKtls);
+
+    // Server session over a connected non-blocking socket; null on failure
+    std::unique_ptr<TlsSession> createSession(int socket);
+
+    Stats stats() const;
+    bool ktlsEnabled() const { return ktls_; }
+
+private:
+    SSL_CTX* ctx_;
+    bool ktls_;
+
+    friend class TlsSession;
+    std::atomic<uint64_t> kernelSendSessions_;
+};
+
+// One connection's TLS state. OpenSSL reads and writes the socket itself, so
+// the owner calls read()/write() where it would call recv()/send() and maps
+// WANT_READ/WANT_WRITE onto its readiness events. Not thread safe; callers
+// serialize on the connection's write lock.
+class TlsSession {
+public:
+    enum class Status {
+        OK,
+        WANT_READ,   // retry once the socket is readable
+        WANT_WRITE,  // retry once the socket is writable
+        CLOSED,      // the peer sent close_notify or went away
+        ERROR
+    };
+
+    TlsSession(TlsContext* context, SSL* ssl);
+    ~TlsSession();
+
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+
+    // Drives the handshake first; bytesRead is set on OK
+    Status read(char* buffer, size_t size, size_t& bytesRead);
+    // Returns WANT_WRITE with the record buffered inside OpenSSL; the retry
+    // must pass the same bytes again, possibly from a moved buffer
+    Status write(const char* data, size_t size, size_t& written);
+    // Best-effort close_notify; never waits for the peer's
+    void shutdown();
+
+    bool handshakeDone() const { return SSL_is_init_finished(ssl_); }
+    // The kernel encrypts outgoing records, so plaintext can be written to the
+    // socket directly with no copy through OpenSSL. Not while OpenSSL still
+    // holds a record of its own (a ticket, an alert) that has to go first.
+    bool kernelSend() const { return kernelSend_ && !readWantsWrite; }
+
+    // A read returned WANT_WRITE and has to be repeated on the next writable edge
+    bool readWantsWrite;
+
+private:
+    TlsContext* context_;
+    SSL* ssl_;
+    bool handshakeCounted_;
+    bool kernelSend_;
+
+    Status status(int result);
+    void onHandshakeDone();
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "websocket_mask.h"
+
+namespace WebSocketOpcode {
+constexpr uint8_t CONTINUATION = 0x0;
+constexpr uint8_t TEXT = 0x1;
+constexpr uint8_t BINARY = 0x2;
+constexpr uint8_t CLOSE = 0x8;
+constexpr uint8_t PING = 0x9;
+constexpr uint8_t PONG = 0xA;
+}
+
+namespace WebSocketCloseCode {
+constexpr uint16_t NORMAL = 1000;
+constexpr uint16_t PROTOCOL_ERROR = 1002;
+constexpr uint16_t INVALID_PAYLOAD = 1007;
+constexpr uint16_t POLICY_VIOLATION = 1008;
+constexpr uint16_t MESSAGE_TOO_BIG = 1009;
+}
+
+// Stateful decoder for the client-to-server frame stream (RFC 6455 section 5).
+// The caller hands it everything received so far; a frame is only taken once
+// it is complete, so a large frame arriving over many reads is not touched
+// until its last byte is in. Payloads are unmasked in place and, for messages
+// that come in one frame, returned as a view into the caller's buffer.
+// Fragmented messages are reassembled across calls; control frames may arrive
+// between their fragments.
+class WebSocketDecoder {
+public:
+    enum class Result {
+        INCOMPLETE,  // need more bytes
+        MESSAGE,     // opcode() is TEXT or BINARY, payload() the whole message
+        CONTROL,     // opcode() is CLOSE, PING or PONG
+        ERROR        // closeCode() says why; the stream cannot continue
+    };
+
+    explicit WebSocketDecoder(size_t maxMessageSize = 1024 * 1024);
+
+    // Decodes frames from the front of data until one message or control
+    // frame is complete. data is modified (unmasked). consumed() is valid for
+    // every result, including INCOMPLETE after swallowing leading fragments.
+    Result decode(char* data, size_t size);
+
+    size_t consumed() const { return consumed_; }
+    uint8_t opcode() const { return opcode_; }
+    // Valid until the next decode() call or until the buffer changes
+    std::string_view payload() const { return payload_; }
+    uint16_t closeCode() const { return closeCode_; }
+    size_t maxMessageSize() const { return maxMessageSize_; }
+    // The MESSAGE had RSV1 set on its first frame: payload() is still deflated
+    bool compressed() const { return compressed_; }
+
+    // Lets RSV1 through on data messages once permessage-deflate is negotiated
+    void allowCompression(bool allow) { compressionAllowed_ = allow; }
+
+    void reset();
+
+private:
+    size_t maxMessageSize_;
+    size_t consumed_;
+    uint8_t opcode_;
+    std::string_view payload_;
+    uint16_t closeCode_;
+    bool compressed_;
+    bool compressionAllowed_;
+
+    // Fragmented message in progress
+    uint8_t fragmentOpcode_;  // CONTINUATION when none
+    bool fragmentCompressed_;
+    std::string fragments_;
+
+    Result fail(uint16_t code);
+};
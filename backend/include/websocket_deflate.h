@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+// Server policy for permessage-deflate (RFC 7692)
+struct DeflateConfig {
+    bool enabled = true;
+    size_t memoryLimit = 128 * 1024;  // zlib state per connection, both directions
+    size_t minSize = 256;             // smaller messages go out uncompressed
+    bool contextTakeover = true;      // keep the compression window between outgoing messages
+};
+
+// One connection's negotiated permessage-deflate state. The zlib streams are
+// created on first use, so a connection that never sends or receives a large
+// message costs nothing beyond this object. Not thread safe: compress() and
+// decompress() each need their own serialization.
+class PerMessageDeflate {
+public:
+    struct Params {
+        int serverWindowBits = 15;            // our compressor
+        int clientWindowBits = 15;            // the client's compressor, so our decompressor
+        bool serverNoContextTakeover = false;
+        bool clientNoContextTakeover = false;
+    };
+
+    enum class InflateResult {
+        OK,
+        TOO_BIG,  // the message inflates past the limit
+        ERROR     // not a valid deflate stream
+    };
+
+    // Accepts the first offer in a Sec-WebSocket-Extensions value that fits
+    // the config and fills response with the matching extension parameters.
+    // Null when there is no usable offer, or none fits the memory limit.
+    static std::unique_ptr<PerMessageDeflate> negotiate(std::string_view offers, const DeflateConfig& config,
+                                                        std::string& response);
+
+    PerMessageDeflate(const Params& params, size_t minSize);
+    ~PerMessageDeflate();
+
+    PerMessageDeflate(const PerMessageDeflate&) = delete;
+    PerMessageDeflate& operator=(const PerMessageDeflate&) = delete;
+
+    // Compresses one whole message into out (replacing its contents). False
+    // when the message should go out as is: below the size threshold, or it
+    // did not shrink.
+    bool compress(std::string_view payload, std::string& out);
+    // Inflates one whole message received with RSV1 set
+    InflateResult decompress(std::string_view payload, size_t maxSize, std::string& out);
+
+    const Params& params() const { return params_; }
+    // Messages below the threshold always go out as they are
+    bool worthCompressing(size_t size) const { return size >= minSize_; }
+
+    // zlib memory for the given window sizes, as documented in zconf.h
+    static size_t memoryFor(int serverWindowBits, int clientWindowBits);
+
+private:
+    Params params_;
+    size_t minSize_;
+    z_stream deflate_;
+    z_stream inflate_;
+    bool deflateReady_;
+    bool inflateReady_;
+
+    bool ensureDeflate();
+    bool ensureInflate();
+};
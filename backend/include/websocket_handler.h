@@ -3,6 +3,9 @@
 #include <string>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <chrono>
+#include <vector>
 #include <memory>
 #include <functional>
 #include <thread>
@@ -11,76 +14,220 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include "io_backend.h"
+#include "http_parser.h"
+#include "router.h"
+#include "http_response.h"
+#include "admission_control.h"
+#include "tls_context.h"
+#include "websocket_decoder.h"
+#include "websocket_deflate.h"
+#include "connection_registry.h"
+#include "wire_protocol.h"
+#include "pubsub_hub.h"
+#include "session_journal.h"
 
 class MessageHandler;
 class UserManager;
+class PresenceService;
+class EventLoop;
 
-struct WebSocketFrame {
-    bool fin;
-    uint8_t opcode;
-    bool masked;
-    uint64_t payload_length;
-    std::string payload;
-    std::string masking_key;
+// Rate limit state of one kind of signal in one conversation
+struct SignalSlot {
+    std::chrono::steady_clock::time_point nextAllowed;
+    bool held = false;    // one is waiting for nextAllowed
+    uint64_t target = 0;  // of the latest one
+};
+
+enum class ConnectionState {
+    HTTP,       // waiting for / handling an HTTP request
+    WEBSOCKET,  // upgraded, exchanging frames
+    CLOSED
 };
 
 struct WebSocketConnection {
     int socket;
     std::string remote_address;
-    int user_id;
+    std::atomic<int> user_id;   // -1 until signed in
     bool authenticated;
     std::string username;
-    std::thread read_thread;
     std::atomic<bool> active;
     
-    WebSocketConnection(int sock, const std::string& addr) 
+    // I/O state. Everything except outbound is only touched on the owning loop.
+    IoBackend* io;
+    EventLoop* loop;
+    ConnectionState state;
+    std::string inbound;        // received bytes not yet consumed
+    HttpParser http;            // request parser state over inbound (8KB headers, 1MB body)
+    WebSocketDecoder frames;    // frame decoder over inbound once upgraded (1MB messages)
+    bool keepAlive;             // the current HTTP response leaves the connection open
+    bool httpIdle;              // between requests; the keep-alive idle timeout applies
+    unsigned requestCount;      // HTTP requests served on this connection
+    bool handshakePending;      // counts against the pending handshake budget
+    uint64_t timer;             // request/idle deadline or WebSocket liveness check, 0 if none
+    bool awaitingPong;          // a ping went out and nothing has come back yet
+    uint64_t lastBytesSent;     // bytesSent at the previous liveness check
+    std::atomic<uint64_t> bytesSent;  // advanced by the backend as the socket accepts data
+    OutboundQueue outbound;     // bytes queued for the backend to send, bounded by OutboundLimits
+    std::mutex writeMutex;      // guards outbound, writeScheduled and active transitions
+    bool writeScheduled;        // a backend flush for outbound is pending
+    bool socketClosed;          // the backend has closed the fd
+    std::unique_ptr<TlsSession> tls;  // null for plaintext; guarded like outbound
+    std::unique_ptr<PerMessageDeflate> deflate;  // null unless negotiated at the upgrade
+    std::mutex deflateMutex;    // one compressed message at a time, queued in compression order
+    WireFormat format;          // envelope encoding chosen at the upgrade
+    std::unordered_map<uint64_t, SignalSlot> signals;  // by type and conversation; loop thread only
+    
+    WebSocketConnection(int sock, const std::string& addr, IoBackend* backend) 
         : socket(sock), remote_address(addr), user_id(-1), 
-          authenticated(false), active(true) {}
+          authenticated(false), active(true), io(backend), loop(backend->loop()),
+          state(ConnectionState::HTTP), keepAlive(false), httpIdle(false), requestCount(0),
+          handshakePending(true), timer(0),
+          awaitingPong(false), lastBytesSent(0), bytesSent(0),
+          writeScheduled(false), socketClosed(false), format(WireFormat::PLAIN) {}
 };
 
 class WebSocketHandler {
 public:
+    // One connection's send queue, for monitoring
+    struct QueueInfo {
+        std::string address;
+        int userId;
+        OutboundQueue::Stats stats;
+    };
+    struct SignalStats {
+        uint64_t received;
+        uint64_t published;
+        uint64_t coalesced;  // replaced by a later one before it went out
+        uint64_t dropped;    // no slot left on the connection
+    };
+
     WebSocketHandler(std::shared_ptr<MessageHandler> msgHandler, 
-                    std::shared_ptr<UserManager> userManager);
+                    std::shared_ptr<UserManager> userManager,
+                    std::shared_ptr<PubSubHub> pubsub,
+                    std::shared_ptr<PresenceService> presence);
     ~WebSocketHandler();
 
-    void handleConnection(int clientSocket, const std::string& remoteAddress);
-    void broadcastMessage(const std::string& message, const std::set<int>& userIds);
+    // Takes ownership of a non-blocking socket; I/O runs on the backend's loop
+    void handleConnection(int clientSocket, const std::string& remoteAddress, IoBackend* io);
+    
+    // Entry points for the socket layer
+    IoCallbacks ioCallbacks();
+    
+    // Every HTTP endpoint, including the WebSocket upgrade. Other components
+    // add their routes before the server starts.
+    Router& router() { return router_; }
+    AdmissionControl& admission() { return admission_; }
+    void setDeflateConfig(const DeflateConfig& config) { deflateConfig_ = config; }
+    void setOutboundLimits(const OutboundLimits& limits) { outboundLimits_ = limits; }
+    const OutboundLimits& outboundLimits() const { return outboundLimits_; }
+    std::vector<QueueInfo> queueStats();
+    SignalStats signalStats() const;
+    void sendJsonResponse(std::shared_ptr<WebSocketConnection> conn, std::string body,
+                          const std::string& status = "200 OK");
+    // A non-zero coalesceKey marks the message as a droppable update that a
+    // slow recipient may skip or receive only the latest of (OutboundQueue)
+    void broadcastMessage(const std::string& message, const std::set<int>& userIds, uint64_t coalesceKey = 0);
+    // Reach every device the user is signed in on
     void sendToUser(int userId, const std::string& message);
     void disconnectUser(int userId);
+    // Encodes the envelope in the connection's negotiated format
+    void sendEnvelope(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
     
-    // Connection management
+    // Connection management. A user may hold several connections at once;
+    // addConnection signs one more in and subscribes it to user:{id} and the
+    // user's groups, removeConnection forgets all of them.
     void addConnection(int userId, std::shared_ptr<WebSocketConnection> conn);
     void removeConnection(int userId);
+    // The user's most recently signed-in connection, or null
     std::shared_ptr<WebSocketConnection> getConnection(int userId);
+    const ConnectionRegistry& registry() const { return registry_; }
+    SessionJournal& journal() { return journal_; }
+    // Subscribes on the connection's loop, so it cannot race with the close
+    void subscribe(const std::shared_ptr<WebSocketConnection>& conn, const Topic& topic);
+    // Follow a membership change on every device the user is signed in on;
+    // sign-in subscribes the groups the user already belongs to
+    void joinGroup(int userId, int groupId);
+    void leaveGroup(int userId, int groupId);
     
     // WebSocket protocol
-    bool performHandshake(int socket, const std::string& request);
-    std::string createHandshakeResponse(const std::string& key);
-    WebSocketFrame parseFrame(const std::string& data);
-    std::string createFrame(const std::string& payload, uint8_t opcode = 0x01);
-    std::string maskData(const std::string& data, const std::string& key);
+    bool performHandshake(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
+    std::string createHandshakeResponse(const std::string& key, const std::string& extensions = "",
+                                        const std::string& protocol = "");
+    std::string createFrame(const std::string& payload, uint8_t opcode = 0x01, bool compressed = false);
 
 private:
     std::shared_ptr<MessageHandler> messageHandler_;
     std::shared_ptr<UserManager> userManager_;
+    std::shared_ptr<PubSubHub> pubsub_;
+    std::shared_ptr<PresenceService> presence_;
+    
+    Router router_;
+    AdmissionControl admission_;
+    DeflateConfig deflateConfig_;
+    OutboundLimits outboundLimits_;
+    
+    // Connection tracking, by socket and by signed-in user
+    ConnectionRegistry registry_;
+    // Sequence numbers and replay rings for reliable events, per user
+    SessionJournal journal_;
+    
+    std::atomic<uint64_t> signalsReceived_;
+    std::atomic<uint64_t> signalsPublished_;
+    std::atomic<uint64_t> signalsCoalesced_;
+    std::atomic<uint64_t> signalsDropped_;
     
-    // Connection tracking
-    std::map<int, std::shared_ptr<WebSocketConnection>> connections_;
-    std::mutex connectionsMutex_;
+    static constexpr int REQUEST_TIMEOUT_MS = 5000;        // first byte to complete request
+    static constexpr int KEEPALIVE_IDLE_MS = 30000;        // idle time between requests
+    static constexpr unsigned MAX_REQUESTS_PER_CONNECTION = 1000;
+    static constexpr int PING_INTERVAL_MS = 30000;         // WebSocket liveness check period
+    static constexpr int CLOSE_GRACE_MS = 5000;            // for a closing peer to take what is still queued
+    static constexpr int SIGNAL_INTERVAL_MS = 1000;        // per connection, signal type and conversation
+    static constexpr size_t MAX_SIGNAL_SLOTS = 64;         // conversations signalled in per connection
     
-    // WebSocket constants
-    static const uint8_t OPCODE_CONTINUATION = 0x0;
-    static const uint8_t OPCODE_TEXT = 0x1;
-    static const uint8_t OPCODE_BINARY = 0x2;
-    static const uint8_t OPCODE_CLOSE = 0x8;
-    static const uint8_t OPCODE_PING = 0x9;
-    static const uint8_t OPCODE_PONG = 0xA;
+    void rejectConnection(int clientSocket, const std::string& remoteAddress, AdmissionControl::Verdict verdict,
+                          bool plaintext);
+    bool writeRaw(std::shared_ptr<WebSocketConnection> conn, const std::string& data);
+    void sendHttpResponse(std::shared_ptr<WebSocketConnection> conn, HttpResponse& response);
+    void armHttpTimer(std::shared_ptr<WebSocketConnection> conn, int timeoutMs);
+    void armLivenessTimer(std::shared_ptr<WebSocketConnection> conn);
+    void checkLiveness(std::shared_ptr<WebSocketConnection> conn);
+    // Graceful by default; abortive drops queued output for dead or stuck peers
+    void closeSocket(std::shared_ptr<WebSocketConnection> conn, bool abortive = false);
     
     void handleClient(std::shared_ptr<WebSocketConnection> conn);
-    void processMessage(std::shared_ptr<WebSocketConnection> conn, const std::string& message);
-    void sendFrame(std::shared_ptr<WebSocketConnection> conn, const std::string& payload, uint8_t opcode);
-    void closeConnection(std::shared_ptr<WebSocketConnection> conn, uint16_t code = 1000);
+    void handleWebSocketData(std::shared_ptr<WebSocketConnection> conn);
+    void processMessage(std::shared_ptr<WebSocketConnection> conn, std::string_view message, uint8_t opcode);
+    void handleEnvelope(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
+    void sendFrame(std::shared_ptr<WebSocketConnection> conn, const std::string& payload, uint8_t opcode,
+                   uint64_t coalesceKey = 0);
+    // Queues a prebuilt uncompressed frame carrying payload
+    void sendSharedFrame(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& frame,
+                         const std::string& payload, uint8_t opcode, uint64_t coalesceKey);
+    // PubSubHub delivery. A droppable update is framed once per wire format
+    // for every subscriber; a reliable event gets each user's next sequence
+    // number and is framed once per user.
+    void deliver(const Topic& topic, const PubSubHub::Subscribers& subscribers, const Envelope& envelope,
+                 uint64_t coalesceKey);
+    void deliverShared(const std::vector<std::shared_ptr<WebSocketConnection>>& conns, const Envelope& envelope,
+                       uint64_t coalesceKey);
+    // With request, answers an auth envelope and replays what the client missed
+    void signIn(const std::shared_ptr<WebSocketConnection>& conn, int userId, const Envelope* request);
+    void signOut(const std::shared_ptr<WebSocketConnection>& conn);
+    void handleAuth(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
+    void handleSubscription(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
+    // A direct or group message from the client; acknowledged from the
+    // connection's loop once the message writer has committed it
+    void handleSend(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
+    // Typing and read signals: rate limited, the latest held back one wins
+    void handleSignal(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope);
+    void publishSignal(const std::shared_ptr<WebSocketConnection>& conn, uint32_t type, const Topic& conversation,
+                       uint64_t target);
+    void sendError(const std::shared_ptr<WebSocketConnection>& conn, uint64_t id, std::string_view reason);
+    void queueFrame(const std::shared_ptr<WebSocketConnection>& conn, std::string frame, uint64_t coalesceKey);
+    // Closes with 1008 once the peer has fallen past the high watermark
+    void checkOverflow(const std::shared_ptr<WebSocketConnection>& conn);
+    void closeConnection(std::shared_ptr<WebSocketConnection> conn, uint16_t code = WebSocketCloseCode::NORMAL);
     
     // Utility functions
     std::string generateWebSocketKey();
@@ -89,8 +236,12 @@ private:
     uint16_t htons(uint16_t hostshort);
     
     // HTTP API handlers
-    void handleRegister(std::shared_ptr<WebSocketConnection> conn, const std::string& request);
-    void handleLogin(std::shared_ptr<WebSocketConnection> conn, const std::string& request);
+    void setupRoutes();
+    void handleHttpRequest(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
+    void handleWebSocketUpgrade(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
+    void handleStatusPage(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
+    void handleRegister(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
+    void handleLogin(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request);
     void handleCorsPreflight(std::shared_ptr<WebSocketConnection> conn);
     void sendErrorResponse(std::shared_ptr<WebSocketConnection> conn, int statusCode, const std::string& message);
 }; 
\ No newline at end of file
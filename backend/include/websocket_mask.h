@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XORs size bytes of data in place with the 4-byte masking key, starting at
+// key position keyOffset. Uses AVX2 or SSE2 when the CPU has them (checked
+// once at run time) and a word-at-a-time loop otherwise.
+void unmaskPayload(char* data, size_t size, const uint8_t key[4], size_t keyOffset = 0);
+
+// The implementation unmaskPayload dispatches to: "avx2", "sse2" or "scalar"
+const char* unmaskImplementation();
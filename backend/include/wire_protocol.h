@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// How a WebSocket client exchanges application messages, chosen through
+// Sec-WebSocket-Protocol at the upgrade
+enum class WireFormat {
+    PLAIN,   // no subprotocol: free text frames, replies as JSON envelopes
+    JSON,    // "cockpit.json.v1": envelopes as JSON objects in text frames
+    BINARY   // "cockpit.bin.v1": envelopes in binary frames, see below
+};
+
+namespace WireSubprotocol {
+constexpr const char* JSON = "cockpit.json.v1";
+constexpr const char* BINARY = "cockpit.bin.v1";
+}
+
+namespace MessageType {
+constexpr uint32_t ERROR = 1;  // body says what was wrong with the request with the same id
+constexpr uint32_t ECHO = 2;   // sent straight back
+constexpr uint32_t AUTH = 3;   // body is a session token; the reply's target is the user id
+constexpr uint32_t SUBSCRIBE = 4;      // body is a topic name, e.g. "presence:12"
+constexpr uint32_t UNSUBSCRIBE = 5;
+constexpr uint32_t MESSAGE = 6;        // direct message; from is the sender, target the recipient
+constexpr uint32_t GROUP_MESSAGE = 7;  // from is the sender, target the group
+constexpr uint32_t PRESENCE = 8;       // body "online" or "offline"; from is the user, ts when it last changed
+// Ephemeral signals, never stored. body names the conversation: "group:<id>",
+// or "user:<id>" for the other user in a direct one.
+constexpr uint32_t TYPING = 9;
+constexpr uint32_t READ = 10;          // target is the last message read
+}
+
+// Name used for a type in the JSON encoding, null if unknown
+const char* messageTypeName(uint32_t type);
+bool parseMessageType(std::string_view name, uint32_t& type);
+
+// One application message. Fields left at 0 are absent on the wire.
+//
+// Binary encoding, version 1 (all integers are unsigned LEB128 varints):
+//   u8 version | type | u8 field mask | seq, id, from, target, timestamp (each
+//   only if its mask bit is set, in this order) | body length | body bytes
+// JSON encoding:
+//   {"type":"echo","seq":1,"id":2,"from":5,"target":3,"ts":4,"body":"..."}
+// where type may also be given as a number.
+struct Envelope {
+    uint32_t type = 0;
+    uint64_t seq = 0;        // position in the recipient's event stream
+    uint64_t id = 0;         // message or request id
+    uint64_t from = 0;       // user the message comes from
+    uint64_t target = 0;     // conversation, group or user the message is about
+    uint64_t timestamp = 0;  // milliseconds since the epoch
+    std::string_view body;   // text; points into the decoded frame or caller storage
+};
+
+// Picks the format for a Sec-WebSocket-Protocol offer list, preferring
+// binary. protocol is set to the token to echo back, empty for PLAIN.
+WireFormat negotiateWireFormat(std::string_view offers, std::string& protocol);
+
+// Appends the encoded envelope to out. PLAIN encodes as JSON.
+void encodeEnvelope(const Envelope& envelope, WireFormat format, std::string& out);
+// Decodes one frame payload. The body may point into data or, when a JSON
+// body has escapes, into scratch. False if the message is malformed.
+bool decodeEnvelope(std::string_view data, WireFormat format, Envelope& envelope, std::string& scratch);
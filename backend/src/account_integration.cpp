@@ -538,7 +538,7 @@ bool AccountIntegrationManager::saveAccountToDatabase(const AccountCredentials&
     return true;
 }
 
-bool AccountIntegrationManager::loadAccountsFromDatabase(const std::string& userId, std::vector<AccountCredentials>& accounts) {
+bool AccountIntegrationManager::loadAccountsFromDatabase(const std::string& userId, std::vector<AccountCredentials>& /*accounts*/) {
     // TODO: Implement actual database load
     std::cout << "Loading accounts from database for user: " << userId << std::endl;
     return true;
@@ -550,7 +550,7 @@ bool AccountIntegrationManager::saveMessageToDatabase(const UnifiedMessage& mess
     return true;
 }
 
-bool AccountIntegrationManager::loadMessagesFromDatabase(const std::string& userId, std::vector<UnifiedMessage>& messages) {
+bool AccountIntegrationManager::loadMessagesFromDatabase(const std::string& userId, std::vector<UnifiedMessage>& /*messages*/) {
     // TODO: Implement actual database load
     std::cout << "Loading messages from database for user: " << userId << std::endl;
     return true;
@@ -558,41 +558,41 @@ bool AccountIntegrationManager::loadMessagesFromDatabase(const std::string& user
 
 // Message action implementations (placeholder)
 
-bool AccountIntegrationManager::markMessageAsRead(const std::string& userId, const std::string& messageId) {
+bool AccountIntegrationManager::markMessageAsRead(const std::string& /*userId*/, const std::string& messageId) {
     // TODO: Implement
     std::cout << "Marking message as read: " << messageId << std::endl;
     return true;
 }
 
-bool AccountIntegrationManager::markMessageAsImportant(const std::string& userId, const std::string& messageId) {
+bool AccountIntegrationManager::markMessageAsImportant(const std::string& /*userId*/, const std::string& messageId) {
     // TODO: Implement
     std::cout << "Marking message as important: " << messageId << std::endl;
     return true;
 }
 
-bool AccountIntegrationManager::deleteMessage(const std::string& userId, const std::string& messageId) {
+bool AccountIntegrationManager::deleteMessage(const std::string& /*userId*/, const std::string& messageId) {
     // TODO: Implement
     std::cout << "Deleting message: " << messageId << std::endl;
     return true;
 }
 
-bool AccountIntegrationManager::replyToMessage(const std::string& userId, const std::string& messageId, const std::string& replyContent) {
+bool AccountIntegrationManager::replyToMessage(const std::string& /*userId*/, const std::string& messageId, const std::string& /*replyContent*/) {
     // TODO: Implement
     std::cout << "Replying to message: " << messageId << std::endl;
     return true;
 }
 
-std::vector<UnifiedMessage> AccountIntegrationManager::fetchMessagesByAccount(const std::string& userId, const std::string& accountId) {
+std::vector<UnifiedMessage> AccountIntegrationManager::fetchMessagesByAccount(const std::string& /*userId*/, const std::string& /*accountId*/) {
     // TODO: Implement
     return std::vector<UnifiedMessage>();
 }
 
-std::vector<UnifiedMessage> AccountIntegrationManager::searchMessages(const std::string& userId, const std::string& query) {
+std::vector<UnifiedMessage> AccountIntegrationManager::searchMessages(const std::string& /*userId*/, const std::string& /*query*/) {
     // TODO: Implement
     return std::vector<UnifiedMessage>();
 }
 
-bool AccountIntegrationManager::updateAccount(const std::string& userId, const std::string& accountId, const AccountCredentials& credentials) {
+bool AccountIntegrationManager::updateAccount(const std::string& /*userId*/, const std::string& /*accountId*/, const AccountCredentials& /*credentials*/) {
     // TODO: Implement
     return true;
 } 
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "admission_control.h"
+
+AdmissionControl::AdmissionControl(const AdmissionLimits& limits) : limits_(limits) {
+}
+
+void AdmissionControl::setLimits(const AdmissionLimits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+}
+
+std::string_view AdmissionControl::hostOf(const std::string& remoteAddress) {
+    std::string_view address(remoteAddress);
+    size_t colon = address.rfind(':');
+    return colon == std::string_view::npos ? address : address.substr(0, colon);
+}
+
+AdmissionControl::Verdict AdmissionControl::admit(const std::string& remoteAddress) {
+    std::string host(hostOf(remoteAddress));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (limits_.maxConnections && stats_.active >= limits_.maxConnections) {
+        stats_.rejectedConnections++;
+        return Verdict::OVER_CONNECTIONS;
+    }
+    if (limits_.maxPendingHandshakes && stats_.pending >= limits_.maxPendingHandshakes) {
+        stats_.rejectedPending++;
+        return Verdict::OVER_PENDING;
+    }
+
+    auto it = perIp_.find(host);
+    if (it == perIp_.end()) {
+        perIp_.emplace(std::move(host), 1);
+    } else if (limits_.maxConnectionsPerIp && it->second >= limits_.maxConnectionsPerIp) {
+        stats_.rejectedPerIp++;
+        return Verdict::OVER_PER_IP;
+    } else {
+        it->second++;
+    }
+
+    stats_.active++;
+    stats_.pending++;
+    stats_.admitted++;
+    return Verdict::ADMITTED;
+}
+
+void AdmissionControl::handshakeDone() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stats_.pending > 0) {
+        stats_.pending--;
+    }
+}
+
+void AdmissionControl::release(const std::string& remoteAddress, bool pending) {
+    std::string host(hostOf(remoteAddress));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = perIp_.find(host);
+    if (it != perIp_.end() && --it->second == 0) {
+        // Only addresses with open connections are kept, so the map stays
+        // bounded by maxConnections
+        perIp_.erase(it);
+    }
+    if (stats_.active > 0) {
+        stats_.active--;
+    }
+    if (pending && stats_.pending > 0) {
+        stats_.pending--;
+    }
+}
+
+AdmissionControl::Stats AdmissionControl::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats result = stats_;
+    result.trackedAddresses = perIp_.size();
+    return result;
+}
+
+const char* admissionVerdictName(AdmissionControl::Verdict verdict) {
+    switch (verdict) {
+        case AdmissionControl::Verdict::ADMITTED: return "admitted";
+        case AdmissionControl::Verdict::OVER_CONNECTIONS: return "connection limit";
+        case AdmissionControl::Verdict::OVER_PER_IP: return "per-address limit";
+        case AdmissionControl::Verdict::OVER_PENDING: return "pending handshake limit";
+    }
+    return "unknown";
+}
@@ -0,0 +1,110 @@
+#include "connection_registry.h"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+size_t ConnectionRegistry::shardOf(int key) {
+    // Socket numbers and user ids are both dense; mix them so neighbours
+    // land on different shards
+    uint32_t hash = static_cast<uint32_t>(key) * 2654435761u;
+    return (hash >> 16) & (SHARDS - 1);
+}
+
+void ConnectionRegistry::addSocket(int socket, const ConnectionPtr& conn) {
+    SocketShard& shard = sockets_[shardOf(socket)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.connections[socket] = conn;
+}
+
+void ConnectionRegistry::removeSocket(int socket, const ConnectionPtr& conn) {
+    SocketShard& shard = sockets_[shardOf(socket)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.connections.find(socket);
+    if (it != shard.connections.end() && it->second == conn) {
+        shard.connections.erase(it);
+    }
+}
+
+void ConnectionRegistry::addUser(int userId, const ConnectionPtr& conn) {
+    UserShard& shard = users_[shardOf(userId)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    std::vector<ConnectionPtr>& devices = shard.devices[userId];
+    if (std::find(devices.begin(), devices.end(), conn) == devices.end()) {
+        devices.push_back(conn);
+    }
+}
+
+void ConnectionRegistry::removeUser(int userId, const ConnectionPtr& conn) {
+    UserShard& shard = users_[shardOf(userId)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.devices.find(userId);
+    if (it == shard.devices.end()) {
+        return;
+    }
+    std::vector<ConnectionPtr>& devices = it->second;
+    devices.erase(std::remove(devices.begin(), devices.end(), conn), devices.end());
+    if (devices.empty()) {
+        shard.devices.erase(it);
+    }
+}
+
+std::vector<ConnectionRegistry::ConnectionPtr> ConnectionRegistry::removeAllOfUser(int userId) {
+    UserShard& shard = users_[shardOf(userId)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.devices.find(userId);
+    if (it == shard.devices.end()) {
+        return {};
+    }
+    std::vector<ConnectionPtr> devices = std::move(it->second);
+    shard.devices.erase(it);
+    return devices;
+}
+
+std::vector<ConnectionRegistry::ConnectionPtr> ConnectionRegistry::connectionsOf(int userId) const {
+    const UserShard& shard = users_[shardOf(userId)];
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.devices.find(userId);
+    return it == shard.devices.end() ? std::vector<ConnectionPtr>() : it->second;
+}
+
+void ConnectionRegistry::collect(const std::vector<int>& userIds, std::vector<ConnectionPtr>& out) const {
+    // One shard locked at a time, never two, so collectors cannot deadlock
+    // with each other or with writers
+    for (int userId : userIds) {
+        const UserShard& shard = users_[shardOf(userId)];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.devices.find(userId);
+        if (it != shard.devices.end()) {
+            out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+    }
+}
+
+std::vector<ConnectionRegistry::ConnectionPtr> ConnectionRegistry::allConnections() const {
+    std::vector<ConnectionPtr> all;
+    for (const SocketShard& shard : sockets_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& [socket, conn] : shard.connections) {
+            all.push_back(conn);
+        }
+    }
+    return all;
+}
+
+size_t ConnectionRegistry::socketCount() const {
+    size_t count = 0;
+    for (const SocketShard& shard : sockets_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        count += shard.connections.size();
+    }
+    return count;
+}
+
+size_t ConnectionRegistry::userCount() const {
+    size_t count = 0;
+    for (const UserShard& shard : users_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        count += shard.devices.size();
+    }
+    return count;
+}
@@ -1,30 +1,210 @@
 #include "database.h"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <ctime>
 
-Database::Database(const std::string& dbPath) : dbPath_(dbPath), db_(nullptr), initialized_(false) {
+namespace {
+
+// Nullable columns (description, public_key) come back as NULL
+const char* columnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? reinterpret_cast<const char*>(text) : "";
+}
+
+// Indexed by Database::Query
+const char* const QUERY_SQL[] = {
+    // CREATE_USER
+    "INSERT INTO users (username, email, password_hash, public_key) VALUES (?, ?, ?, ?)",
+    // USER_BY_USERNAME
+    "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users WHERE username = ?",
+    // USER_BY_ID
+    "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users WHERE id = ?",
+    // UPDATE_ONLINE_STATUS
+    "UPDATE users SET is_online = ? WHERE id = ?",
+    // SAVE_PRESENCE
+    "UPDATE users SET is_online = ?, last_seen = ? WHERE id = ?",
+    // USER_LAST_SEEN
+    "SELECT last_seen FROM users WHERE id = ?",
+    // ALL_USERS
+    "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users",
+    // SAVE_MESSAGE
+    "INSERT INTO messages (sender_id, receiver_id, group_id, content, encrypted_content, message_type) VALUES (?, ?, ?, ?, ?, ?)",
+    // MESSAGES_BETWEEN
+    "SELECT id, sender_id, receiver_id, group_id, content, encrypted_content, timestamp, is_read, message_type FROM messages WHERE (sender_id = ? AND receiver_id = ?) OR (sender_id = ? AND receiver_id = ?) ORDER BY timestamp DESC LIMIT ?",
+    // GROUP_MESSAGES
+    "SELECT id, sender_id, receiver_id, group_id, content, encrypted_content, timestamp, is_read, message_type FROM messages WHERE group_id = ? ORDER BY timestamp DESC LIMIT ?",
+    // MARK_MESSAGE_READ
+    "UPDATE messages SET is_read = TRUE WHERE id = ?",
+    // DELETE_MESSAGE
+    "DELETE FROM messages WHERE id = ?",
+    // CREATE_GROUP
+    "INSERT INTO groups (name, description, creator_id) VALUES (?, ?, ?)",
+    // ADD_GROUP_MEMBER
+    "INSERT OR REPLACE INTO group_members (group_id, user_id, role) VALUES (?, ?, ?)",
+    // REMOVE_GROUP_MEMBER
+    "DELETE FROM group_members WHERE group_id = ? AND user_id = ?",
+    // USER_GROUPS
+    "SELECT g.id, g.name, g.description, g.creator_id, g.created_at FROM groups g JOIN group_members gm ON g.id = gm.group_id WHERE gm.user_id = ?",
+    // GROUP_MEMBERS
+    "SELECT u.id, u.username, u.email, u.password_hash, u.public_key, u.created_at, u.is_online FROM users u JOIN group_members gm ON u.id = gm.user_id WHERE gm.group_id = ?",
+    // SAVE_SESSION
+    "INSERT OR REPLACE INTO sessions (token, user_id, expires_at) VALUES (?, ?, ?)",
+    // SESSION_USER
+    "SELECT user_id FROM sessions WHERE token = ? AND expires_at > datetime('now')",
+    // DELETE_SESSION
+    "DELETE FROM sessions WHERE token = ?",
+};
+
+// Binds a message to Query::SAVE_MESSAGE
+void bindMessage(sqlite3_stmt* stmt, const Message& message) {
+    sqlite3_bind_int(stmt, 1, message.sender_id);
+    // 0 means "none" in Message but would break the foreign keys; stored as NULL
+    if (message.receiver_id) {
+        sqlite3_bind_int(stmt, 2, message.receiver_id);
+    } else {
+        sqlite3_bind_null(stmt, 2);
+    }
+    if (message.group_id) {
+        sqlite3_bind_int(stmt, 3, message.group_id);
+    } else {
+        sqlite3_bind_null(stmt, 3);
+    }
+    sqlite3_bind_text(stmt, 4, message.content.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, message.encrypted_content.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, message.message_type.c_str(), -1, SQLITE_STATIC);
+}
+
+// A cached statement for the length of one call. Resetting it releases its
+// read or write lock and clearing its bindings drops pointers into the
+// caller's strings, so the next call starts clean.
+class Statement {
+public:
+    explicit Statement(sqlite3_stmt* stmt) : stmt_(stmt) {}
+    ~Statement() {
+        if (stmt_) {
+            sqlite3_reset(stmt_);
+            sqlite3_clear_bindings(stmt_);
+        }
+    }
+    Statement(const Statement&) = delete;
+    Statement& operator=(const Statement&) = delete;
+
+    operator sqlite3_stmt*() const { return stmt_; }
+
+private:
+    sqlite3_stmt* stmt_;
+};
+
+} // namespace
+
+bool parseSyncMode(const std::string& name, SyncMode& mode) {
+    if (name == "off") {
+        mode = SyncMode::OFF;
+    } else if (name == "normal") {
+        mode = SyncMode::NORMAL;
+    } else if (name == "full") {
+        mode = SyncMode::FULL;
+    } else if (name == "extra") {
+        mode = SyncMode::EXTRA;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* syncModeName(SyncMode mode) {
+    switch (mode) {
+        case SyncMode::OFF:
+            return "off";
+        case SyncMode::NORMAL:
+            return "normal";
+        case SyncMode::FULL:
+            return "full";
+        case SyncMode::EXTRA:
+            return "extra";
+    }
+    return "unknown";
+}
+
+static_assert(sizeof(QUERY_SQL) / sizeof(QUERY_SQL[0]) == static_cast<size_t>(Database::Query::COUNT),
+              "every query needs its SQL");
+
+sqlite3_stmt* Database::StatementCache::get(Query query) {
+    sqlite3_stmt*& stmt = statements_[static_cast<size_t>(query)];
+    if (!stmt && sqlite3_prepare_v3(db_, QUERY_SQL[static_cast<size_t>(query)], -1, SQLITE_PREPARE_PERSISTENT,
+                                    &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+        stmt = nullptr;
+    }
+    return stmt;
+}
+
+void Database::StatementCache::clear() {
+    for (sqlite3_stmt*& stmt : statements_) {
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+    }
+}
+
+Database::Database(const DatabaseConfig& config)
+    : config_(config), db_(nullptr), initialized_(false), nextReader_(0), reads_(0), readWaits_(0) {
 }
 
 Database::~Database() {
+    // A connection with unfinalized statements does not close
+    for (const std::unique_ptr<Reader>& reader : readers_) {
+        reader->statements.clear();
+        sqlite3_close(reader->db);
+    }
     if (db_) {
+        statements_.clear();
         sqlite3_close(db_);
     }
 }
 
+sqlite3* Database::open(int flags) {
+    // Each connection is used by one thread at a time, under its own mutex
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(config_.path.c_str(), &db, flags | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to open database: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        return nullptr;
+    }
+    
+    // Checkpoints and other processes can hold a lock for a moment
+    sqlite3_busy_timeout(db, 5000);
+    std::string tuning = "PRAGMA mmap_size = " + std::to_string(config_.mmapSize) +
+                         "; PRAGMA cache_size = " + std::to_string(-config_.cacheSize);
+    sqlite3_exec(db, tuning.c_str(), nullptr, nullptr, nullptr);
+    return db;
+}
+
 bool Database::initialize() {
     if (initialized_) return true;
     
-    int rc = sqlite3_open(dbPath_.c_str(), &db_);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to open database: " << sqlite3_errmsg(db_) << std::endl;
+    db_ = open(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    if (!db_) {
         return false;
     }
+    statements_.attach(db_);
     
     // Enable foreign keys
     sqlite3_exec(db_, "PRAGMA foreign_keys = ON", nullptr, nullptr, nullptr);
     
+    // Readers see the last commit while the writer appends to the log
+    std::string journalMode;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, "PRAGMA journal_mode = WAL", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            journalMode = columnText(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    std::string synchronous = std::string("PRAGMA synchronous = ") + syncModeName(config_.synchronous);
+    sqlite3_exec(db_, synchronous.c_str(), nullptr, nullptr, nullptr);
+    
     if (!createTables()) {
         std::cerr << "Failed to create tables" << std::endl;
         return false;
@@ -35,11 +215,59 @@ bool Database::initialize() {
         return false;
     }
     
+    // Outside WAL a reader would block the writer, and an in-memory
+    // database would be a different one per connection
+    if (journalMode != "wal") {
+        std::cerr << "Database is not in WAL mode (" << journalMode << "); reads share the writer" << std::endl;
+    } else if (!openReaders()) {
+        return false;
+    }
+    
     initialized_ = true;
     std::cout << "Database initialized successfully" << std::endl;
     return true;
 }
 
+bool Database::openReaders() {
+    for (size_t i = 0; i < config_.readers; i++) {
+        sqlite3* db = open(SQLITE_OPEN_READONLY);
+        if (!db) {
+            return false;
+        }
+        auto reader = std::make_unique<Reader>();
+        reader->db = db;
+        reader->statements.attach(db);
+        readers_.push_back(std::move(reader));
+    }
+    return true;
+}
+
+Database::StatementCache& Database::reader(std::unique_lock<std::mutex>& lock) {
+    if (readers_.empty()) {
+        lock = std::unique_lock<std::mutex>(dbMutex_);
+        return statements_;
+    }
+    
+    reads_++;
+    size_t count = readers_.size();
+    size_t first = nextReader_++ % count;
+    for (size_t i = 0; i < count; i++) {
+        Reader& reader = *readers_[(first + i) % count];
+        lock = std::unique_lock<std::mutex>(reader.mutex, std::try_to_lock);
+        if (lock.owns_lock()) {
+            return reader.statements;
+        }
+    }
+    readWaits_++;
+    Reader& reader = *readers_[first];
+    lock = std::unique_lock<std::mutex>(reader.mutex);
+    return reader.statements;
+}
+
+Database::Stats Database::stats() const {
+    return {readers_.size(), reads_.load(), readWaits_.load()};
+}
+
 bool Database::createTables() {
     const char* createUsersTable = R"(
         CREATE TABLE IF NOT EXISTS users (
@@ -49,7 +277,8 @@ bool Database::createTables() {
             password_hash TEXT NOT NULL,
             public_key TEXT,
             created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
-            is_online BOOLEAN DEFAULT FALSE
+            is_online BOOLEAN DEFAULT FALSE,
+            last_seen INTEGER DEFAULT 0
         )
     )";
     
@@ -110,6 +339,15 @@ bool Database::createTables() {
         return false;
     }
     
+    // Databases created before last_seen existed
+    if (!hasColumn("users", "last_seen") &&
+        sqlite3_exec(db_, "ALTER TABLE users ADD COLUMN last_seen INTEGER DEFAULT 0", nullptr, nullptr,
+                     &errMsg) != SQLITE_OK) {
+        std::cerr << "Failed to add users.last_seen: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    
     if (sqlite3_exec(db_, createGroupsTable, nullptr, nullptr, &errMsg) != SQLITE_OK) {
         std::cerr << "Failed to create groups table: " << errMsg << std::endl;
         sqlite3_free(errMsg);
@@ -137,6 +375,21 @@ bool Database::createTables() {
     return true;
 }
 
+bool Database::hasColumn(const char* table, const char* column) {
+    std::string sql = std::string("PRAGMA table_info(") + table + ")";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        found = std::string(columnText(stmt, 1)) == column;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
 bool Database::createIndexes() {
     const char* indexes[] = {
         "CREATE INDEX IF NOT EXISTS idx_users_username ON users(username)",
@@ -167,11 +420,8 @@ bool Database::createUser(const std::string& username, const std::string& email,
                          const std::string& passwordHash, const std::string& publicKey) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "INSERT INTO users (username, email, password_hash, public_key) VALUES (?, ?, ?, ?)";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::CREATE_USER));
+    if (!stmt) {
         return false;
     }
     
@@ -181,75 +431,58 @@ bool Database::createUser(const std::string& username, const std::string& email,
     sqlite3_bind_text(stmt, 4, publicKey.c_str(), -1, SQLITE_STATIC);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 User Database::getUserByUsername(const std::string& username) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users WHERE username = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::USER_BY_USERNAME));
+    if (!stmt) {
         return User{};
     }
     
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
     
-    User user;
+    User user{};
     if (sqlite3_step(stmt) == SQLITE_ROW) {
         user.id = sqlite3_column_int(stmt, 0);
-        user.username = (const char*)sqlite3_column_text(stmt, 1);
-        user.email = (const char*)sqlite3_column_text(stmt, 2);
-        user.password_hash = (const char*)sqlite3_column_text(stmt, 3);
-        user.public_key = (const char*)sqlite3_column_text(stmt, 4);
-        user.created_at = (const char*)sqlite3_column_text(stmt, 5);
+        user.username = columnText(stmt, 1);
+        user.email = columnText(stmt, 2);
+        user.password_hash = columnText(stmt, 3);
+        user.public_key = columnText(stmt, 4);
+        user.created_at = columnText(stmt, 5);
         user.is_online = sqlite3_column_int(stmt, 6) != 0;
     }
-    
-    sqlite3_finalize(stmt);
     return user;
 }
 
 User Database::getUserById(int id) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users WHERE id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::USER_BY_ID));
+    if (!stmt) {
         return User{};
     }
     
     sqlite3_bind_int(stmt, 1, id);
     
-    User user;
+    User user{};
     if (sqlite3_step(stmt) == SQLITE_ROW) {
         user.id = sqlite3_column_int(stmt, 0);
-        user.username = (const char*)sqlite3_column_text(stmt, 1);
-        user.email = (const char*)sqlite3_column_text(stmt, 2);
-        user.password_hash = (const char*)sqlite3_column_text(stmt, 3);
-        user.public_key = (const char*)sqlite3_column_text(stmt, 4);
-        user.created_at = (const char*)sqlite3_column_text(stmt, 5);
+        user.username = columnText(stmt, 1);
+        user.email = columnText(stmt, 2);
+        user.password_hash = columnText(stmt, 3);
+        user.public_key = columnText(stmt, 4);
+        user.created_at = columnText(stmt, 5);
         user.is_online = sqlite3_column_int(stmt, 6) != 0;
     }
-    
-    sqlite3_finalize(stmt);
     return user;
 }
 
 bool Database::updateUserOnlineStatus(int userId, bool online) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "UPDATE users SET is_online = ? WHERE id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::UPDATE_ONLINE_STATUS));
+    if (!stmt) {
         return false;
     }
     
@@ -257,19 +490,73 @@ bool Database::updateUserOnlineStatus(int userId, bool online) {
     sqlite3_bind_int(stmt, 2, userId);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
-std::vector<User> Database::getAllUsers() {
+bool Database::savePresence(const std::vector<PresenceRecord>& records) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "SELECT id, username, email, password_hash, public_key, created_at, is_online FROM users";
-    sqlite3_stmt* stmt;
+    // One transaction, so the batch costs one journal sync instead of one per row
+    if (sqlite3_exec(db_, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(db_) << std::endl;
+        return false;
+    }
     
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::SAVE_PRESENCE));
+    if (!stmt) {
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        return false;
+    }
+    
+    bool ok = true;
+    for (const PresenceRecord& record : records) {
+        sqlite3_bind_int(stmt, 1, record.online ? 1 : 0);
+        sqlite3_bind_int64(stmt, 2, record.last_seen);
+        sqlite3_bind_int(stmt, 3, record.user_id);
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            ok = false;
+            break;
+        }
+    }
+    
+    if (!ok || sqlite3_exec(db_, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to save presence: " << sqlite3_errmsg(db_) << std::endl;
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
+
+bool Database::clearOnlineStatus() {
+    std::lock_guard<std::mutex> lock(dbMutex_);
+    
+    const char* sql = "UPDATE users SET is_online = 0 WHERE is_online != 0";
+    return sqlite3_exec(db_, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+int64_t Database::getUserLastSeen(int userId) {
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::USER_LAST_SEEN));
+    if (!stmt) {
+        return 0;
+    }
+    
+    sqlite3_bind_int(stmt, 1, userId);
+    
+    int64_t lastSeen = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        lastSeen = sqlite3_column_int64(stmt, 0);
+    }
+    
+    return lastSeen;
+}
+
+std::vector<User> Database::getAllUsers() {
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::ALL_USERS));
+    if (!stmt) {
         return {};
     }
     
@@ -277,51 +564,78 @@ std::vector<User> Database::getAllUsers() {
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         User user;
         user.id = sqlite3_column_int(stmt, 0);
-        user.username = (const char*)sqlite3_column_text(stmt, 1);
-        user.email = (const char*)sqlite3_column_text(stmt, 2);
-        user.password_hash = (const char*)sqlite3_column_text(stmt, 3);
-        user.public_key = (const char*)sqlite3_column_text(stmt, 4);
-        user.created_at = (const char*)sqlite3_column_text(stmt, 5);
+        user.username = columnText(stmt, 1);
+        user.email = columnText(stmt, 2);
+        user.password_hash = columnText(stmt, 3);
+        user.public_key = columnText(stmt, 4);
+        user.created_at = columnText(stmt, 5);
         user.is_online = sqlite3_column_int(stmt, 6) != 0;
         users.push_back(user);
     }
     
-    sqlite3_finalize(stmt);
     return users;
 }
 
 bool Database::saveMessage(const Message& message) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "INSERT INTO messages (sender_id, receiver_id, group_id, content, encrypted_content, message_type) VALUES (?, ?, ?, ?, ?, ?)";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::SAVE_MESSAGE));
+    if (!stmt) {
         return false;
     }
     
-    sqlite3_bind_int(stmt, 1, message.sender_id);
-    sqlite3_bind_int(stmt, 2, message.receiver_id);
-    sqlite3_bind_int(stmt, 3, message.group_id);
-    sqlite3_bind_text(stmt, 4, message.content.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, message.encrypted_content.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 6, message.message_type.c_str(), -1, SQLITE_STATIC);
+    bindMessage(stmt, message);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
-std::vector<Message> Database::getMessages(int userId, int otherUserId, int limit) {
+bool Database::saveMessages(const std::vector<Message>& messages, std::vector<int>& ids) {
     std::lock_guard<std::mutex> lock(dbMutex_);
+    ids.assign(messages.size(), -1);
     
-    const char* sql = "SELECT id, sender_id, receiver_id, group_id, content, encrypted_content, timestamp, is_read, message_type FROM messages WHERE (sender_id = ? AND receiver_id = ?) OR (sender_id = ? AND receiver_id = ?) ORDER BY timestamp DESC LIMIT ?";
-    sqlite3_stmt* stmt;
+    // One commit, and so one sync of the log, for the whole batch
+    if (sqlite3_exec(db_, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(db_) << std::endl;
+        return false;
+    }
     
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::SAVE_MESSAGE));
+    if (!stmt) {
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        return false;
+    }
+    
+    for (size_t i = 0; i < messages.size(); i++) {
+        bindMessage(stmt, messages[i]);
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc == SQLITE_DONE) {
+            ids[i] = static_cast<int>(sqlite3_last_insert_rowid(db_));
+            continue;
+        }
+        // A constraint failure undoes only its own row; anything that ended
+        // the transaction undoes the rows before it too
+        std::cerr << "Failed to save message: " << sqlite3_errmsg(db_) << std::endl;
+        if (sqlite3_get_autocommit(db_)) {
+            ids.assign(messages.size(), -1);
+            return false;
+        }
+    }
+    
+    if (sqlite3_exec(db_, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to commit messages: " << sqlite3_errmsg(db_) << std::endl;
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        ids.assign(messages.size(), -1);
+        return false;
+    }
+    return std::any_of(ids.begin(), ids.end(), [](int id) { return id >= 0; });
+}
+
+std::vector<Message> Database::getMessages(int userId, int otherUserId, int limit) {
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::MESSAGES_BETWEEN));
+    if (!stmt) {
         return {};
     }
     
@@ -338,26 +652,21 @@ std::vector<Message> Database::getMessages(int userId, int otherUserId, int limi
         message.sender_id = sqlite3_column_int(stmt, 1);
         message.receiver_id = sqlite3_column_int(stmt, 2);
         message.group_id = sqlite3_column_int(stmt, 3);
-        message.content = (const char*)sqlite3_column_text(stmt, 4);
-        message.encrypted_content = (const char*)sqlite3_column_text(stmt, 5);
-        message.timestamp = (const char*)sqlite3_column_text(stmt, 6);
+        message.content = columnText(stmt, 4);
+        message.encrypted_content = columnText(stmt, 5);
+        message.timestamp = columnText(stmt, 6);
         message.is_read = sqlite3_column_int(stmt, 7) != 0;
-        message.message_type = (const char*)sqlite3_column_text(stmt, 8);
+        message.message_type = columnText(stmt, 8);
         messages.push_back(message);
     }
     
-    sqlite3_finalize(stmt);
     return messages;
 }
 
 std::vector<Message> Database::getGroupMessages(int groupId, int limit) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT id, sender_id, receiver_id, group_id, content, encrypted_content, timestamp, is_read, message_type FROM messages WHERE group_id = ? ORDER BY timestamp DESC LIMIT ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::GROUP_MESSAGES));
+    if (!stmt) {
         return {};
     }
     
@@ -371,64 +680,50 @@ std::vector<Message> Database::getGroupMessages(int groupId, int limit) {
         message.sender_id = sqlite3_column_int(stmt, 1);
         message.receiver_id = sqlite3_column_int(stmt, 2);
         message.group_id = sqlite3_column_int(stmt, 3);
-        message.content = (const char*)sqlite3_column_text(stmt, 4);
-        message.encrypted_content = (const char*)sqlite3_column_text(stmt, 5);
-        message.timestamp = (const char*)sqlite3_column_text(stmt, 6);
+        message.content = columnText(stmt, 4);
+        message.encrypted_content = columnText(stmt, 5);
+        message.timestamp = columnText(stmt, 6);
         message.is_read = sqlite3_column_int(stmt, 7) != 0;
-        message.message_type = (const char*)sqlite3_column_text(stmt, 8);
+        message.message_type = columnText(stmt, 8);
         messages.push_back(message);
     }
     
-    sqlite3_finalize(stmt);
     return messages;
 }
 
 bool Database::markMessageAsRead(int messageId) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "UPDATE messages SET is_read = TRUE WHERE id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::MARK_MESSAGE_READ));
+    if (!stmt) {
         return false;
     }
     
     sqlite3_bind_int(stmt, 1, messageId);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 bool Database::deleteMessage(int messageId) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "DELETE FROM messages WHERE id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::DELETE_MESSAGE));
+    if (!stmt) {
         return false;
     }
     
     sqlite3_bind_int(stmt, 1, messageId);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 bool Database::createGroup(const std::string& name, const std::string& description, int creatorId) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "INSERT INTO groups (name, description, creator_id) VALUES (?, ?, ?)";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::CREATE_GROUP));
+    if (!stmt) {
         return false;
     }
     
@@ -437,19 +732,14 @@ bool Database::createGroup(const std::string& name, const std::string& descripti
     sqlite3_bind_int(stmt, 3, creatorId);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 bool Database::addUserToGroup(int groupId, int userId, const std::string& role) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "INSERT OR REPLACE INTO group_members (group_id, user_id, role) VALUES (?, ?, ?)";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::ADD_GROUP_MEMBER));
+    if (!stmt) {
         return false;
     }
     
@@ -458,19 +748,14 @@ bool Database::addUserToGroup(int groupId, int userId, const std::string& role)
     sqlite3_bind_text(stmt, 3, role.c_str(), -1, SQLITE_STATIC);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 bool Database::removeUserFromGroup(int groupId, int userId) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "DELETE FROM group_members WHERE group_id = ? AND user_id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::REMOVE_GROUP_MEMBER));
+    if (!stmt) {
         return false;
     }
     
@@ -478,19 +763,13 @@ bool Database::removeUserFromGroup(int groupId, int userId) {
     sqlite3_bind_int(stmt, 2, userId);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 std::vector<Group> Database::getUserGroups(int userId) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT g.id, g.name, g.description, g.creator_id, g.created_at FROM groups g JOIN group_members gm ON g.id = gm.group_id WHERE gm.user_id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::USER_GROUPS));
+    if (!stmt) {
         return {};
     }
     
@@ -500,25 +779,20 @@ std::vector<Group> Database::getUserGroups(int userId) {
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         Group group;
         group.id = sqlite3_column_int(stmt, 0);
-        group.name = (const char*)sqlite3_column_text(stmt, 1);
-        group.description = (const char*)sqlite3_column_text(stmt, 2);
+        group.name = columnText(stmt, 1);
+        group.description = columnText(stmt, 2);
         group.creator_id = sqlite3_column_int(stmt, 3);
-        group.created_at = (const char*)sqlite3_column_text(stmt, 4);
+        group.created_at = columnText(stmt, 4);
         groups.push_back(group);
     }
     
-    sqlite3_finalize(stmt);
     return groups;
 }
 
 std::vector<User> Database::getGroupMembers(int groupId) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT u.id, u.username, u.email, u.password_hash, u.public_key, u.created_at, u.is_online FROM users u JOIN group_members gm ON u.id = gm.user_id WHERE gm.group_id = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::GROUP_MEMBERS));
+    if (!stmt) {
         return {};
     }
     
@@ -528,27 +802,23 @@ std::vector<User> Database::getGroupMembers(int groupId) {
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         User user;
         user.id = sqlite3_column_int(stmt, 0);
-        user.username = (const char*)sqlite3_column_text(stmt, 1);
-        user.email = (const char*)sqlite3_column_text(stmt, 2);
-        user.password_hash = (const char*)sqlite3_column_text(stmt, 3);
-        user.public_key = (const char*)sqlite3_column_text(stmt, 4);
-        user.created_at = (const char*)sqlite3_column_text(stmt, 5);
+        user.username = columnText(stmt, 1);
+        user.email = columnText(stmt, 2);
+        user.password_hash = columnText(stmt, 3);
+        user.public_key = columnText(stmt, 4);
+        user.created_at = columnText(stmt, 5);
         user.is_online = sqlite3_column_int(stmt, 6) != 0;
         users.push_back(user);
     }
     
-    sqlite3_finalize(stmt);
     return users;
 }
 
 bool Database::saveSession(const std::string& token, int userId, const std::string& expiresAt) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "INSERT OR REPLACE INTO sessions (token, user_id, expires_at) VALUES (?, ?, ?)";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::SAVE_SESSION));
+    if (!stmt) {
         return false;
     }
     
@@ -557,19 +827,13 @@ bool Database::saveSession(const std::string& token, int userId, const std::stri
     sqlite3_bind_text(stmt, 3, expiresAt.c_str(), -1, SQLITE_STATIC);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
 int Database::getUserIdFromSession(const std::string& token) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
-    
-    const char* sql = "SELECT user_id FROM sessions WHERE token = ? AND expires_at > datetime('now')";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    std::unique_lock<std::mutex> lock;
+    Statement stmt(reader(lock).get(Query::SESSION_USER));
+    if (!stmt) {
         return -1;
     }
     
@@ -580,26 +844,20 @@ int Database::getUserIdFromSession(const std::string& token) {
         userId = sqlite3_column_int(stmt, 0);
     }
     
-    sqlite3_finalize(stmt);
     return userId;
 }
 
 bool Database::deleteSession(const std::string& token) {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
-    const char* sql = "DELETE FROM sessions WHERE token = ?";
-    sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << std::endl;
+    Statement stmt(statements_.get(Query::DELETE_SESSION));
+    if (!stmt) {
         return false;
     }
     
     sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_STATIC);
     
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
     return rc == SQLITE_DONE;
 }
 
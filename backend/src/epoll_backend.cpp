@@ -0,0 +1,405 @@
+#include "epoll_backend.h"
+#include "event_loop.h"
+#include "websocket_handler.h"
+#include "tls_context.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+EpollBackend::EpollBackend(EventLoop* loop, IoCallbacks callbacks) : IoBackend(loop, std::move(callbacks)) {
+}
+
+bool EpollBackend::initialize() {
+    loop_->setPreWaitHook([this]() {
+        flushScheduled();
+    });
+    return true;
+}
+
+bool EpollBackend::addListener(int listenSocket, AcceptCallback onAccept) {
+    return loop_->add(listenSocket, EPOLLIN | EPOLLET, [this, listenSocket, onAccept](uint32_t) {
+        acceptConnections(listenSocket, onAccept);
+    });
+}
+
+void EpollBackend::acceptConnections(int listenSocket, const AcceptCallback& onAccept) {
+    // Edge-triggered: drain the accept queue until EAGAIN
+    while (true) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrLen = sizeof(clientAddr);
+
+        int clientSocket = accept4(listenSocket, (struct sockaddr*)&clientAddr, &clientAddrLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EMFILE/ENFILE and friends: leave the rest queued for the next edge
+            std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        // Get client address
+        char clientIP[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
+        std::string remoteAddress = std::string(clientIP) + ":" + std::to_string(ntohs(clientAddr.sin_port));
+
+        onAccept(clientSocket, remoteAddress);
+    }
+}
+
+bool EpollBackend::attach(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (tls_) {
+        // The handshake runs inside the first reads
+        conn->tls = tls_->createSession(conn->socket);
+        if (!conn->tls) {
+            return false;
+        }
+    }
+
+    // Edge-triggered for both directions: EPOLLOUT fires once whenever the
+    // socket becomes writable again, which is exactly when outbound can drain.
+    return loop_->add(conn->socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [this, conn](uint32_t events) {
+        onSocketEvent(conn, events);
+    });
+}
+
+void EpollBackend::onSocketEvent(const std::shared_ptr<WebSocketConnection>& conn, uint32_t events) {
+    if (events & EPOLLOUT) {
+        flushOutbound(conn);
+        if (conn->socketClosed) {
+            return;
+        }
+    }
+
+    // A TLS read that had to write (handshake messages, a session ticket)
+    // continues on the writable edge
+    bool tlsRetry = (events & EPOLLOUT) && conn->tls && conn->tls->readWantsWrite;
+
+    if (tlsRetry || (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        // While closing, keep draining so the kernel does not answer unread
+        // input with a RST that could overtake the response we are flushing
+        bool closing = !conn->active;
+        size_t before = conn->inbound.size();
+        bool open = readSocket(conn, closing);
+
+        if (!closing && conn->inbound.size() != before) {
+            callbacks_.onData(conn);
+        }
+        // Anything written before the handshake finished was held back
+        if (open && conn->tls && !conn->socketClosed) {
+            flushOutbound(conn);
+        }
+        if (open || conn->socketClosed) {
+            return;
+        }
+        if (conn->active) {
+            callbacks_.onDisconnect(conn);
+        }
+        // A half-closed peer can still take the rest of a graceful close;
+        // after a hangup or error nothing queued can be delivered.
+        if (!conn->socketClosed && (events & (EPOLLHUP | EPOLLERR))) {
+            finishClose(conn);
+        }
+    }
+}
+
+bool EpollBackend::readSocket(const std::shared_ptr<WebSocketConnection>& conn, bool discard) {
+    if (conn->tls) {
+        return readTls(conn, discard);
+    }
+
+    // One scratch buffer per I/O thread; connections only keep what is unparsed
+    thread_local char buffer[16384];
+
+    while (true) {
+        ssize_t bytesRead = recv(conn->socket, buffer, sizeof(buffer), 0);
+        if (bytesRead > 0) {
+            if (!discard) {
+                conn->inbound.append(buffer, bytesRead);
+            }
+            continue;
+        }
+        if (bytesRead == 0) {
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        return false;
+    }
+}
+
+bool EpollBackend::readTls(const std::shared_ptr<WebSocketConnection>& conn, bool discard) {
+    // Sized for one full TLS record
+    thread_local char buffer[16384];
+
+    while (true) {
+        size_t bytesRead = 0;
+        TlsSession::Status status;
+        {
+            // OpenSSL may write while reading, so the session is only ever
+            // used under the write lock
+            std::lock_guard<std::mutex> lock(conn->writeMutex);
+            status = conn->tls->read(buffer, sizeof(buffer), bytesRead);
+            conn->tls->readWantsWrite = status == TlsSession::Status::WANT_WRITE;
+        }
+
+        switch (status) {
+            case TlsSession::Status::OK:
+                if (!discard) {
+                    conn->inbound.append(buffer, bytesRead);
+                }
+                continue;
+            case TlsSession::Status::WANT_READ:
+            case TlsSession::Status::WANT_WRITE:
+                return true;
+            default:
+                // close_notify, a reset or a failed handshake
+                return false;
+        }
+    }
+}
+
+bool EpollBackend::writeTls(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count) {
+    // A record carries up to 16KB, so gathering the pieces keeps a small
+    // response in one record instead of one per piece
+    thread_local std::string gathered;
+    const char* data = static_cast<const char*>(iov[0].iov_base);
+    size_t size = iov[0].iov_len;
+    if (count > 1) {
+        gathered.clear();
+        for (int i = 0; i < count; i++) {
+            gathered.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+        data = gathered.data();
+        size = gathered.size();
+    }
+
+    size_t offset = 0;
+    if (!writeTlsDirect(conn, data, size, offset)) {
+        return false;
+    }
+    conn->outbound.append(data + offset, size - offset);
+    return true;
+}
+
+bool EpollBackend::writeTlsDirect(const std::shared_ptr<WebSocketConnection>& conn, const char* data, size_t size,
+                                  size_t& offset) {
+    if (!conn->outbound.empty() || !conn->tls->handshakeDone()) {
+        return true;
+    }
+    while (offset < size) {
+        size_t written = 0;
+        TlsSession::Status status = conn->tls->write(data + offset, size - offset, written);
+        sendCalls_.fetch_add(1, std::memory_order_relaxed);
+        if (status == TlsSession::Status::OK) {
+            offset += written;
+            conn->bytesSent.fetch_add(written, std::memory_order_relaxed);
+            continue;
+        }
+        // On WANT_* OpenSSL keeps the record it started; outbound begins with
+        // the same bytes, which is what the retry has to pass
+        return status == TlsSession::Status::WANT_WRITE || status == TlsSession::Status::WANT_READ;
+    }
+    return true;
+}
+
+bool EpollBackend::flushTls(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (!conn->tls->handshakeDone()) {
+        // Held until the handshake is done, unless the connection is already closing
+        return conn->active;
+    }
+    // One segment at a time: a retried write must start at the same bytes
+    struct iovec front;
+    while (conn->outbound.gather(&front, 1) == 1) {
+        size_t written = 0;
+        TlsSession::Status status = conn->tls->write(static_cast<const char*>(front.iov_base), front.iov_len, written);
+        sendCalls_.fetch_add(1, std::memory_order_relaxed);
+        if (status == TlsSession::Status::OK) {
+            conn->outbound.consume(written);
+            conn->bytesSent.fetch_add(written, std::memory_order_relaxed);
+            continue;
+        }
+        return status == TlsSession::Status::WANT_WRITE || status == TlsSession::Status::WANT_READ;
+    }
+    return true;
+}
+
+bool EpollBackend::writev(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count) {
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    if (!conn->active) {
+        return false;
+    }
+    if (count <= 0) {
+        return true;
+    }
+
+    // Under kTLS the kernel builds the records and the plaintext path applies
+    if (conn->tls && !conn->tls->kernelSend()) {
+        return writeTls(conn, iov, std::min(count, MAX_IOVECS));
+    }
+
+    for (int i = 0; i < count; i++) {
+        conn->outbound.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    scheduleFlush(conn);
+    return true;
+}
+
+bool EpollBackend::writeShared(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& buffer,
+                               uint64_t coalesceKey) {
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    if (!conn->active) {
+        return false;
+    }
+
+    if (conn->tls && !conn->tls->kernelSend()) {
+        size_t offset = 0;
+        if (!writeTlsDirect(conn, buffer->data(), buffer->size(), offset)) {
+            return false;
+        }
+        // The unsent tail stays in the shared buffer
+        conn->outbound.append(buffer, offset, coalesceKey);
+        return true;
+    }
+
+    conn->outbound.append(buffer, 0, coalesceKey);
+    scheduleFlush(conn);
+    return true;
+}
+
+void EpollBackend::scheduleFlush(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (conn->writeScheduled) {
+        return;
+    }
+    conn->writeScheduled = true;
+    if (loop_->isInLoopThread()) {
+        scheduled_.push_back(conn);
+    } else {
+        loop_->post([this, conn]() {
+            scheduled_.push_back(conn);
+        });
+    }
+}
+
+void EpollBackend::flushScheduled() {
+    if (scheduled_.empty()) {
+        return;
+    }
+    std::vector<std::shared_ptr<WebSocketConnection>> batch;
+    batch.swap(scheduled_);
+    for (const auto& conn : batch) {
+        {
+            std::lock_guard<std::mutex> lock(conn->writeMutex);
+            conn->writeScheduled = false;
+        }
+        if (!conn->socketClosed) {
+            flushOutbound(conn);
+        }
+    }
+}
+
+void EpollBackend::flushOutbound(const std::shared_ptr<WebSocketConnection>& conn) {
+    bool finished = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+
+        bool failed = false;
+        if (conn->tls && !conn->tls->kernelSend()) {
+            failed = !flushTls(conn);
+        } else {
+            struct iovec iov[FLUSH_IOVECS];
+            while (!conn->outbound.empty()) {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = conn->outbound.gather(iov, FLUSH_IOVECS);
+
+                ssize_t sent = sendmsg(conn->socket, &msg, MSG_NOSIGNAL);
+                sendCalls_.fetch_add(1, std::memory_order_relaxed);
+                if (sent > 0) {
+                    conn->outbound.consume(sent);
+                    conn->bytesSent.fetch_add(sent, std::memory_order_relaxed);
+                    continue;
+                }
+                if (sent == -1 && errno == EINTR) {
+                    continue;
+                }
+                failed = sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK;
+                break;
+            }
+        }
+
+        // A graceful close completes once the queue is drained (or can never be)
+        finished = !conn->active && (conn->outbound.empty() || failed);
+        if (finished && !failed && conn->tls) {
+            conn->tls->shutdown();
+        }
+    }
+
+    if (finished) {
+        finishClose(conn);
+    }
+}
+
+void EpollBackend::close(const std::shared_ptr<WebSocketConnection>& conn) {
+    bool drained;
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->active = false;
+        drained = conn->outbound.empty();
+        if (drained && conn->tls) {
+            conn->tls->shutdown();
+        }
+    }
+
+    if (drained) {
+        finishClose(conn);
+    }
+}
+
+void EpollBackend::abort(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (conn->socketClosed) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->active = false;
+        conn->outbound.clear();
+    }
+
+    // Zero linger turns the close into a RST instead of leaving unsent data
+    // for the kernel to retry
+    struct linger reset = {1, 0};
+    setsockopt(conn->socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    finishClose(conn);
+}
+
+void EpollBackend::finishClose(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (conn->socketClosed) {
+        return;
+    }
+    conn->socketClosed = true;
+    loop_->remove(conn->socket);
+
+    // Writers on other threads check active under this lock, so nobody can
+    // send on the fd number after it has been closed and reused.
+    std::lock_guard<std::mutex> lock(conn->writeMutex);
+    conn->active = false;
+    conn->outbound.clear();
+    conn->tls.reset();
+    ::close(conn->socket);
+}
@@ -0,0 +1,233 @@
+#include "event_loop.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace {
+const int MAX_EVENTS = 256;
+}
+
+EventLoop::EventLoop() : epollFd_(-1), wakeFd_(-1), running_(false) {
+}
+
+EventLoop::~EventLoop() {
+    if (wakeFd_ != -1) {
+        ::close(wakeFd_);
+    }
+    if (epollFd_ != -1) {
+        ::close(epollFd_);
+    }
+}
+
+bool EventLoop::initialize() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ == -1) {
+        std::cerr << "Failed to create epoll instance: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ == -1) {
+        std::cerr << "Failed to create eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // The wakeup fd is registered with a null data pointer so it never goes
+    // through the watcher table.
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev) == -1) {
+        std::cerr << "Failed to register eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void EventLoop::run() {
+    threadId_ = std::this_thread::get_id();
+    running_ = true;
+
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running_) {
+        if (preWaitHook_) {
+            preWaitHook_();
+        }
+        int count = epoll_wait(epollFd_, events, MAX_EVENTS, nextTimeoutMs());
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Watcher* watcher = static_cast<Watcher*>(events[i].data.ptr);
+            if (!watcher) {
+                drainWakeup();
+                continue;
+            }
+            if (!watcher->active) {
+                continue;
+            }
+
+            try {
+                watcher->callback(events[i].events);
+            } catch (const std::exception& e) {
+                std::cerr << "Exception in event callback: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Unknown exception in event callback" << std::endl;
+            }
+        }
+
+        runPendingTasks();
+        runExpiredTimers();
+        retired_.clear();
+    }
+
+    runPendingTasks();
+    retired_.clear();
+}
+
+void EventLoop::stop() {
+    running_ = false;
+    wakeup();
+}
+
+bool EventLoop::add(int fd, uint32_t events, EventCallback callback) {
+    auto watcher = std::make_unique<Watcher>();
+    watcher->fd = fd;
+    watcher->callback = std::move(callback);
+    watcher->active = true;
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = watcher.get();
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        std::cerr << "Failed to add fd " << fd << " to epoll: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    watchers_[fd] = std::move(watcher);
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    auto it = watchers_.find(fd);
+    if (it == watchers_.end()) {
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = it->second.get();
+    if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        std::cerr << "Failed to modify fd " << fd << " in epoll: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    auto it = watchers_.find(fd);
+    if (it == watchers_.end()) {
+        return;
+    }
+
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+
+    // The callback may be the one currently executing, so keep it alive until
+    // the end of this dispatch round.
+    it->second->active = false;
+    retired_.push_back(std::move(it->second));
+    watchers_.erase(it);
+}
+
+EventLoop::TimerId EventLoop::runAfter(std::chrono::milliseconds delay, Task task) {
+    return timers_.schedule(Clock::now(), delay, std::move(task));
+}
+
+void EventLoop::cancelTimer(TimerId id) {
+    timers_.cancel(id);
+}
+
+int EventLoop::nextTimeoutMs() const {
+    Clock::time_point deadline = timers_.nextDeadline();
+    if (deadline == Clock::time_point::max()) {
+        return -1;
+    }
+    auto remaining = deadline - Clock::now();
+    if (remaining <= Clock::duration::zero()) {
+        return 0;
+    }
+    // Round up so we never wake just before the deadline and spin
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()) + 1;
+}
+
+void EventLoop::runExpiredTimers() {
+    Clock::time_point now = Clock::now();
+    Task task;
+    while (timers_.popExpired(now, task)) {
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Exception in timer: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Unknown exception in timer" << std::endl;
+        }
+    }
+}
+
+void EventLoop::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        pendingTasks_.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void EventLoop::runInLoop(Task task) {
+    if (isInLoopThread()) {
+        task();
+    } else {
+        post(std::move(task));
+    }
+}
+
+void EventLoop::wakeup() {
+    if (wakeFd_ == -1) {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t written = ::write(wakeFd_, &one, sizeof(one));
+    (void)written; // EAGAIN means a wakeup is already pending
+}
+
+void EventLoop::drainWakeup() {
+    uint64_t value;
+    while (::read(wakeFd_, &value, sizeof(value)) > 0) {
+    }
+}
+
+void EventLoop::runPendingTasks() {
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks.swap(pendingTasks_);
+    }
+
+    for (auto& task : tasks) {
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Exception in loop task: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Unknown exception in loop task" << std::endl;
+        }
+    }
+}
@@ -4,30 +4,46 @@
 GroupChat::GroupChat(std::shared_ptr<Database> database) : database_(database) {
 }
 
+void GroupChat::setMembershipCallback(MembershipCallback callback) {
+    membershipCallback_ = callback;
+}
+
 bool GroupChat::createGroup(const std::string& name, const std::string& description, int creatorId) {
     return database_->createGroup(name, description, creatorId);
 }
 
-bool GroupChat::deleteGroup(int groupId, int userId) {
+bool GroupChat::deleteGroup(int /*groupId*/, int /*userId*/) {
     // TODO: Implement group deletion with permission check
     return false;
 }
 
-bool GroupChat::updateGroup(int groupId, const std::string& name, const std::string& description, int userId) {
+bool GroupChat::updateGroup(int /*groupId*/, const std::string& /*name*/, const std::string& /*description*/, int /*userId*/) {
     // TODO: Implement group update with permission check
     return false;
 }
 
 bool GroupChat::addMember(int groupId, int userId, const std::string& role) {
-    return database_->addUserToGroup(groupId, userId, role);
+    if (!database_->addUserToGroup(groupId, userId, role)) {
+        return false;
+    }
+    if (membershipCallback_) {
+        membershipCallback_(groupId, userId, true);
+    }
+    return true;
 }
 
-bool GroupChat::removeMember(int groupId, int userId, int adminId) {
+bool GroupChat::removeMember(int groupId, int userId, int /*adminId*/) {
     // TODO: Implement member removal with permission check
-    return database_->removeUserFromGroup(groupId, userId);
+    if (!database_->removeUserFromGroup(groupId, userId)) {
+        return false;
+    }
+    if (membershipCallback_) {
+        membershipCallback_(groupId, userId, false);
+    }
+    return true;
 }
 
-bool GroupChat::updateMemberRole(int groupId, int userId, const std::string& role, int adminId) {
+bool GroupChat::updateMemberRole(int /*groupId*/, int /*userId*/, const std::string& /*role*/, int /*adminId*/) {
     // TODO: Implement role update with permission check
     return false;
 }
@@ -40,22 +56,22 @@ std::vector<User> GroupChat::getGroupMembers(int groupId) {
     return database_->getGroupMembers(groupId);
 }
 
-Group GroupChat::getGroupById(int groupId) {
+Group GroupChat::getGroupById(int /*groupId*/) {
     // TODO: Implement get group by ID
     return Group{};
 }
 
-bool GroupChat::isGroupAdmin(int groupId, int userId) {
+bool GroupChat::isGroupAdmin(int /*groupId*/, int /*userId*/) {
     // TODO: Implement admin check
     return false;
 }
 
-bool GroupChat::isGroupMember(int groupId, int userId) {
+bool GroupChat::isGroupMember(int /*groupId*/, int /*userId*/) {
     // TODO: Implement member check
     return true;
 }
 
-bool GroupChat::canManageGroup(int groupId, int userId) {
+bool GroupChat::canManageGroup(int /*groupId*/, int /*userId*/) {
     // TODO: Implement permission check
     return false;
 } 
\ No newline at end of file
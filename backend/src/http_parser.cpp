@@ -0,0 +1,261 @@
+#include "http_parser.h"
+#include <cstring>
+
+namespace {
+
+char asciiLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+bool isTokenChar(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    return std::strchr("!#$%&'*+-.^_`|~", c) != nullptr && c != '\0';
+}
+
+bool isToken(std::string_view s) {
+    if (s.empty()) {
+        return false;
+    }
+    for (char c : s) {
+        if (!isTokenChar(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view trimWhitespace(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+} // namespace
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (asciiLower(a[i]) != asciiLower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    for (const auto& [key, value] : headers) {
+        if (equalsIgnoreCase(key, name)) {
+            return value;
+        }
+    }
+    return std::string_view();
+}
+
+bool HttpRequest::headerHasToken(std::string_view name, std::string_view token) const {
+    // The same list header may be repeated; every occurrence counts
+    for (const auto& [key, value] : headers) {
+        if (!equalsIgnoreCase(key, name)) {
+            continue;
+        }
+        std::string_view rest = value;
+        while (!rest.empty()) {
+            size_t comma = rest.find(',');
+            std::string_view item = trimWhitespace(rest.substr(0, comma));
+            if (equalsIgnoreCase(item, token)) {
+                return true;
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            rest.remove_prefix(comma + 1);
+        }
+    }
+    return false;
+}
+
+HttpParser::HttpParser(size_t maxHeaderSize, size_t maxBodySize)
+    : maxHeaderSize_(maxHeaderSize), maxBodySize_(maxBodySize) {
+    reset();
+}
+
+void HttpParser::reset() {
+    state_ = State::REQUEST_LINE;
+    lineStart_ = 0;
+    scanned_ = 0;
+    headerEnd_ = 0;
+    contentLength_ = 0;
+    hasContentLength_ = false;
+    errorStatus_ = 0;
+    method_ = Span();
+    target_ = Span();
+    // clear() keeps the capacity for the next request on this connection
+    headerSpans_.clear();
+    request_.headers.clear();
+    request_.method = request_.target = request_.path = request_.query = request_.body = std::string_view();
+    request_.versionMinor = 1;
+}
+
+HttpParser::Result HttpParser::fail(int status) {
+    state_ = State::ERROR;
+    errorStatus_ = status;
+    return Result::ERROR;
+}
+
+HttpParser::Result HttpParser::parse(const char* data, size_t size) {
+    if (state_ == State::ERROR) {
+        return Result::ERROR;
+    }
+
+    while (state_ == State::REQUEST_LINE || state_ == State::HEADERS) {
+        const char* newline = scanned_ < size
+            ? static_cast<const char*>(std::memchr(data + scanned_, '\n', size - scanned_))
+            : nullptr;
+        if (!newline) {
+            scanned_ = size;
+            if (size > maxHeaderSize_) {
+                return fail(431);
+            }
+            return Result::INCOMPLETE;
+        }
+
+        size_t end = newline - data;
+        size_t offset = lineStart_;
+        size_t length = end - offset;
+        if (length > 0 && data[end - 1] == '\r') {
+            length--;
+        }
+        scanned_ = lineStart_ = end + 1;
+        if (scanned_ > maxHeaderSize_) {
+            return fail(431);
+        }
+
+        if (state_ == State::REQUEST_LINE) {
+            // Clients may send a stray CRLF after a body; skip it
+            if (length == 0) {
+                continue;
+            }
+            if (!parseRequestLine(data + offset, offset, length)) {
+                return fail(errorStatus_ ? errorStatus_ : 400);
+            }
+            state_ = State::HEADERS;
+        } else if (length == 0) {
+            headerEnd_ = scanned_;
+            state_ = State::BODY;
+        } else if (!parseHeaderLine(data + offset, offset, length)) {
+            return fail(errorStatus_ ? errorStatus_ : 400);
+        }
+    }
+
+    if (state_ == State::BODY) {
+        if (size - headerEnd_ < contentLength_) {
+            return Result::INCOMPLETE;
+        }
+        state_ = State::COMPLETE;
+    }
+
+    // Rebuilt on every call since the buffer may have moved
+    buildRequest(data);
+    return Result::COMPLETE;
+}
+
+bool HttpParser::parseRequestLine(const char* line, size_t offset, size_t length) {
+    std::string_view text(line, length);
+
+    size_t methodEnd = text.find(' ');
+    if (methodEnd == std::string_view::npos || !isToken(text.substr(0, methodEnd))) {
+        return false;
+    }
+    size_t targetEnd = text.find(' ', methodEnd + 1);
+    if (targetEnd == std::string_view::npos || targetEnd == methodEnd + 1) {
+        return false;
+    }
+
+    std::string_view version = text.substr(targetEnd + 1);
+    if (version.size() != 8 || version.substr(0, 5) != "HTTP/" || version[6] != '.' ||
+        version[5] < '0' || version[5] > '9' || version[7] < '0' || version[7] > '9') {
+        return false;
+    }
+    if (version[5] != '1') {
+        errorStatus_ = 505;
+        return false;
+    }
+
+    method_ = Span{offset, methodEnd};
+    target_ = Span{offset + methodEnd + 1, targetEnd - methodEnd - 1};
+    request_.versionMinor = version[7] - '0';
+    return true;
+}
+
+bool HttpParser::parseHeaderLine(const char* line, size_t offset, size_t length) {
+    // Obsolete line folding is rejected rather than unfolded (RFC 9112 5.2)
+    if (line[0] == ' ' || line[0] == '\t') {
+        return false;
+    }
+
+    std::string_view text(line, length);
+    size_t colon = text.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    std::string_view name = text.substr(0, colon);
+    if (!isToken(name)) {
+        return false;
+    }
+    std::string_view value = trimWhitespace(text.substr(colon + 1));
+
+    if (equalsIgnoreCase(name, "Content-Length")) {
+        if (value.empty()) {
+            return false;
+        }
+        size_t parsed = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            parsed = parsed * 10 + (c - '0');
+            if (parsed > maxBodySize_) {
+                errorStatus_ = 413;
+                return false;
+            }
+        }
+        if (hasContentLength_ && parsed != contentLength_) {
+            return false;
+        }
+        hasContentLength_ = true;
+        contentLength_ = parsed;
+    } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+        // No endpoint takes chunked uploads
+        errorStatus_ = 501;
+        return false;
+    }
+
+    Span valueSpan{offset + (value.data() - line), value.size()};
+    headerSpans_.push_back(std::make_pair(Span{offset, name.size()}, valueSpan));
+    return true;
+}
+
+void HttpParser::buildRequest(const char* data) {
+    request_.method = std::string_view(data + method_.offset, method_.length);
+    request_.target = std::string_view(data + target_.offset, target_.length);
+
+    size_t question = request_.target.find('?');
+    request_.path = request_.target.substr(0, question);
+    request_.query = question == std::string_view::npos
+        ? std::string_view() : request_.target.substr(question + 1);
+
+    request_.headers.clear();
+    for (const auto& [name, value] : headerSpans_) {
+        request_.headers.emplace_back(std::string_view(data + name.offset, name.length),
+                                      std::string_view(data + value.offset, value.length));
+    }
+
+    request_.body = std::string_view(data + headerEnd_, contentLength_);
+}
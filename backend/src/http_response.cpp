@@ -0,0 +1,66 @@
+#include "http_response.h"
+
+namespace HttpHeaders {
+const std::string_view JSON =
+    "Content-Type: application/json\r\n"
+    "Access-Control-Allow-Origin: *\r\n";
+const std::string_view TEXT =
+    "Content-Type: text/plain\r\n";
+const std::string_view CORS =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
+    "Access-Control-Max-Age: 86400\r\n";
+const std::string_view JSON_CORS =
+    "Content-Type: application/json\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
+    "Access-Control-Max-Age: 86400\r\n";
+}
+
+namespace {
+const std::string_view HEADER_END = "\r\n";
+}
+
+HttpResponse::HttpResponse(std::string_view status, std::string_view staticHeaders)
+    : staticHeaders_(staticHeaders), keepAlive_(false) {
+    // Room for the status line plus Content-Length and Connection
+    head_.reserve(96);
+    head_ += "HTTP/1.1 ";
+    head_ += status;
+    head_ += "\r\n";
+}
+
+void HttpResponse::addHeader(std::string_view name, std::string_view value) {
+    head_ += name;
+    head_ += ": ";
+    head_ += value;
+    head_ += "\r\n";
+}
+
+void HttpResponse::setBody(std::string body) {
+    ownedBody_ = std::move(body);
+    body_ = ownedBody_;
+}
+
+void HttpResponse::setStaticBody(std::string_view body) {
+    ownedBody_.clear();
+    body_ = body;
+}
+
+int HttpResponse::toIovecs(struct iovec* iov) {
+    head_ += "Content-Length: ";
+    head_ += std::to_string(body_.size());
+    head_ += keepAlive_ ? "\r\nConnection: keep-alive\r\n" : "\r\nConnection: close\r\n";
+
+    iov[0].iov_base = const_cast<char*>(head_.data());
+    iov[0].iov_len = head_.size();
+    iov[1].iov_base = const_cast<char*>(staticHeaders_.data());
+    iov[1].iov_len = staticHeaders_.size();
+    iov[2].iov_base = const_cast<char*>(HEADER_END.data());
+    iov[2].iov_len = HEADER_END.size();
+    iov[3].iov_base = const_cast<char*>(body_.data());
+    iov[3].iov_len = body_.size();
+    return IOVEC_COUNT;
+}
@@ -0,0 +1,39 @@
+#include "io_backend.h"
+#include "epoll_backend.h"
+#include "uring_backend.h"
+
+bool parseIoBackendType(const std::string& name, IoBackendType& type) {
+    if (name == "epoll") {
+        type = IoBackendType::EPOLL;
+        return true;
+    }
+    if (name == "uring" || name == "io_uring") {
+        type = IoBackendType::URING;
+        return true;
+    }
+    return false;
+}
+
+const char* ioBackendName(IoBackendType type) {
+    switch (type) {
+        case IoBackendType::EPOLL: return "epoll";
+        case IoBackendType::URING: return "uring";
+        default: return "unknown";
+    }
+}
+
+bool ioBackendSupportsTls(IoBackendType type) {
+    // OpenSSL drives the socket itself, which needs readiness events; the
+    // uring backend's reads complete into its own buffer ring
+    return type == IoBackendType::EPOLL;
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(IoBackendType type, EventLoop* loop, IoCallbacks callbacks) {
+    switch (type) {
+        case IoBackendType::URING:
+            return std::make_unique<UringBackend>(loop, std::move(callbacks));
+        case IoBackendType::EPOLL:
+        default:
+            return std::make_unique<EpollBackend>(loop, std::move(callbacks));
+    }
+}
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <cstdlib>
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -9,9 +11,11 @@ std::unique_ptr<Server> server;
 void signalHandler(int signum) {
     std::cout << "\nReceived signal " << signum << ". Shutting down server..." << std::endl;
     if (server) {
+        // run() returns once every I/O loop has stopped and been joined
         server->stop();
+    } else {
+        exit(0);
     }
-    exit(0);
 }
 
 void printUsage(const char* programName) {
@@ -20,6 +24,26 @@ void printUsage(const char* programName) {
               << "  -p, --port PORT        Server port (default: 8080)\n"
               << "  -d, --database PATH    Database file path (default: cockpit.db)\n"
               << "  -i, --init-db          Initialize database\n"
+              << "  -t, --io-threads N     Number of I/O event loops (default: one per CPU)\n"
+              << "  -r, --reuseport        Give every I/O loop its own SO_REUSEPORT listener\n"
+              << "  -c, --pin-cpus         Pin each I/O loop to its own CPU\n"
+              << "  -b, --io-backend NAME  Socket I/O backend: epoll or uring (default: epoll)\n"
+              << "  -m, --max-connections N  Open connection limit, 0 for none (default: 10000)\n"
+              << "  -a, --max-per-ip N       Open connections per client address (default: 256)\n"
+              << "  -k, --max-pending N      Connections still waiting on a first request (default: 1024)\n"
+              << "  -C, --tls-cert PATH      Serve TLS with this PEM certificate chain\n"
+              << "  -K, --tls-key PATH       Private key for --tls-cert\n"
+              << "  -X, --ktls               Hand TLS record encryption to the kernel when it can\n"
+              << "  -Z, --no-deflate         Refuse the permessage-deflate WebSocket extension\n"
+              << "  -H, --queue-high BYTES   Per-connection send queue limit, 0 for none (default: 4194304)\n"
+              << "  -L, --queue-low BYTES    Level DROP_OLDEST trims a full queue back to (default: 1048576)\n"
+              << "  -O, --overflow POLICY    Full send queue: drop-oldest, coalesce or disconnect (default: drop-oldest)\n"
+              << "  -R, --db-readers N       Read-only database connections, 0 to read on the writer (default: 4)\n"
+              << "  -S, --db-sync MODE       Writer durability: off, normal, full or extra (default: normal)\n"
+              << "  -M, --db-mmap BYTES      Memory-mapped database size per connection (default: 268435456)\n"
+              << "  -E, --db-cache KIB       Page cache per database connection (default: 16384)\n"
+              << "  -B, --commit-batch N     Most messages stored in one transaction (default: 512)\n"
+              << "  -D, --commit-delay USEC  Longest a message waits to share a transaction (default: 250)\n"
               << "  -h, --help             Show this help message\n"
               << "  -v, --version          Show version information\n"
               << std::endl;
@@ -32,15 +56,41 @@ void printVersion() {
 }
 
 int main(int argc, char* argv[]) {
-    int port = 8080;
-    std::string dbPath = "cockpit.db";
+    ServerConfig config;
     bool initDb = false;
     
+    if (const char* cert = getenv("COCKPIT_SSL_CERT")) {
+        config.tlsCertFile = cert;
+    }
+    if (const char* key = getenv("COCKPIT_SSL_KEY")) {
+        config.tlsKeyFile = key;
+    }
+    
     // Parse command line arguments
     static struct option long_options[] = {
         {"port", required_argument, 0, 'p'},
         {"database", required_argument, 0, 'd'},
         {"init-db", no_argument, 0, 'i'},
+        {"io-threads", required_argument, 0, 't'},
+        {"reuseport", no_argument, 0, 'r'},
+        {"pin-cpus", no_argument, 0, 'c'},
+        {"io-backend", required_argument, 0, 'b'},
+        {"max-connections", required_argument, 0, 'm'},
+        {"max-per-ip", required_argument, 0, 'a'},
+        {"max-pending", required_argument, 0, 'k'},
+        {"tls-cert", required_argument, 0, 'C'},
+        {"tls-key", required_argument, 0, 'K'},
+        {"ktls", no_argument, 0, 'X'},
+        {"no-deflate", no_argument, 0, 'Z'},
+        {"queue-high", required_argument, 0, 'H'},
+        {"queue-low", required_argument, 0, 'L'},
+        {"overflow", required_argument, 0, 'O'},
+        {"db-readers", required_argument, 0, 'R'},
+        {"db-sync", required_argument, 0, 'S'},
+        {"db-mmap", required_argument, 0, 'M'},
+        {"db-cache", required_argument, 0, 'E'},
+        {"commit-batch", required_argument, 0, 'B'},
+        {"commit-delay", required_argument, 0, 'D'},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0}
@@ -49,17 +99,89 @@ int main(int argc, char* argv[]) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "p:d:ihv", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:d:it:rcb:m:a:k:C:K:XZH:L:O:R:S:M:E:B:D:hv", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'p':
-                port = std::stoi(optarg);
+                config.port = std::stoi(optarg);
                 break;
             case 'd':
-                dbPath = optarg;
+                config.database.path = optarg;
                 break;
             case 'i':
                 initDb = true;
                 break;
+            case 't':
+                config.ioThreads = std::stoi(optarg);
+                break;
+            case 'r':
+                config.reusePort = true;
+                break;
+            case 'c':
+                config.pinThreads = true;
+                break;
+            case 'b':
+                if (!parseIoBackendType(optarg, config.ioBackend)) {
+                    std::cerr << "Unknown I/O backend: " << optarg << std::endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                config.admission.maxConnections = std::stoul(optarg);
+                break;
+            case 'a':
+                config.admission.maxConnectionsPerIp = std::stoul(optarg);
+                break;
+            case 'k':
+                config.admission.maxPendingHandshakes = std::stoul(optarg);
+                break;
+            case 'C':
+                config.tlsCertFile = optarg;
+                break;
+            case 'K':
+                config.tlsKeyFile = optarg;
+                break;
+            case 'X':
+                config.ktls = true;
+                break;
+            case 'Z':
+                config.deflate.enabled = false;
+                break;
+            case 'H':
+                config.outbound.highWatermark = std::stoul(optarg);
+                break;
+            case 'L':
+                config.outbound.lowWatermark = std::stoul(optarg);
+                break;
+            case 'O':
+                if (!parseOverflowPolicy(optarg, config.outbound.policy)) {
+                    std::cerr << "Unknown overflow policy: " << optarg << std::endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                config.database.readers = std::stoul(optarg);
+                break;
+            case 'S':
+                if (!parseSyncMode(optarg, config.database.synchronous)) {
+                    std::cerr << "Unknown synchronous mode: " << optarg << std::endl;
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'M':
+                config.database.mmapSize = std::stoll(optarg);
+                break;
+            case 'E':
+                config.database.cacheSize = std::stoll(optarg);
+                break;
+            case 'B':
+                config.messageWriter.maxBatch = std::max<size_t>(1, std::stoul(optarg));
+                break;
+            case 'D':
+                config.messageWriter.maxDelay = std::chrono::microseconds(std::stoll(optarg));
+                break;
             case 'h':
                 printUsage(argv[0]);
                 return 0;
@@ -75,14 +197,17 @@ int main(int argc, char* argv[]) {
     // Set up signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    // OpenSSL writes TLS sockets without MSG_NOSIGNAL; a vanished peer must
+    // surface as EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
     
     std::cout << "Starting Cockpit Messenger Server..." << std::endl;
-    std::cout << "Port: " << port << std::endl;
-    std::cout << "Database: " << dbPath << std::endl;
+    std::cout << "Port: " << config.port << std::endl;
+    std::cout << "Database: " << config.database.path << std::endl;
     
     try {
         // Create and initialize server
-        server = std::make_unique<Server>(port);
+        server = std::make_unique<Server>(config);
         
         if (!server->initialize()) {
             std::cerr << "Failed to initialize server" << std::endl;
@@ -1,19 +1,21 @@
 #include "message_handler.h"
 #include <iostream>
 #include <sstream>
+#include <chrono>
 
 MessageHandler::MessageHandler(std::shared_ptr<Database> database, 
-                             std::shared_ptr<UserManager> userManager)
-    : database_(database), userManager_(userManager) {
+                             std::shared_ptr<UserManager> userManager,
+                             std::shared_ptr<PubSubHub> pubsub,
+                             std::shared_ptr<MessageWriter> writer)
+    : database_(database), userManager_(userManager), pubsub_(pubsub), writer_(writer) {
 }
 
 bool MessageHandler::sendMessage(int senderId, int receiverId, const std::string& content, 
-                                const std::string& messageType) {
-    // Validate users exist
-    User sender = userManager_->getUserById(senderId);
-    User receiver = userManager_->getUserById(receiverId);
-    
-    if (sender.id == 0 || receiver.id == 0) {
+                                const std::string& messageType, SendCallback done) {
+    // Callers run on an I/O loop, so the users are not looked up here: the
+    // messages table's foreign keys reject an unknown sender or receiver on
+    // the writer thread, and the message completes with -1
+    if (senderId <= 0 || receiverId <= 0) {
         std::cerr << "Invalid sender or receiver ID" << std::endl;
         return false;
     }
@@ -30,28 +32,44 @@ bool MessageHandler::sendMessage(int senderId, int receiverId, const std::string
     message.encrypted_content = encryptedContent;
     message.message_type = messageType;
     
-    // Save to database
-    if (!database_->saveMessage(message)) {
-        std::cerr << "Failed to save message" << std::endl;
-        return false;
-    }
-    
-    // Trigger message event
-    if (messageCallback_) {
-        MessageEvent event;
-        event.type = "new_message";
-        event.data = content;
-        event.senderId = senderId;
-        event.receiverId = receiverId;
-        event.groupId = 0;
-        messageCallback_(event);
-    }
+    // Save to database, in a transaction shared with concurrent senders
+    writer_->save(message, [this, message, done](int id) mutable {
+        if (id < 0) {
+            std::cerr << "Failed to save message" << std::endl;
+            if (done) {
+                done(-1);
+            }
+            return;
+        }
+        message.id = id;
+        
+        // The sender's other devices see it too
+        publish(Topic::user(message.receiver_id), MessageType::MESSAGE, message);
+        if (message.sender_id != message.receiver_id) {
+            publish(Topic::user(message.sender_id), MessageType::MESSAGE, message);
+        }
+        
+        // Trigger message event
+        if (messageCallback_) {
+            MessageEvent event;
+            event.type = "new_message";
+            event.data = message.content;
+            event.senderId = message.sender_id;
+            event.receiverId = message.receiver_id;
+            event.groupId = 0;
+            messageCallback_(event);
+        }
+        
+        if (done) {
+            done(id);
+        }
+    });
     
     return true;
 }
 
 bool MessageHandler::sendGroupMessage(int senderId, int groupId, const std::string& content,
-                                     const std::string& messageType) {
+                                     const std::string& messageType, SendCallback done) {
     // Validate user is in group
     if (!isUserInGroup(senderId, groupId)) {
         std::cerr << "User is not a member of the group" << std::endl;
@@ -70,22 +88,35 @@ bool MessageHandler::sendGroupMessage(int senderId, int groupId, const std::stri
     message.encrypted_content = encryptedContent;
     message.message_type = messageType;
     
-    // Save to database
-    if (!database_->saveMessage(message)) {
-        std::cerr << "Failed to save group message" << std::endl;
-        return false;
-    }
-    
-    // Trigger message event
-    if (messageCallback_) {
-        MessageEvent event;
-        event.type = "new_group_message";
-        event.data = content;
-        event.senderId = senderId;
-        event.receiverId = 0;
-        event.groupId = groupId;
-        messageCallback_(event);
-    }
+    // Save to database, in a transaction shared with concurrent senders
+    writer_->save(message, [this, message, done](int id) mutable {
+        if (id < 0) {
+            std::cerr << "Failed to save group message" << std::endl;
+            if (done) {
+                done(-1);
+            }
+            return;
+        }
+        message.id = id;
+        
+        // Members follow the group topic from sign-in or from joining; no member lookup here
+        publish(Topic::group(message.group_id), MessageType::GROUP_MESSAGE, message);
+        
+        // Trigger message event
+        if (messageCallback_) {
+            MessageEvent event;
+            event.type = "new_group_message";
+            event.data = message.content;
+            event.senderId = message.sender_id;
+            event.receiverId = 0;
+            event.groupId = message.group_id;
+            messageCallback_(event);
+        }
+        
+        if (done) {
+            done(id);
+        }
+    });
     
     return true;
 }
@@ -98,6 +129,10 @@ std::vector<Message> MessageHandler::getGroupMessages(int groupId, int limit) {
     return database_->getGroupMessages(groupId, limit);
 }
 
+std::vector<Group> MessageHandler::getUserGroups(int userId) {
+    return database_->getUserGroups(userId);
+}
+
 bool MessageHandler::markMessageAsRead(int messageId) {
     return database_->markMessageAsRead(messageId);
 }
@@ -135,4 +170,16 @@ bool MessageHandler::isUserInGroup(int userId, int groupId) {
     (void)userId;   // Suppress unused parameter warning
     (void)groupId;  // Suppress unused parameter warning
     return true;
-} 
\ No newline at end of file
+}
+
+void MessageHandler::publish(const Topic& topic, uint32_t type, const Message& message) {
+    Envelope envelope;
+    envelope.type = type;
+    envelope.id = message.id;
+    envelope.from = message.sender_id;
+    envelope.target = message.group_id ? message.group_id : message.receiver_id;
+    envelope.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    envelope.body = message.content;
+    pubsub_->publish(topic, envelope);
+}
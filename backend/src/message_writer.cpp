@@ -0,0 +1,115 @@
+#include "message_writer.h"
+#include <algorithm>
+#include <iterator>
+
+MessageWriter::MessageWriter(std::shared_ptr<Database> database, const MessageWriterConfig& config)
+    : database_(database), config_(config), running_(false), queued_(0), saved_(0), failed_(0), batches_(0) {
+}
+
+MessageWriter::~MessageWriter() {
+    stop();
+}
+
+void MessageWriter::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+}
+
+void MessageWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    // run() drains the queue before it returns
+    thread_.join();
+}
+
+void MessageWriter::save(Message message, Callback done) {
+    Pending pending{std::move(message), std::move(done)};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            if (queue_.empty()) {
+                firstQueued_ = std::chrono::steady_clock::now();
+            }
+            queue_.push_back(std::move(pending));
+            queued_++;
+            // Only the first message and a full batch change what run() waits for
+            if (queue_.size() == 1 || queue_.size() == config_.maxBatch) {
+                wakeup_.notify_one();
+            }
+            return;
+        }
+    }
+    std::vector<Pending> batch;
+    batch.push_back(std::move(pending));
+    write(batch);
+}
+
+std::future<int> MessageWriter::save(Message message) {
+    auto id = std::make_shared<std::promise<int>>();
+    std::future<int> result = id->get_future();
+    save(std::move(message), [id](int rowId) { id->set_value(rowId); });
+    return result;
+}
+
+void MessageWriter::run() {
+    std::vector<Pending> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_ || !queue_.empty()) {
+        wakeup_.wait(lock, [this]() { return !running_ || !queue_.empty(); });
+        // Give later messages until maxDelay after the first to join the batch
+        wakeup_.wait_until(lock, firstQueued_ + config_.maxDelay, [this]() {
+            return !running_ || queue_.size() >= config_.maxBatch;
+        });
+        if (queue_.empty()) {
+            continue;
+        }
+
+        size_t count = std::min(queue_.size(), config_.maxBatch);
+        batch.assign(std::make_move_iterator(queue_.begin()), std::make_move_iterator(queue_.begin() + count));
+        queue_.erase(queue_.begin(), queue_.begin() + count);
+        queued_ -= count;
+        // The rest waited through this batch's commit already
+        firstQueued_ = std::chrono::steady_clock::now() - config_.maxDelay;
+
+        lock.unlock();
+        write(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void MessageWriter::write(std::vector<Pending>& batch) {
+    std::vector<Message> messages;
+    messages.reserve(batch.size());
+    for (const Pending& pending : batch) {
+        messages.push_back(pending.message);
+    }
+
+    std::vector<int> ids;
+    database_->saveMessages(messages, ids);
+    batches_++;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (ids[i] >= 0) {
+            saved_++;
+        } else {
+            failed_++;
+        }
+        if (batch[i].done) {
+            batch[i].done(ids[i]);
+        }
+    }
+}
+
+MessageWriter::Stats MessageWriter::stats() const {
+    return {queued_.load(), saved_.load(), failed_.load(), batches_.load()};
+}
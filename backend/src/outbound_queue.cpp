@@ -0,0 +1,148 @@
+#include "outbound_queue.h"
+#include <algorithm>
+
+bool parseOverflowPolicy(const std::string& name, OverflowPolicy& policy) {
+    if (name == "drop-oldest") {
+        policy = OverflowPolicy::DROP_OLDEST;
+    } else if (name == "coalesce") {
+        policy = OverflowPolicy::COALESCE;
+    } else if (name == "disconnect") {
+        policy = OverflowPolicy::DISCONNECT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* overflowPolicyName(OverflowPolicy policy) {
+    switch (policy) {
+        case OverflowPolicy::DROP_OLDEST:
+            return "drop-oldest";
+        case OverflowPolicy::COALESCE:
+            return "coalesce";
+        case OverflowPolicy::DISCONNECT:
+            return "disconnect";
+    }
+    return "unknown";
+}
+
+void OutboundQueue::append(const char* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    const Segment* tail = segments_.empty() ? nullptr : &segments_.back();
+    if (!tail || tail->shared || tail->key || tail->copy.size() + size > COPY_SEGMENT_SIZE) {
+        segments_.emplace_back();
+    }
+    segments_.back().copy.append(data, size);
+    bytes_ += size;
+    enforceLimits();
+}
+
+void OutboundQueue::append(SharedBuffer buffer, size_t offset, uint64_t coalesceKey) {
+    if (!buffer || offset >= buffer->size()) {
+        return;
+    }
+
+    // The newer update makes a queued one with the same key redundant. The
+    // front segment may be partly sent, or mid-retry under TLS, so it stays.
+    if (coalesceKey && keyed_ && limits_.policy == OverflowPolicy::COALESCE) {
+        for (auto it = segments_.begin() + 1; it < segments_.end(); ++it) {
+            if (it->key == coalesceKey) {
+                erase(it);
+                coalesced_++;
+                break;
+            }
+        }
+    }
+
+    Segment segment;
+    segment.shared = std::move(buffer);
+    segment.offset = offset;
+    // Partly sent already, so it has to go out whole
+    segment.key = offset == 0 ? coalesceKey : 0;
+    bytes_ += segment.remaining();
+    keyed_ += segment.key ? 1 : 0;
+    segments_.push_back(std::move(segment));
+    enforceLimits();
+}
+
+void OutboundQueue::erase(std::deque<Segment>::iterator it) {
+    bytes_ -= it->remaining();
+    keyed_ -= it->key ? 1 : 0;
+    segments_.erase(it);
+}
+
+void OutboundQueue::enforceLimits() {
+    peak_ = std::max(peak_, bytes_);
+    if (limits_.highWatermark == 0 || bytes_ <= limits_.highWatermark) {
+        return;
+    }
+
+    if (limits_.policy == OverflowPolicy::DROP_OLDEST && keyed_) {
+        size_t target = std::min(limits_.lowWatermark, limits_.highWatermark);
+        auto it = segments_.begin() + 1;
+        while (bytes_ > target && keyed_ && it < segments_.end()) {
+            if (it->key) {
+                size_t index = it - segments_.begin();
+                erase(it);
+                dropped_++;
+                it = segments_.begin() + index;
+            } else {
+                ++it;
+            }
+        }
+    }
+    overflowed_ = bytes_ > limits_.highWatermark;
+}
+
+int OutboundQueue::gather(struct iovec* iov, int max) const {
+    int count = 0;
+    for (auto it = segments_.begin(); it != segments_.end() && count < max; ++it) {
+        const std::string& data = it->data();
+        iov[count].iov_base = const_cast<char*>(data.data() + it->offset);
+        iov[count].iov_len = data.size() - it->offset;
+        count++;
+    }
+    return count;
+}
+
+void OutboundQueue::consume(size_t size) {
+    bytes_ -= size;
+    while (size > 0) {
+        Segment& front = segments_.front();
+        size_t remaining = front.remaining();
+        if (size < remaining) {
+            front.offset += size;
+            // Partly on the wire now, so no longer droppable
+            keyed_ -= front.key ? 1 : 0;
+            front.key = 0;
+            return;
+        }
+        size -= remaining;
+        keyed_ -= front.key ? 1 : 0;
+        segments_.pop_front();
+    }
+}
+
+void OutboundQueue::dropUnsent() {
+    while (segments_.size() > 1) {
+        erase(segments_.end() - 1);
+    }
+    overflowed_ = false;
+}
+
+void OutboundQueue::clear() {
+    segments_.clear();
+    bytes_ = 0;
+    keyed_ = 0;
+    overflowed_ = false;
+}
+
+void OutboundQueue::swap(OutboundQueue& other) {
+    // Only the contents move; each queue keeps its own limits and counters
+    segments_.swap(other.segments_);
+    std::swap(bytes_, other.bytes_);
+    std::swap(keyed_, other.keyed_);
+    std::swap(overflowed_, other.overflowed_);
+}
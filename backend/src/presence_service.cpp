@@ -0,0 +1,224 @@
+#include "presence_service.h"
+#include "database.h"
+#include "pubsub_hub.h"
+#include <iostream>
+
+namespace {
+
+int64_t millisNow() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+PresenceService::PresenceService(std::shared_ptr<Database> database, std::shared_ptr<PubSubHub> pubsub)
+    : database_(database), pubsub_(pubsub), running_(false), online_(0), pending_(0), published_(0),
+      persisted_(0), batches_(0) {
+}
+
+PresenceService::~PresenceService() {
+    stop();
+}
+
+PresenceService::Shard& PresenceService::shardOf(int userId) {
+    uint32_t hash = static_cast<uint32_t>(userId) * 2654435761u;
+    return shards_[(hash >> 16) & (SHARDS - 1)];
+}
+
+void PresenceService::start() {
+    std::lock_guard<std::mutex> lock(runMutex_);
+    if (running_) {
+        return;
+    }
+    database_->clearOnlineStatus();
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+}
+
+void PresenceService::stop() {
+    {
+        std::lock_guard<std::mutex> lock(runMutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    wakeup_.notify_all();
+    thread_.join();
+
+    // Connections are going away with the server; nobody is left to tell
+    int64_t now = millisNow();
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& [userId, entry] : shard.users) {
+            if (entry.online) {
+                entry.lastSeen = now;
+                setOnline(shard, userId, entry, false, false);
+            }
+        }
+    }
+    flush();
+}
+
+void PresenceService::connected(int userId) {
+    Shard& shard = shardOf(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry& entry = shard.users[userId];
+    entry.devices++;
+    entry.lastSeen = millisNow();
+    if (!entry.online) {
+        setOnline(shard, userId, entry, true, true);
+    }
+    // A pending offline is dropped by expire() now that devices > 0
+}
+
+void PresenceService::disconnected(int userId) {
+    Shard& shard = shardOf(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end() || it->second.devices == 0) {
+        return;
+    }
+    Entry& entry = it->second;
+    entry.lastSeen = millisNow();
+    if (--entry.devices > 0) {
+        return;
+    }
+    entry.offlineAt = Clock::now() + OFFLINE_DEBOUNCE;
+    if (!entry.pending) {
+        entry.pending = true;
+        shard.pending.push_back(userId);
+        pending_++;
+    }
+}
+
+void PresenceService::setOnline(Shard& shard, int userId, Entry& entry, bool online, bool publish) {
+    entry.online = online;
+    if (online) {
+        online_++;
+    } else {
+        online_--;
+    }
+    if (!entry.dirty) {
+        entry.dirty = true;
+        shard.dirty.push_back(userId);
+    }
+    if (publish) {
+        // Only the latest state per user is worth queueing to a slow subscriber
+        Topic topic = Topic::presence(userId);
+        pubsub_->publish(topic, envelopeFor(userId, entry.online, entry.lastSeen), topic.key());
+        published_++;
+    }
+}
+
+PresenceService::Presence PresenceService::get(int userId) {
+    {
+        Shard& shard = shardOf(userId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.users.find(userId);
+        if (it != shard.users.end()) {
+            return {it->second.online, it->second.devices, it->second.lastSeen};
+        }
+    }
+    // Offline since its state was stored, or not connected since the server started
+    return {false, 0, database_->getUserLastSeen(userId)};
+}
+
+Envelope PresenceService::snapshot(int userId) {
+    Presence presence = get(userId);
+    return envelopeFor(userId, presence.online, presence.lastSeen);
+}
+
+Envelope PresenceService::envelopeFor(int userId, bool online, int64_t lastSeen) {
+    Envelope envelope;
+    envelope.type = MessageType::PRESENCE;
+    envelope.from = userId;
+    envelope.timestamp = lastSeen;
+    envelope.body = online ? "online" : "offline";
+    return envelope;
+}
+
+void PresenceService::run() {
+    std::unique_lock<std::mutex> lock(runMutex_);
+    while (running_) {
+        wakeup_.wait_for(lock, FLUSH_INTERVAL, [this]() { return !running_; });
+        lock.unlock();
+        expire();
+        flush();
+        lock.lock();
+    }
+}
+
+void PresenceService::expire() {
+    if (pending_ == 0) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto kept = shard.pending.begin();
+        for (int userId : shard.pending) {
+            Entry& entry = shard.users[userId];
+            if (entry.devices == 0 && entry.offlineAt > now) {
+                *kept++ = userId;
+                continue;
+            }
+            entry.pending = false;
+            pending_--;
+            if (entry.devices == 0 && entry.online) {
+                setOnline(shard, userId, entry, false, true);
+            }
+        }
+        shard.pending.erase(kept, shard.pending.end());
+    }
+}
+
+void PresenceService::flush() {
+    std::vector<PresenceRecord> records;
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (int userId : shard.dirty) {
+            Entry& entry = shard.users[userId];
+            entry.dirty = false;
+            records.push_back({userId, entry.online, entry.lastSeen});
+        }
+        shard.dirty.clear();
+    }
+    if (records.empty()) {
+        return;
+    }
+
+    if (!database_->savePresence(records)) {
+        // Retried with the next batch, with whatever the state is by then
+        std::cerr << "Failed to persist presence for " << records.size() << " users" << std::endl;
+        for (const PresenceRecord& record : records) {
+            Shard& shard = shardOf(record.user_id);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            Entry& entry = shard.users[record.user_id];
+            if (!entry.dirty) {
+                entry.dirty = true;
+                shard.dirty.push_back(record.user_id);
+            }
+        }
+        return;
+    }
+    persisted_ += records.size();
+    batches_++;
+
+    // Offline users are only kept until their state is stored; get() reads
+    // it back from the database after that
+    for (const PresenceRecord& record : records) {
+        Shard& shard = shardOf(record.user_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.users.find(record.user_id);
+        if (it != shard.users.end() && !it->second.online && it->second.devices == 0 &&
+            !it->second.dirty && !it->second.pending) {
+            shard.users.erase(it);
+        }
+    }
+}
+
+PresenceService::Stats PresenceService::stats() const {
+    return {online_.load(), pending_.load(), published_.load(), persisted_.load(), batches_.load()};
+}
@@ -0,0 +1,187 @@
+#include "pubsub_hub.h"
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+struct KindName {
+    Topic::Kind kind;
+    std::string_view prefix;
+};
+
+constexpr KindName KIND_NAMES[] = {
+    {Topic::Kind::GROUP, "group:"},
+    {Topic::Kind::USER, "user:"},
+    {Topic::Kind::PRESENCE, "presence:"},
+};
+
+size_t mix(uint64_t key) {
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 40);
+}
+
+} // namespace
+
+std::string Topic::name() const {
+    for (const KindName& entry : KIND_NAMES) {
+        if (entry.kind == kind) {
+            return std::string(entry.prefix) + std::to_string(id);
+        }
+    }
+    return std::to_string(id);
+}
+
+bool Topic::parse(std::string_view name, Topic& topic) {
+    for (const KindName& entry : KIND_NAMES) {
+        if (name.substr(0, entry.prefix.size()) != entry.prefix) {
+            continue;
+        }
+        std::string_view digits = name.substr(entry.prefix.size());
+        int id;
+        auto result = std::from_chars(digits.data(), digits.data() + digits.size(), id);
+        if (result.ec != std::errc() || result.ptr != digits.data() + digits.size() || id < 0) {
+            return false;
+        }
+        topic = {entry.kind, id};
+        return true;
+    }
+    return false;
+}
+
+PubSubHub::PubSubHub() : published_(0), delivered_(0) {
+}
+
+PubSubHub::TopicShard& PubSubHub::topicShard(uint64_t key) {
+    return topics_[mix(key) & (SHARDS - 1)];
+}
+
+const PubSubHub::TopicShard& PubSubHub::topicShard(uint64_t key) const {
+    return topics_[mix(key) & (SHARDS - 1)];
+}
+
+PubSubHub::MemberShard& PubSubHub::memberShard(const WebSocketConnection* subscriber) {
+    return members_[mix(reinterpret_cast<uintptr_t>(subscriber)) & (SHARDS - 1)];
+}
+
+bool PubSubHub::update(uint64_t key, const Subscriber& subscriber, bool add) {
+    TopicShard& shard = topicShard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    SubscriberList& list = shard.topics[key];
+    bool present = list && std::find(list->begin(), list->end(), subscriber) != list->end();
+    if (present == add) {
+        if (!list) {
+            shard.topics.erase(key);
+        }
+        return false;
+    }
+
+    // Publishers may still be walking the old list, so it is replaced rather
+    // than modified
+    auto next = std::make_shared<Subscribers>();
+    next->reserve((list ? list->size() : 0) + (add ? 1 : 0));
+    if (list) {
+        for (const Subscriber& existing : *list) {
+            if (existing != subscriber) {
+                next->push_back(existing);
+            }
+        }
+    }
+    if (add) {
+        next->push_back(subscriber);
+    }
+    if (next->empty()) {
+        shard.topics.erase(key);
+    } else {
+        list = std::move(next);
+    }
+    return true;
+}
+
+bool PubSubHub::subscribe(const Topic& topic, const Subscriber& subscriber) {
+    // Lock order is always member shard, then topic shard
+    MemberShard& members = memberShard(subscriber.get());
+    std::lock_guard<std::mutex> lock(members.mutex);
+    if (!update(topic.key(), subscriber, true)) {
+        return false;
+    }
+    members.topics[subscriber.get()].push_back(topic.key());
+    return true;
+}
+
+bool PubSubHub::unsubscribe(const Topic& topic, const Subscriber& subscriber) {
+    MemberShard& members = memberShard(subscriber.get());
+    std::lock_guard<std::mutex> lock(members.mutex);
+    if (!update(topic.key(), subscriber, false)) {
+        return false;
+    }
+    auto it = members.topics.find(subscriber.get());
+    if (it != members.topics.end()) {
+        std::vector<uint64_t>& keys = it->second;
+        keys.erase(std::remove(keys.begin(), keys.end(), topic.key()), keys.end());
+        if (keys.empty()) {
+            members.topics.erase(it);
+        }
+    }
+    return true;
+}
+
+void PubSubHub::unsubscribeAll(const Subscriber& subscriber) {
+    MemberShard& members = memberShard(subscriber.get());
+    std::lock_guard<std::mutex> lock(members.mutex);
+    auto it = members.topics.find(subscriber.get());
+    if (it == members.topics.end()) {
+        return;
+    }
+    for (uint64_t key : it->second) {
+        update(key, subscriber, false);
+    }
+    members.topics.erase(it);
+}
+
+PubSubHub::SubscriberList PubSubHub::subscribers(const Topic& topic) const {
+    const TopicShard& shard = topicShard(topic.key());
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.topics.find(topic.key());
+    return it == shard.topics.end() ? nullptr : it->second;
+}
+
+std::vector<uint64_t> PubSubHub::topicsOf(const Subscriber& subscriber) {
+    MemberShard& members = memberShard(subscriber.get());
+    std::lock_guard<std::mutex> lock(members.mutex);
+    auto it = members.topics.find(subscriber.get());
+    return it == members.topics.end() ? std::vector<uint64_t>() : it->second;
+}
+
+bool PubSubHub::isSubscribed(const Topic& topic, const Subscriber& subscriber) {
+    MemberShard& members = memberShard(subscriber.get());
+    std::lock_guard<std::mutex> lock(members.mutex);
+    auto it = members.topics.find(subscriber.get());
+    return it != members.topics.end() &&
+           std::find(it->second.begin(), it->second.end(), topic.key()) != it->second.end();
+}
+
+size_t PubSubHub::publish(const Topic& topic, const Envelope& envelope, uint64_t coalesceKey) {
+    published_++;
+    static const Subscribers none;
+    SubscriberList list = subscribers(topic);
+    if (!delivery_) {
+        return 0;
+    }
+    delivery_(topic, list ? *list : none, envelope, coalesceKey);
+    if (!list) {
+        return 0;
+    }
+    delivered_ += list->size();
+    return list->size();
+}
+
+PubSubHub::Stats PubSubHub::stats() const {
+    Stats stats{0, 0, published_.load(), delivered_.load()};
+    for (const TopicShard& shard : topics_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        stats.topics += shard.topics.size();
+        for (const auto& [key, list] : shard.topics) {
+            stats.subscriptions += list->size();
+        }
+    }
+    return stats;
+}
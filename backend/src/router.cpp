@@ -0,0 +1,184 @@
+#include "router.h"
+#include <iostream>
+
+namespace {
+
+const char* const METHOD_NAMES[HTTP_METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"
+};
+
+bool isParamSegment(std::string_view segment) {
+    return segment.size() > 2 && segment.front() == '{' && segment.back() == '}';
+}
+
+// Splits "/a/b" into "a" and "/b"
+std::string_view nextSegment(std::string_view& rest) {
+    rest.remove_prefix(1);
+    size_t slash = rest.find('/');
+    std::string_view segment = rest.substr(0, slash);
+    rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash);
+    return segment;
+}
+
+} // namespace
+
+bool parseHttpMethod(std::string_view name, HttpMethod& method) {
+    for (size_t i = 0; i < HTTP_METHOD_COUNT; i++) {
+        if (name == METHOD_NAMES[i]) {
+            method = static_cast<HttpMethod>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* httpMethodName(HttpMethod method) {
+    return METHOD_NAMES[static_cast<size_t>(method)];
+}
+
+std::string_view RouteParams::get(std::string_view name) const {
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].first == name) {
+            return items[i].second;
+        }
+    }
+    return std::string_view();
+}
+
+Router::Router() : nodes_(1) {
+}
+
+bool Router::add(HttpMethod method, const std::string& pattern, Handler handler) {
+    if (pattern.empty() || pattern[0] != '/') {
+        std::cerr << "Invalid route pattern: " << pattern << std::endl;
+        return false;
+    }
+
+    // Nodes are addressed by index because adding children may reallocate
+    uint32_t node = 0;
+    size_t paramCount = 0;
+    std::string_view rest = pattern == "/" ? std::string_view() : std::string_view(pattern);
+    while (!rest.empty()) {
+        std::string_view segment = nextSegment(rest);
+        if (segment.empty()) {
+            std::cerr << "Empty segment in route pattern: " << pattern << std::endl;
+            return false;
+        }
+
+        if (isParamSegment(segment)) {
+            std::string_view name = segment.substr(1, segment.size() - 2);
+            if (++paramCount > RouteParams::MAX_PARAMS) {
+                std::cerr << "Too many parameters in route pattern: " << pattern << std::endl;
+                return false;
+            }
+            if (nodes_[node].paramChild == NO_NODE) {
+                uint32_t child = static_cast<uint32_t>(nodes_.size());
+                nodes_.emplace_back();
+                nodes_[child].paramName = std::string(name);
+                nodes_[node].paramChild = child;
+            } else if (nodes_[nodes_[node].paramChild].paramName != name) {
+                std::cerr << "Conflicting parameter name in route pattern: " << pattern << std::endl;
+                return false;
+            }
+            node = nodes_[node].paramChild;
+            continue;
+        }
+
+        if (segment.find_first_of("{}") != std::string_view::npos) {
+            std::cerr << "Invalid segment in route pattern: " << pattern << std::endl;
+            return false;
+        }
+
+        uint32_t next = NO_NODE;
+        for (const auto& [literal, child] : nodes_[node].literals) {
+            if (literal == segment) {
+                next = child;
+                break;
+            }
+        }
+        if (next == NO_NODE) {
+            next = static_cast<uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+            nodes_[node].literals.emplace_back(std::string(segment), next);
+        }
+        node = next;
+    }
+
+    unsigned bit = 1u << static_cast<unsigned>(method);
+    if (nodes_[node].methods & bit) {
+        std::cerr << "Duplicate route: " << httpMethodName(method) << " " << pattern << std::endl;
+        return false;
+    }
+    nodes_[node].methods |= bit;
+    nodes_[node].handlers[static_cast<size_t>(method)] = std::move(handler);
+    return true;
+}
+
+Router::Match Router::match(std::string_view method, std::string_view path, RouteParams& params) const {
+    Match result;
+    params.count = 0;
+
+    if (path.empty() || path[0] != '/') {
+        return result;
+    }
+    uint32_t node = find(0, path == "/" ? std::string_view() : path, params);
+    if (node == NO_NODE) {
+        return result;
+    }
+
+    const Node& target = nodes_[node];
+    HttpMethod parsed;
+    if (parseHttpMethod(method, parsed) && (target.methods & (1u << static_cast<unsigned>(parsed)))) {
+        result.status = Status::FOUND;
+        result.handler = &target.handlers[static_cast<size_t>(parsed)];
+        return result;
+    }
+    result.status = Status::METHOD_NOT_ALLOWED;
+    result.allowedMethods = target.methods;
+    return result;
+}
+
+uint32_t Router::find(uint32_t node, std::string_view rest, RouteParams& params) const {
+    const Node& current = nodes_[node];
+    if (rest.empty()) {
+        return current.methods ? node : NO_NODE;
+    }
+
+    std::string_view segment = nextSegment(rest);
+
+    // A literal match is preferred, but if nothing below it matches the rest
+    // of the path the parameter branch still gets a chance
+    for (const auto& [literal, child] : current.literals) {
+        if (literal == segment) {
+            uint32_t found = find(child, rest, params);
+            if (found != NO_NODE) {
+                return found;
+            }
+            break;
+        }
+    }
+
+    if (current.paramChild != NO_NODE && !segment.empty()) {
+        size_t saved = params.count;
+        params.items[params.count++] = std::make_pair(std::string_view(nodes_[current.paramChild].paramName), segment);
+        uint32_t found = find(current.paramChild, rest, params);
+        if (found != NO_NODE) {
+            return found;
+        }
+        params.count = saved;
+    }
+    return NO_NODE;
+}
+
+std::string Router::allowHeaderValue(unsigned allowedMethods) {
+    std::string value;
+    for (size_t i = 0; i < HTTP_METHOD_COUNT; i++) {
+        if (allowedMethods & (1u << i)) {
+            if (!value.empty()) {
+                value += ", ";
+            }
+            value += METHOD_NAMES[i];
+        }
+    }
+    return value;
+}
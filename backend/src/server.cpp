@@ -5,7 +5,13 @@
 #include "group_chat.h"
 #include "auth.h"
 #include "websocket_handler.h"
+#include "presence_service.h"
+#include "event_loop.h"
+#include "http_parser.h"
+#include "tls_context.h"
+#include "websocket_mask.h"
 #include <iostream>
+#include <algorithm>
 #include <sstream>
 #include <regex>
 #include <nlohmann/json.hpp>
@@ -17,13 +23,35 @@
 #include <thread>
 #include <chrono>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
 
 using json = nlohmann::json;
 
-Server::Server(int port) : port_(port), running_(false), database_(std::make_shared<Database>()), 
+Server::Server(const ServerConfig& config) : config_(config), port_(config.port), running_(false),
+                          database_(std::make_shared<Database>(config.database)),
                           userManager_(std::make_shared<UserManager>(database_)),
-                          messageHandler_(std::make_shared<MessageHandler>(database_, userManager_)),
-                          wsHandler_(std::make_shared<WebSocketHandler>(messageHandler_, userManager_)) {
+                          pubsub_(std::make_shared<PubSubHub>()),
+                          presence_(std::make_shared<PresenceService>(database_, pubsub_)),
+                          messageWriter_(std::make_shared<MessageWriter>(database_, config.messageWriter)),
+                          messageHandler_(std::make_shared<MessageHandler>(database_, userManager_, pubsub_,
+                                                                           messageWriter_)),
+                          wsHandler_(std::make_shared<WebSocketHandler>(messageHandler_, userManager_, pubsub_,
+                                                                        presence_)),
+                          groupChat_(std::make_shared<GroupChat>(database_)),
+                          nextLoop_(0) {
+    wsHandler_->admission().setLimits(config.admission);
+    // Members' live connections follow the group topic from the change on
+    groupChat_->setMembershipCallback([this](int groupId, int userId, bool member) {
+        if (member) {
+            wsHandler_->joinGroup(userId, groupId);
+        } else {
+            wsHandler_->leaveGroup(userId, groupId);
+        }
+    });
+    wsHandler_->setDeflateConfig(config.deflate);
+    wsHandler_->setOutboundLimits(config.outbound);
     setupRoutes();
 }
 
@@ -32,41 +60,57 @@ Server::~Server() {
 }
 
 void Server::setupRoutes() {
-    routes["/auth/register"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAuthRoutes(method, path, body, response);
-    };
-    routes["/auth/login"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAuthRoutes(method, path, body, response);
-    };
-    routes["/auth/logout"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAuthRoutes(method, path, body, response);
-    };
-    routes["/users"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleUserRoutes(method, path, body, response);
-    };
-    routes["/messages"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleMessageRoutes(method, path, body, response);
-    };
-    routes["/groups"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleGroupRoutes(method, path, body, response);
+    addRoute(HttpMethod::POST, "/auth/register", &Server::handleAuthRoutes);
+    addRoute(HttpMethod::POST, "/auth/login", &Server::handleAuthRoutes);
+    addRoute(HttpMethod::POST, "/auth/logout", &Server::handleAuthRoutes);
+    
+    // Resource collections and their members
+    const std::pair<const char*, RouteHandler> resources[] = {
+        {"/users", &Server::handleUserRoutes},
+        {"/messages", &Server::handleMessageRoutes},
+        {"/groups", &Server::handleGroupRoutes},
     };
+    for (const auto& [base, handler] : resources) {
+        std::string collection = base;
+        std::string member = collection + "/{id}";
+        addRoute(HttpMethod::GET, collection, handler);
+        addRoute(HttpMethod::POST, collection, handler);
+        addRoute(HttpMethod::GET, member, handler);
+        addRoute(HttpMethod::PUT, member, handler);
+        addRoute(HttpMethod::DELETE, member, handler);
+    }
     
     // Account integration routes
-    routes["/integration/accounts"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAccountIntegrationRoutes(method, path, body, response);
-    };
-    routes["/integration/connect/gmail"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAccountIntegrationRoutes(method, path, body, response);
-    };
-    routes["/integration/connect/whatsapp"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAccountIntegrationRoutes(method, path, body, response);
-    };
-    routes["/integration/messages"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAccountIntegrationRoutes(method, path, body, response);
-    };
-    routes["/integration/sync"] = [this](const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-        handleAccountIntegrationRoutes(method, path, body, response);
-    };
+    addRoute(HttpMethod::GET, "/integration/accounts", &Server::handleGetAccounts);
+    addRoute(HttpMethod::POST, "/integration/connect/gmail", &Server::handleConnectGmail);
+    addRoute(HttpMethod::POST, "/integration/connect/whatsapp", &Server::handleConnectWhatsApp);
+    addRoute(HttpMethod::GET, "/integration/messages", &Server::handleGetUnifiedMessages);
+    addRoute(HttpMethod::POST, "/integration/sync", &Server::handleSyncAccount);
+    
+    addRoute(HttpMethod::GET, "/status/connections", &Server::handleConnectionStats);
+    // Lists peers' addresses and user ids, and walks every connection to do it
+    addRoute(HttpMethod::GET, "/status/queues", &Server::handleQueueStats, true);
+}
+
+void Server::addRoute(HttpMethod method, const std::string& pattern, RouteHandler handler, bool localOnly) {
+    // Routes live in the WebSocket handler's router, which owns the HTTP side
+    // of every connection
+    wsHandler_->router().add(method, pattern, [this, handler, localOnly](const std::shared_ptr<WebSocketConnection>& conn,
+                                                                         const HttpRequest& request,
+                                                                         const RouteParams& params) {
+        // remote_address is "host:port"; loopback is 127.0.0.0/8
+        if (localOnly && conn->remote_address.compare(0, 4, "127.") != 0) {
+            wsHandler_->sendJsonResponse(conn, createErrorResponse("Forbidden"), "403 Forbidden");
+            return;
+        }
+        std::string response;
+        try {
+            (this->*handler)(request, params, response);
+        } catch (const std::exception& e) {
+            response = createErrorResponse("Internal server error: " + std::string(e.what()));
+        }
+        wsHandler_->sendJsonResponse(conn, std::move(response));
+    });
 }
 
 bool Server::initialize() {
@@ -77,6 +121,21 @@ bool Server::initialize() {
         std::cerr << "Failed to initialize database" << std::endl;
         return false;
     }
+    presence_->start();
+    messageWriter_->start();
+    
+    if (!setupTls()) {
+        std::cerr << "Failed to setup TLS" << std::endl;
+        return false;
+    }
+    
+    // Create the I/O loops before the socket so the listener can be registered
+    if (!setupLoops()) {
+        std::cerr << "Failed to setup event loops" << std::endl;
+        return false;
+    }
+    
+    checkDescriptorLimit();
     
     // Setup server socket
     if (!setupSocket()) {
@@ -84,95 +143,214 @@ bool Server::initialize() {
         return false;
     }
     
-    std::cout << "Server initialized successfully on port " << port_ << std::endl;
+    std::cout << "Server initialized successfully on port " << port_ 
+              << " with " << loops_.size() << " I/O loops" << std::endl;
     return true;
 }
 
 bool Server::setupSocket() {
-    serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket_ == -1) {
+    size_t listenerCount = config_.reusePort ? loops_.size() : 1;
+    
+    for (size_t i = 0; i < listenerCount; i++) {
+        int listenSocket = createListener();
+        if (listenSocket == -1) {
+            return false;
+        }
+        listenSockets_.push_back(listenSocket);
+        
+        // Each listener is only touched from its owning loop's thread
+        IoBackend* backend = backends_[i].get();
+        backend->loop()->post([this, backend, listenSocket, i]() {
+            backend->addListener(listenSocket, [this, i](int clientSocket, const std::string& remoteAddress) {
+                onAccept(clientSocket, remoteAddress, i);
+            });
+        });
+    }
+    
+    if (config_.reusePort) {
+        std::cout << "Using " << listenerCount << " SO_REUSEPORT listeners" << std::endl;
+    }
+    
+    return true;
+}
+
+void Server::checkDescriptorLimit() {
+    // Past RLIMIT_NOFILE accept() starts failing with EMFILE before the
+    // connection budget is reached, and then nobody gets a 503
+    const size_t reserve = 64;  // listeners, loop fds, database, logs
+    size_t wanted = config_.admission.maxConnections;
+    struct rlimit limit;
+    if (wanted == 0 || getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY ||
+        limit.rlim_cur >= wanted + reserve) {
+        return;
+    }
+    
+    if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max >= wanted + reserve) {
+        limit.rlim_cur = wanted + reserve;
+    } else {
+        limit.rlim_cur = limit.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur < wanted + reserve) {
+        std::cerr << "Warning: descriptor limit " << limit.rlim_cur << " is below the connection limit of "
+                  << wanted << std::endl;
+    }
+}
+
+int Server::createListener() {
+    int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenSocket == -1) {
         std::cerr << "Failed to create socket" << std::endl;
-        return false;
+        return -1;
     }
     
     // Set socket options
     int opt = 1;
-    if (setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         std::cerr << "Failed to set socket options" << std::endl;
-        close(serverSocket_);
-        return false;
+        close(listenSocket);
+        return -1;
     }
     
-    // Set non-blocking
-    int flags = fcntl(serverSocket_, F_GETFL, 0);
-    fcntl(serverSocket_, F_SETFL, flags | O_NONBLOCK);
+    // Every loop binds the same port; the kernel hashes new connections
+    // across the listeners so there is no shared accept queue or lock
+    if (config_.reusePort && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        std::cerr << "Failed to set SO_REUSEPORT: " << strerror(errno) << std::endl;
+        close(listenSocket);
+        return -1;
+    }
     
     // Bind socket
     struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
     serverAddr.sin_port = htons(port_);
     
-    if (bind(serverSocket_, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+    if (bind(listenSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
         std::cerr << "Failed to bind socket" << std::endl;
-        close(serverSocket_);
-        return false;
+        close(listenSocket);
+        return -1;
     }
     
     // Listen for connections
-    if (listen(serverSocket_, SOMAXCONN) < 0) {
+    if (listen(listenSocket, SOMAXCONN) < 0) {
         std::cerr << "Failed to listen on socket" << std::endl;
-        close(serverSocket_);
+        close(listenSocket);
+        return -1;
+    }
+    
+    return listenSocket;
+}
+
+bool Server::setupTls() {
+    if (config_.tlsCertFile.empty() && config_.tlsKeyFile.empty()) {
+        return true;
+    }
+    if (config_.tlsCertFile.empty() || config_.tlsKeyFile.empty()) {
+        std::cerr << "TLS needs both a certificate and a key" << std::endl;
         return false;
     }
     
+    tls_ = std::make_unique<TlsContext>();
+    if (!tls_->initialize(config_.tlsCertFile, config_.tlsKeyFile, config_.ktls)) {
+        return false;
+    }
+    std::cout << "TLS enabled" << (tls_->ktlsEnabled() ? " with kernel TLS" : "") << std::endl;
     return true;
 }
 
-void Server::run() {
-    running_ = true;
-    std::cout << "Server is running. Press Ctrl+C to stop." << std::endl;
+bool Server::setupLoops() {
+    int count = config_.ioThreads;
+    if (count <= 0) {
+        count = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (count <= 0) {
+        count = 1;
+    }
     
-    // Simple blocking accept loop instead of epoll for now
-    while (running_) {
-        struct sockaddr_in clientAddr;
-        socklen_t clientAddrLen = sizeof(clientAddr);
+    IoBackendType backendType = config_.ioBackend;
+    if (tls_ && !ioBackendSupportsTls(backendType)) {
+        std::cerr << ioBackendName(backendType) << " backend cannot terminate TLS, using epoll" << std::endl;
+        backendType = IoBackendType::EPOLL;
+    }
+    for (int i = 0; i < count; i++) {
+        auto loop = std::make_unique<EventLoop>();
+        if (!loop->initialize()) {
+            return false;
+        }
         
-        int clientSocket = accept(serverSocket_, (struct sockaddr*)&clientAddr, &clientAddrLen);
-        if (clientSocket == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // No connection available, continue
-                continue;
+        auto backend = IoBackend::create(backendType, loop.get(), wsHandler_->ioCallbacks());
+        if (!backend->initialize()) {
+            if (backendType == IoBackendType::EPOLL || i > 0) {
+                return false;
             }
-            if (errno == EINTR) {
-                // Interrupted by signal, continue
-                continue;
+            // Kernel too old or io_uring disabled by policy
+            std::cerr << "io_uring backend unavailable, falling back to epoll" << std::endl;
+            backendType = IoBackendType::EPOLL;
+            backend = IoBackend::create(backendType, loop.get(), wsHandler_->ioCallbacks());
+            if (!backend->initialize()) {
+                return false;
             }
-            std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
-            continue;
         }
         
-        // Get client address
-        char clientIP[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
-        std::string remoteAddress = std::string(clientIP) + ":" + std::to_string(ntohs(clientAddr.sin_port));
-        
-        std::cout << "New connection from " << remoteAddress << std::endl;
-        
-        try {
-            // Handle WebSocket upgrade or HTTP request in a separate thread
-            std::thread clientThread([this, clientSocket, remoteAddress]() {
-                wsHandler_->handleConnection(clientSocket, remoteAddress);
-            });
-            clientThread.detach(); // Let the thread run independently
-        } catch (const std::exception& e) {
-            std::cerr << "Exception handling connection: " << e.what() << std::endl;
-            close(clientSocket);
-        } catch (...) {
-            std::cerr << "Unknown exception handling connection" << std::endl;
-            close(clientSocket);
+        backend->setTls(tls_.get());
+        loops_.push_back(std::move(loop));
+        backends_.push_back(std::move(backend));
+    }
+    
+    std::cout << "Using " << ioBackendName(backendType) << " I/O backend, "
+              << unmaskImplementation() << " frame unmasking" << std::endl;
+    return true;
+}
+
+void Server::onAccept(int clientSocket, const std::string& remoteAddress, size_t loopIndex) {
+    // A sharded listener keeps its connections; the shared one spreads
+    // them over the I/O loops round-robin
+    IoBackend* backend = backends_[loopIndex].get();
+    if (!config_.reusePort) {
+        backend = backends_[nextLoop_].get();
+        nextLoop_ = (nextLoop_ + 1) % backends_.size();
+    }
+    
+    try {
+        wsHandler_->handleConnection(clientSocket, remoteAddress, backend);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception handling connection: " << e.what() << std::endl;
+        close(clientSocket);
+    } catch (...) {
+        std::cerr << "Unknown exception handling connection" << std::endl;
+        close(clientSocket);
+    }
+}
+
+void Server::run() {
+    running_ = true;
+    std::cout << "Server is running. Press Ctrl+C to stop." << std::endl;
+    
+    for (size_t i = 1; i < loops_.size(); i++) {
+        EventLoop* loop = loops_[i].get();
+        ioThreads_.emplace_back([this, loop, i]() {
+            pinCurrentThread(i);
+            loop->run();
+        });
+    }
+    
+    // The first loop runs on the caller's thread until stop()
+    pinCurrentThread(0);
+    loops_[0]->run();
+    
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
+    for (auto& thread : ioThreads_) {
+        if (thread.joinable()) {
+            thread.join();
         }
     }
+    ioThreads_.clear();
     
     cleanup();
 }
@@ -180,13 +358,37 @@ void Server::run() {
 void Server::stop() {
     running_ = false;
     std::cout << "Stopping server..." << std::endl;
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
+}
+
+void Server::pinCurrentThread(size_t loopIndex) {
+    if (!config_.pinThreads) {
+        return;
+    }
+    
+    unsigned int cpuCount = std::thread::hardware_concurrency();
+    if (cpuCount == 0) {
+        return;
+    }
+    
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(loopIndex % cpuCount, &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc != 0) {
+        std::cerr << "Failed to pin I/O loop " << loopIndex << ": " << strerror(rc) << std::endl;
+    }
 }
 
 void Server::cleanup() {
-    if (serverSocket_ != -1) {
-        close(serverSocket_);
-        serverSocket_ = -1;
+    for (int listenSocket : listenSockets_) {
+        close(listenSocket);
     }
+    listenSockets_.clear();
+    messageWriter_->stop();
+    presence_->stop();
 }
 
 // JSON helper methods
@@ -204,28 +406,11 @@ std::string Server::createErrorResponse(const std::string& error) {
     return createJSONResponse(false, error);
 }
 
-// CORS headers
-void Server::addCORSHeaders(std::string& response) {
-    std::string corsHeaders = "Access-Control-Allow-Origin: *\r\n";
-    corsHeaders += "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n";
-    corsHeaders += "Access-Control-Allow-Headers: Content-Type, Authorization\r\n";
-    corsHeaders += "Access-Control-Max-Age: 86400\r\n";
-    
-    // Insert CORS headers after the status line
-    size_t pos = response.find("\r\n");
-    if (pos != std::string::npos) {
-        response.insert(pos + 2, corsHeaders);
-    }
-}
-
 // Authentication token handling
-std::string Server::getAuthToken(const std::map<std::string, std::string>& headers) {
-    auto it = headers.find("authorization");
-    if (it != headers.end()) {
-        std::string authHeader = it->second;
-        if (authHeader.substr(0, 7) == "Bearer ") {
-            return authHeader.substr(7);
-        }
+std::string Server::getAuthToken(const HttpRequest& request) {
+    std::string_view authHeader = request.header("Authorization");
+    if (authHeader.substr(0, 7) == "Bearer ") {
+        return std::string(authHeader.substr(7));
     }
     return "";
 }
@@ -240,162 +425,272 @@ bool Server::validateToken(const std::string& token, std::string& userId) {
     return false;
 }
 
-void Server::handleAccountIntegrationRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response) {
-    try {
-        // Parse headers from the request (this would need to be passed from the calling method)
-        std::map<std::string, std::string> headers;
-        // TODO: Extract headers from the actual request
-        
-        if (method == "GET" && path == "/integration/accounts") {
-            // Get user's connected accounts
-            std::string userId = getAuthToken(headers);
-            if (userId.empty()) {
-                response = createErrorResponse("Unauthorized");
-                return;
-            }
-            
-            auto accounts = accountManager.getUserAccounts(userId);
-            json accountsArray = json::array();
-            
-            for (const auto& account : accounts) {
-                json accountJson;
-                accountJson["id"] = account.id;
-                accountJson["type"] = (account.type == AccountType::EMAIL) ? "email" : "messenger";
-                accountJson["provider"] = [&account]() {
-                    switch (account.provider) {
-                        case ProviderType::GMAIL: return "Gmail";
-                        case ProviderType::OUTLOOK: return "Outlook";
-                        case ProviderType::YAHOO_MAIL: return "Yahoo Mail";
-                        case ProviderType::PROTONMAIL: return "ProtonMail";
-                        case ProviderType::WHATSAPP: return "WhatsApp";
-                        case ProviderType::TELEGRAM: return "Telegram";
-                        case ProviderType::FACEBOOK_MESSENGER: return "Facebook Messenger";
-                        case ProviderType::TWITTER_DM: return "Twitter DM";
-                        case ProviderType::INSTAGRAM_DM: return "Instagram DM";
-                        default: return "Unknown";
-                    }
-                }();
-                accountJson["email"] = account.email;
-                accountJson["username"] = account.username;
-                accountJson["isActive"] = account.isActive;
-                accountJson["lastSync"] = std::chrono::duration_cast<std::chrono::seconds>(
-                    account.lastSync.time_since_epoch()).count();
-                
-                accountsArray.push_back(accountJson);
-            }
-            
-            response = createJSONResponse(true, "Accounts retrieved successfully", accountsArray.dump());
-        }
-        else if (method == "POST" && path == "/integration/connect/gmail") {
-            // Connect Gmail account
-            std::string userId = getAuthToken(headers);
-            if (userId.empty()) {
-                response = createErrorResponse("Unauthorized");
-                return;
-            }
-            
-            json requestJson = json::parse(body);
-            std::string email = requestJson["email"];
-            std::string password = requestJson["password"];
-            
-            bool success = accountManager.connectGmail(userId, email, password);
-            
-            if (success) {
-                response = createJSONResponse(true, "Gmail account connected successfully");
-            } else {
-                response = createErrorResponse("Failed to connect Gmail account");
-            }
-        }
-        else if (method == "POST" && path == "/integration/connect/whatsapp") {
-            // Connect WhatsApp account
-            std::string userId = getAuthToken(headers);
-            if (userId.empty()) {
-                response = createErrorResponse("Unauthorized");
-                return;
-            }
-            
-            json requestJson = json::parse(body);
-            std::string phoneNumber = requestJson["phoneNumber"];
-            std::string password = requestJson["password"];
-            
-            bool success = accountManager.connectWhatsApp(userId, phoneNumber, password);
-            
-            if (success) {
-                response = createJSONResponse(true, "WhatsApp account connected successfully");
-            } else {
-                response = createErrorResponse("Failed to connect WhatsApp account");
-            }
-        }
-        else if (method == "GET" && path == "/integration/messages") {
-            // Get unified messages
-            std::string userId = getAuthToken(headers);
-            if (userId.empty()) {
-                response = createErrorResponse("Unauthorized");
-                return;
-            }
-            
-            auto messages = accountManager.fetchNewMessages(userId);
-            json messagesArray = json::array();
-            
-            for (const auto& message : messages) {
-                json messageJson;
-                messageJson["id"] = message.id;
-                messageJson["accountId"] = message.accountId;
-                messageJson["sender"] = message.sender;
-                messageJson["recipient"] = message.recipient;
-                messageJson["subject"] = message.subject;
-                messageJson["content"] = message.content;
-                messageJson["messageType"] = message.messageType;
-                messageJson["timestamp"] = std::chrono::duration_cast<std::chrono::seconds>(
-                    message.timestamp.time_since_epoch()).count();
-                messageJson["isRead"] = message.isRead;
-                messageJson["isImportant"] = message.isImportant;
-                messageJson["attachments"] = message.attachments;
-                
-                messagesArray.push_back(messageJson);
-            }
-            
-            response = createJSONResponse(true, "Messages retrieved successfully", messagesArray.dump());
-        }
-        else if (method == "POST" && path == "/integration/sync") {
-            // Manual sync trigger
-            std::string userId = getAuthToken(headers);
-            if (userId.empty()) {
-                response = createErrorResponse("Unauthorized");
-                return;
-            }
-            
-            json requestJson = json::parse(body);
-            std::string accountId = requestJson["accountId"];
-            
-            bool success = accountManager.syncAccount(userId, accountId);
-            
-            if (success) {
-                response = createJSONResponse(true, "Account synced successfully");
-            } else {
-                response = createErrorResponse("Failed to sync account");
+void Server::handleGetAccounts(const HttpRequest& request, const RouteParams& /*params*/, std::string& response) {
+    // Get user's connected accounts
+    std::string userId = getAuthToken(request);
+    if (userId.empty()) {
+        response = createErrorResponse("Unauthorized");
+        return;
+    }
+    
+    auto accounts = accountManager.getUserAccounts(userId);
+    json accountsArray = json::array();
+    
+    for (const auto& account : accounts) {
+        json accountJson;
+        accountJson["id"] = account.id;
+        accountJson["type"] = (account.type == AccountType::EMAIL) ? "email" : "messenger";
+        accountJson["provider"] = [&account]() {
+            switch (account.provider) {
+                case ProviderType::GMAIL: return "Gmail";
+                case ProviderType::OUTLOOK: return "Outlook";
+                case ProviderType::YAHOO_MAIL: return "Yahoo Mail";
+                case ProviderType::PROTONMAIL: return "ProtonMail";
+                case ProviderType::WHATSAPP: return "WhatsApp";
+                case ProviderType::TELEGRAM: return "Telegram";
+                case ProviderType::FACEBOOK_MESSENGER: return "Facebook Messenger";
+                case ProviderType::TWITTER_DM: return "Twitter DM";
+                case ProviderType::INSTAGRAM_DM: return "Instagram DM";
+                default: return "Unknown";
             }
+        }();
+        accountJson["email"] = account.email;
+        accountJson["username"] = account.username;
+        accountJson["isActive"] = account.isActive;
+        accountJson["lastSync"] = std::chrono::duration_cast<std::chrono::seconds>(
+            account.lastSync.time_since_epoch()).count();
+        
+        accountsArray.push_back(accountJson);
+    }
+    
+    response = createJSONResponse(true, "Accounts retrieved successfully", accountsArray.dump());
+}
+
+void Server::handleConnectGmail(const HttpRequest& request, const RouteParams& /*params*/, std::string& response) {
+    // Connect Gmail account
+    std::string userId = getAuthToken(request);
+    if (userId.empty()) {
+        response = createErrorResponse("Unauthorized");
+        return;
+    }
+    
+    json requestJson = json::parse(request.body);
+    std::string email = requestJson["email"];
+    std::string password = requestJson["password"];
+    
+    bool success = accountManager.connectGmail(userId, email, password);
+    
+    if (success) {
+        response = createJSONResponse(true, "Gmail account connected successfully");
+    } else {
+        response = createErrorResponse("Failed to connect Gmail account");
+    }
+}
+
+void Server::handleConnectWhatsApp(const HttpRequest& request, const RouteParams& /*params*/, std::string& response) {
+    // Connect WhatsApp account
+    std::string userId = getAuthToken(request);
+    if (userId.empty()) {
+        response = createErrorResponse("Unauthorized");
+        return;
+    }
+    
+    json requestJson = json::parse(request.body);
+    std::string phoneNumber = requestJson["phoneNumber"];
+    std::string password = requestJson["password"];
+    
+    bool success = accountManager.connectWhatsApp(userId, phoneNumber, password);
+    
+    if (success) {
+        response = createJSONResponse(true, "WhatsApp account connected successfully");
+    } else {
+        response = createErrorResponse("Failed to connect WhatsApp account");
+    }
+}
+
+void Server::handleGetUnifiedMessages(const HttpRequest& request, const RouteParams& /*params*/, std::string& response) {
+    // Get unified messages
+    std::string userId = getAuthToken(request);
+    if (userId.empty()) {
+        response = createErrorResponse("Unauthorized");
+        return;
+    }
+    
+    auto messages = accountManager.fetchNewMessages(userId);
+    json messagesArray = json::array();
+    
+    for (const auto& message : messages) {
+        json messageJson;
+        messageJson["id"] = message.id;
+        messageJson["accountId"] = message.accountId;
+        messageJson["sender"] = message.sender;
+        messageJson["recipient"] = message.recipient;
+        messageJson["subject"] = message.subject;
+        messageJson["content"] = message.content;
+        messageJson["messageType"] = message.messageType;
+        messageJson["timestamp"] = std::chrono::duration_cast<std::chrono::seconds>(
+            message.timestamp.time_since_epoch()).count();
+        messageJson["isRead"] = message.isRead;
+        messageJson["isImportant"] = message.isImportant;
+        messageJson["attachments"] = message.attachments;
+        
+        messagesArray.push_back(messageJson);
+    }
+    
+    response = createJSONResponse(true, "Messages retrieved successfully", messagesArray.dump());
+}
+
+void Server::handleSyncAccount(const HttpRequest& request, const RouteParams& /*params*/, std::string& response) {
+    // Manual sync trigger
+    std::string userId = getAuthToken(request);
+    if (userId.empty()) {
+        response = createErrorResponse("Unauthorized");
+        return;
+    }
+    
+    json requestJson = json::parse(request.body);
+    std::string accountId = requestJson["accountId"];
+    
+    bool success = accountManager.syncAccount(userId, accountId);
+    
+    if (success) {
+        response = createJSONResponse(true, "Account synced successfully");
+    } else {
+        response = createErrorResponse("Failed to sync account");
+    }
+}
+
+void Server::handleConnectionStats(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
+    AdmissionControl::Stats stats = wsHandler_->admission().stats();
+    const AdmissionLimits& limits = wsHandler_->admission().limits();
+    
+    json data;
+    data["active"] = stats.active;
+    data["pendingHandshakes"] = stats.pending;
+    data["addresses"] = stats.trackedAddresses;
+    data["signedInUsers"] = wsHandler_->registry().userCount();
+    uint64_t sendCalls = 0;
+    for (const auto& backend : backends_) {
+        sendCalls += backend->sendCalls();
+    }
+    data["sendCalls"] = sendCalls;
+    PubSubHub::Stats pubsub = pubsub_->stats();
+    data["pubsub"] = {
+        {"topics", pubsub.topics},
+        {"subscriptions", pubsub.subscriptions},
+        {"published", pubsub.published},
+        {"delivered", pubsub.delivered}
+    };
+    SessionJournal::Stats journal = wsHandler_->journal().stats();
+    data["journal"] = {
+        {"users", journal.users},
+        {"parked", journal.parked},
+        {"events", journal.events}
+    };
+    WebSocketHandler::SignalStats signals = wsHandler_->signalStats();
+    data["signals"] = {
+        {"received", signals.received},
+        {"published", signals.published},
+        {"coalesced", signals.coalesced},
+        {"dropped", signals.dropped}
+    };
+    PresenceService::Stats presence = presence_->stats();
+    data["presence"] = {
+        {"online", presence.online},
+        {"pending", presence.pending},
+        {"published", presence.published},
+        {"persisted", presence.persisted},
+        {"batches", presence.batches}
+    };
+    Database::Stats database = database_->stats();
+    data["database"] = {
+        {"readers", database.readers},
+        {"reads", database.reads},
+        {"readWaits", database.readWaits}
+    };
+    MessageWriter::Stats writer = messageWriter_->stats();
+    data["messageWriter"] = {
+        {"queued", writer.queued},
+        {"saved", writer.saved},
+        {"failed", writer.failed},
+        {"batches", writer.batches}
+    };
+    data["admitted"] = stats.admitted;
+    data["rejected"] = {
+        {"connectionLimit", stats.rejectedConnections},
+        {"perAddressLimit", stats.rejectedPerIp},
+        {"pendingHandshakeLimit", stats.rejectedPending}
+    };
+    data["limits"] = {
+        {"maxConnections", limits.maxConnections},
+        {"maxConnectionsPerIp", limits.maxConnectionsPerIp},
+        {"maxPendingHandshakes", limits.maxPendingHandshakes}
+    };
+    if (tls_) {
+        TlsContext::Stats tlsStats = tls_->stats();
+        data["tls"] = {
+            {"handshakes", tlsStats.handshakes},
+            {"resumed", tlsStats.resumed},
+            {"kernelSend", tlsStats.kernelSend}
+        };
+    }
+    response = createJSONResponse(true, "Connection statistics", data.dump());
+}
+
+void Server::handleQueueStats(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
+    std::vector<WebSocketHandler::QueueInfo> queues = wsHandler_->queueStats();
+    const OutboundLimits& limits = wsHandler_->outboundLimits();
+    
+    // Deepest first; the long tail of idle connections is only counted
+    std::sort(queues.begin(), queues.end(), [](const auto& a, const auto& b) {
+        return a.stats.queued > b.stats.queued;
+    });
+    size_t queued = 0;
+    uint64_t dropped = 0;
+    uint64_t coalesced = 0;
+    json connections = json::array();
+    for (const auto& queue : queues) {
+        queued += queue.stats.queued;
+        dropped += queue.stats.dropped;
+        coalesced += queue.stats.coalesced;
+        if (connections.size() < MAX_LISTED_QUEUES) {
+            connections.push_back({
+                {"address", queue.address},
+                {"userId", queue.userId},
+                {"queued", queue.stats.queued},
+                {"peak", queue.stats.peak},
+                {"dropped", queue.stats.dropped},
+                {"coalesced", queue.stats.coalesced}
+            });
         }
-        else {
-            response = createErrorResponse("Method not allowed");
-        }
-    } catch (const std::exception& e) {
-        response = createErrorResponse("Internal server error: " + std::string(e.what()));
     }
+    
+    json data;
+    data["connections"] = queues.size();
+    data["queued"] = queued;
+    data["dropped"] = dropped;
+    data["coalesced"] = coalesced;
+    data["limits"] = {
+        {"highWatermark", limits.highWatermark},
+        {"lowWatermark", limits.lowWatermark},
+        {"policy", overflowPolicyName(limits.policy)}
+    };
+    data["deepest"] = connections;
+    response = createJSONResponse(true, "Send queue statistics", data.dump());
 }
 
-void Server::handleAuthRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response) {
+void Server::handleAuthRoutes(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
     response = createErrorResponse("Not implemented");
 }
 
-void Server::handleUserRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response) {
+void Server::handleUserRoutes(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
     response = createErrorResponse("Not implemented");
 }
 
-void Server::handleMessageRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response) {
+void Server::handleMessageRoutes(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
     response = createErrorResponse("Not implemented");
 }
 
-void Server::handleGroupRoutes(const std::string& method, const std::string& path, const std::string& body, std::string& response) {
+void Server::handleGroupRoutes(const HttpRequest& /*request*/, const RouteParams& /*params*/, std::string& response) {
     response = createErrorResponse("Not implemented");
 } 
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "session_journal.h"
+#include <algorithm>
+
+namespace {
+
+uint64_t microsNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+SessionJournal::SessionJournal() : parkedUsers_(0), lastSweep_(0) {
+}
+
+SessionJournal::Shard& SessionJournal::shardOf(int userId) {
+    uint32_t hash = static_cast<uint32_t>(userId) * 2654435761u;
+    return shards_[(hash >> 16) & (SHARDS - 1)];
+}
+
+SessionJournal::UserJournal& SessionJournal::journalFor(Shard& shard, int userId) {
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end()) {
+        it = shard.users.emplace(userId, UserJournal()).first;
+        it->second.lastSeq = microsNow();
+    }
+    return it->second;
+}
+
+void SessionJournal::attach(int userId, uint64_t afterSeq, const AttachCallback& callback) {
+    Shard& shard = shardOf(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    UserJournal& journal = journalFor(shard, userId);
+    if (journal.devices++ == 0) {
+        unpark(userId, journal);
+    }
+
+    std::vector<Envelope> missed;
+    bool resumed = false;
+    if (afterSeq) {
+        // The ring holds everything after firstSeq - 1
+        uint64_t firstSeq = journal.events.empty() ? journal.lastSeq + 1 : journal.events.front().envelope.seq;
+        resumed = afterSeq + 1 >= firstSeq && afterSeq <= journal.lastSeq;
+        if (resumed) {
+            for (const Event& event : journal.events) {
+                if (event.envelope.seq > afterSeq) {
+                    missed.push_back(event.envelope);
+                }
+            }
+        }
+    }
+    callback(journal.lastSeq, resumed, missed);
+}
+
+void SessionJournal::detach(int userId, std::vector<uint64_t> topics) {
+    {
+        Shard& shard = shardOf(userId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.users.find(userId);
+        if (it == shard.users.end() || it->second.devices == 0) {
+            return;
+        }
+        UserJournal& journal = it->second;
+        if (--journal.devices == 0) {
+            journal.parkedTopics = std::move(topics);
+            journal.parkedUntil = Clock::now() + RESUME_WINDOW;
+            std::lock_guard<std::mutex> parkedLock(parkedMutex_);
+            for (uint64_t topic : journal.parkedTopics) {
+                parked_[topic].push_back(userId);
+            }
+            parkedUsers_++;
+        }
+    }
+    sweep();
+}
+
+void SessionJournal::unpark(int userId, UserJournal& journal) {
+    if (journal.parkedUntil == Clock::time_point()) {
+        return;
+    }
+    std::lock_guard<std::mutex> parkedLock(parkedMutex_);
+    for (uint64_t topic : journal.parkedTopics) {
+        auto it = parked_.find(topic);
+        if (it == parked_.end()) {
+            continue;
+        }
+        std::vector<int>& users = it->second;
+        users.erase(std::remove(users.begin(), users.end(), userId), users.end());
+        if (users.empty()) {
+            parked_.erase(it);
+        }
+    }
+    journal.parkedTopics.clear();
+    journal.parkedUntil = Clock::time_point();
+    parkedUsers_--;
+}
+
+void SessionJournal::record(int userId, const Envelope& envelope, const RecordCallback& callback) {
+    Shard& shard = shardOf(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    UserJournal& journal = journalFor(shard, userId);
+
+    Event event;
+    event.text = std::make_shared<const std::string>(envelope.body);
+    event.envelope = envelope;
+    event.envelope.seq = ++journal.lastSeq;
+    event.envelope.body = *event.text;
+    journal.bytes += event.text->size();
+    journal.events.push_back(std::move(event));
+    while (journal.events.size() > MAX_EVENTS || (journal.bytes > MAX_BYTES && journal.events.size() > 1)) {
+        journal.bytes -= journal.events.front().text->size();
+        journal.events.pop_front();
+    }
+    callback(journal.events.back().envelope);
+}
+
+void SessionJournal::parkedOn(uint64_t topic, std::vector<int>& users) {
+    if (parkedUsers_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(parkedMutex_);
+    auto it = parked_.find(topic);
+    if (it != parked_.end()) {
+        users.insert(users.end(), it->second.begin(), it->second.end());
+    }
+}
+
+void SessionJournal::sweep() {
+    Clock::time_point now = Clock::now();
+    int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    int64_t last = lastSweep_;
+    if (nowMs - last < 1000 || !lastSweep_.compare_exchange_strong(last, nowMs)) {
+        return;
+    }
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.users.begin(); it != shard.users.end();) {
+            UserJournal& journal = it->second;
+            if (journal.devices == 0 && journal.parkedUntil <= now) {
+                unpark(it->first, journal);
+                it = shard.users.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+SessionJournal::Stats SessionJournal::stats() {
+    Stats stats{0, parkedUsers_.load(), 0};
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.users += shard.users.size();
+        for (const auto& [userId, journal] : shard.users) {
+            stats.events += journal.events.size();
+        }
+    }
+    return stats;
+}
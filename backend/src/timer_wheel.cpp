@@ -0,0 +1,209 @@
+#include "timer_wheel.h"
+
+namespace {
+
+uint64_t rotateRight(uint64_t value, unsigned shift) {
+    return shift ? (value >> shift) | (value << (64 - shift)) : value;
+}
+
+} // namespace
+
+TimerWheel::TimerWheel(Clock::duration tick)
+    : start_(Clock::now()), tick_(tick), currentTick_(0), cascadedTick_(UINT64_MAX), count_(0) {
+    for (unsigned level = 0; level < LEVELS; level++) {
+        for (unsigned slot = 0; slot < SLOTS; slot++) {
+            heads_[level][slot] = NIL;
+        }
+        occupied_[level] = 0;
+    }
+}
+
+uint64_t TimerWheel::tickAt(Clock::time_point time) const {
+    if (time <= start_) {
+        return 0;
+    }
+    return static_cast<uint64_t>((time - start_) / tick_);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(Clock::time_point now, Clock::duration delay, Task task) {
+    uint32_t index;
+    if (!freeNodes_.empty()) {
+        index = freeNodes_.back();
+        freeNodes_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    }
+
+    // Rounded up and one tick past the current one, so a timer never fires
+    // early; it can fire up to one tick late
+    uint64_t delayTicks = delay > Clock::duration::zero()
+        ? static_cast<uint64_t>((delay + tick_ - Clock::duration(1)) / tick_) : 0;
+
+    Node& node = nodes_[index];
+    node.task = std::move(task);
+    node.expires = tickAt(now) + 1 + delayTicks;
+    link(index);
+    count_++;
+
+    return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+void TimerWheel::cancel(TimerId id) {
+    uint32_t index = static_cast<uint32_t>(id);
+    uint32_t generation = static_cast<uint32_t>(id >> 32);
+    if (index >= nodes_.size() || nodes_[index].generation != generation || !nodes_[index].linked) {
+        return;
+    }
+    unlink(index);
+    release(index);
+}
+
+bool TimerWheel::popExpired(Clock::time_point now, Task& task) {
+    uint64_t nowTick = tickAt(now);
+
+    if (count_ == 0) {
+        // Nothing to cascade or run; jump straight to the present
+        if (currentTick_ <= nowTick) {
+            currentTick_ = nowTick + 1;
+        }
+        return false;
+    }
+
+    while (currentTick_ <= nowTick) {
+        if (cascadedTick_ != currentTick_) {
+            cascade(currentTick_);
+            cascadedTick_ = currentTick_;
+        }
+
+        // Every level-0 timer in this slot expires exactly at currentTick_
+        uint32_t head = heads_[0][currentTick_ & (SLOTS - 1)];
+        if (head != NIL) {
+            unlink(head);
+            task = std::move(nodes_[head].task);
+            release(head);
+            return true;
+        }
+
+        // Skip ticks with nothing to run or cascade, so catching up after a
+        // long stall does not walk every empty slot
+        uint64_t next = nextEventTick();
+        currentTick_ = next <= nowTick ? next : nowTick + 1;
+    }
+    return false;
+}
+
+TimerWheel::Clock::time_point TimerWheel::nextDeadline() const {
+    if (count_ == 0) {
+        return Clock::time_point::max();
+    }
+    return start_ + tick_ * static_cast<Clock::rep>(nextEventTick());
+}
+
+uint64_t TimerWheel::nextEventTick() const {
+    uint64_t best = UINT64_MAX;
+
+    // Level 0 holds the next SLOTS ticks, one tick per slot
+    uint64_t pending = rotateRight(occupied_[0], currentTick_ & (SLOTS - 1));
+    if (pending) {
+        best = currentTick_ + __builtin_ctzll(pending);
+    }
+
+    // Higher levels only need the loop to wake up for the cascade
+    for (unsigned level = 1; level < LEVELS; level++) {
+        if (!occupied_[level]) {
+            continue;
+        }
+        uint64_t unit = 1ull << (level * SLOT_BITS);
+        uint64_t boundary = (currentTick_ + unit - 1) & ~(unit - 1);
+        if (boundary == cascadedTick_) {
+            boundary += unit;
+        }
+        pending = rotateRight(occupied_[level], (boundary >> (level * SLOT_BITS)) & (SLOTS - 1));
+        if (pending) {
+            uint64_t candidate = boundary + __builtin_ctzll(pending) * unit;
+            if (candidate < best) {
+                best = candidate;
+            }
+        }
+    }
+    return best;
+}
+
+void TimerWheel::link(uint32_t index) {
+    Node& node = nodes_[index];
+    if (node.expires < currentTick_) {
+        node.expires = currentTick_;
+    }
+
+    uint64_t delta = node.expires - currentTick_;
+    unsigned level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS))) {
+        level++;
+    }
+    // Beyond the wheel's range the timer parks in the furthest top-level slot
+    // and is re-placed each time that slot cascades
+    uint64_t span = 1ull << (LEVELS * SLOT_BITS);
+    uint64_t placeAt = delta >= span ? currentTick_ + span - 1 : node.expires;
+
+    unsigned slot = (placeAt >> (level * SLOT_BITS)) & (SLOTS - 1);
+    node.level = static_cast<uint8_t>(level);
+    node.slot = static_cast<uint8_t>(slot);
+    node.prev = NIL;
+    node.next = heads_[level][slot];
+    if (node.next != NIL) {
+        nodes_[node.next].prev = index;
+    }
+    heads_[level][slot] = index;
+    occupied_[level] |= 1ull << slot;
+    node.linked = true;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = nodes_[index];
+    if (node.prev != NIL) {
+        nodes_[node.prev].next = node.next;
+    } else {
+        heads_[node.level][node.slot] = node.next;
+        if (node.next == NIL) {
+            occupied_[node.level] &= ~(1ull << node.slot);
+        }
+    }
+    if (node.next != NIL) {
+        nodes_[node.next].prev = node.prev;
+    }
+    node.prev = node.next = NIL;
+    node.linked = false;
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node& node = nodes_[index];
+    node.task = nullptr;
+    // Invalidates outstanding TimerIds for this node
+    if (++node.generation == 0) {
+        node.generation = 1;
+    }
+    freeNodes_.push_back(index);
+    count_--;
+}
+
+void TimerWheel::cascade(uint64_t tick) {
+    for (unsigned level = LEVELS - 1; level >= 1; level--) {
+        uint64_t unit = 1ull << (level * SLOT_BITS);
+        if (tick & (unit - 1)) {
+            continue;
+        }
+        unsigned slot = (tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+        uint32_t index = heads_[level][slot];
+        heads_[level][slot] = NIL;
+        occupied_[level] &= ~(1ull << slot);
+
+        // Re-placing relative to the current tick moves each timer down
+        while (index != NIL) {
+            uint32_t next = nodes_[index].next;
+            nodes_[index].linked = false;
+            link(index);
+            index = next;
+        }
+    }
+}
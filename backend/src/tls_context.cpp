@@ -0,0 +1,198 @@
+#include "tls_context.h"
+#include <iostream>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+
+namespace {
+
+const unsigned char SESSION_ID_CONTEXT[] = "cockpit";
+const long SESSION_LIFETIME_SECONDS = 2 * 60 * 60;
+
+std::string lastSslError() {
+    char message[256];
+    ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+    ERR_clear_error();
+    return message;
+}
+
+#ifndef OPENSSL_NO_KTLS
+// The kernel only knows the "tls" upper layer protocol once the module is
+// loaded; an unconnected socket is enough to find out
+bool kernelTlsAvailable() {
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+        return false;
+    }
+    bool available = setsockopt(probe, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 || errno != ENOENT;
+    close(probe);
+    return available;
+}
+#endif
+
+} // namespace
+
+TlsContext::TlsContext() : ctx_(nullptr), ktls_(false), kernelSendSessions_(0) {
+}
+
+TlsContext::~TlsContext() {
+    if (ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+}
+
+bool TlsContext::initialize(const std::string& certFile, const std::string& keyFile, bool enableKtls) {
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (!ctx_) {
+        std::cerr << "Failed to create TLS context: " << lastSslError() << std::endl;
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    // Renegotiation is a CPU sink for clients and unsupported by kTLS; a peer
+    // that drops the TCP connection without close_notify is just a disconnect
+    SSL_CTX_set_options(ctx_, SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    // Writes are retried from WebSocketConnection::outbound, which may have
+    // moved in the meantime. Idle connections give their record buffers back.
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx_, certFile.c_str()) != 1) {
+        std::cerr << "Failed to load TLS certificate " << certFile << ": " << lastSslError() << std::endl;
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx_, keyFile.c_str(), SSL_FILETYPE_PEM) != 1) {
+        std::cerr << "Failed to load TLS key " << keyFile << ": " << lastSslError() << std::endl;
+        return false;
+    }
+    if (SSL_CTX_check_private_key(ctx_) != 1) {
+        std::cerr << "TLS key does not match the certificate: " << lastSslError() << std::endl;
+        return false;
+    }
+
+    // Resumption: TLS 1.3 and ticket-capable 1.2 clients get a session ticket
+    // sealed with this context's keys, older 1.2 clients a session ID in the
+    // server cache. Either way a reconnect skips the certificate exchange and
+    // the key agreement.
+    SSL_CTX_set_session_id_context(ctx_, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_timeout(ctx_, SESSION_LIFETIME_SECONDS);
+    // Clients use a TLS 1.3 ticket once and get a fresh one on every resumption
+    SSL_CTX_set_num_tickets(ctx_, 1);
+
+    if (enableKtls) {
+#ifdef OPENSSL_NO_KTLS
+        std::cerr << "OpenSSL was built without kernel TLS support; encrypting in userspace" << std::endl;
+#else
+        if (kernelTlsAvailable()) {
+            SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+            ktls_ = true;
+        } else {
+            std::cerr << "Kernel TLS unavailable (is the tls module loaded?); encrypting in userspace" << std::endl;
+        }
+#endif
+    }
+
+    return true;
+}
+
+std::unique_ptr<TlsSession> TlsContext::createSession(int socket) {
+    SSL* ssl = SSL_new(ctx_);
+    if (!ssl) {
+        std::cerr << "Failed to create TLS session: " << lastSslError() << std::endl;
+        return nullptr;
+    }
+    // A socket BIO, so OpenSSL can hand the socket to kTLS after the handshake
+    if (SSL_set_fd(ssl, socket) != 1) {
+        std::cerr << "Failed to attach TLS session: " << lastSslError() << std::endl;
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return std::make_unique<TlsSession>(this, ssl);
+}
+
+TlsContext::Stats TlsContext::stats() const {
+    Stats result;
+    if (ctx_) {
+        result.handshakes = SSL_CTX_sess_accept_good(ctx_);
+        result.resumed = SSL_CTX_sess_hits(ctx_);
+    }
+    result.kernelSend = kernelSendSessions_.load(std::memory_order_relaxed);
+    return result;
+}
+
+TlsSession::TlsSession(TlsContext* context, SSL* ssl)
+    : readWantsWrite(false), context_(context), ssl_(ssl), handshakeCounted_(false), kernelSend_(false) {
+}
+
+TlsSession::~TlsSession() {
+    SSL_free(ssl_);
+}
+
+TlsSession::Status TlsSession::status(int result) {
+    int error = SSL_get_error(ssl_, result);
+    // Leftovers in the thread's error queue would be blamed on the next
+    // connection this loop serves
+    ERR_clear_error();
+    switch (error) {
+        case SSL_ERROR_WANT_READ:
+            return Status::WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return Status::WANT_WRITE;
+        case SSL_ERROR_ZERO_RETURN:
+            return Status::CLOSED;
+        default:
+            return Status::ERROR;
+    }
+}
+
+void TlsSession::onHandshakeDone() {
+    handshakeCounted_ = true;
+#ifndef OPENSSL_NO_KTLS
+    kernelSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    if (kernelSend_) {
+        context_->kernelSendSessions_.fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+}
+
+TlsSession::Status TlsSession::read(char* buffer, size_t size, size_t& bytesRead) {
+    ERR_clear_error();
+    int result = SSL_read(ssl_, buffer, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+    if (!handshakeCounted_ && SSL_is_init_finished(ssl_)) {
+        onHandshakeDone();
+    }
+    if (result > 0) {
+        bytesRead = static_cast<size_t>(result);
+        return Status::OK;
+    }
+    return status(result);
+}
+
+TlsSession::Status TlsSession::write(const char* data, size_t size, size_t& written) {
+    written = 0;
+    if (size == 0) {
+        return Status::OK;
+    }
+    ERR_clear_error();
+    int result = SSL_write(ssl_, data, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+    if (result > 0) {
+        written = static_cast<size_t>(result);
+        return Status::OK;
+    }
+    return status(result);
+}
+
+void TlsSession::shutdown() {
+    if (SSL_is_init_finished(ssl_)) {
+        ERR_clear_error();
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+}
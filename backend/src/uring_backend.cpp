@@ -0,0 +1,721 @@
+#include "uring_backend.h"
+#include "event_loop.h"
+#include "websocket_handler.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int ringFd, unsigned opcode, void* arg, unsigned nrArgs) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs));
+}
+
+// user_data layout: socket fd in the high bits, operation in the low byte.
+// A socket stays open until all of its operations completed, so the fd
+// cannot be reused while a completion for it is still outstanding.
+uint64_t makeUserData(int fd, uint8_t op) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(fd)) << 8) | op;
+}
+
+template <typename T>
+T loadAcquire(const T* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void storeRelease(T* ptr, T value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+}
+
+UringBackend::UringBackend(EventLoop* loop, IoCallbacks callbacks)
+    : IoBackend(loop, std::move(callbacks)), ringFd_(-1), eventFd_(-1),
+      sqRing_(nullptr), sqRingSize_(0), sqes_(nullptr), sqesSize_(0),
+      sqHead_(nullptr), sqTail_(nullptr), sqFlags_(nullptr), sqArray_(nullptr),
+      sqMask_(0), sqEntries_(0), sqLocalTail_(0), pendingSubmit_(0),
+      cqRing_(nullptr), cqRingSize_(0), cqHead_(nullptr), cqTail_(nullptr), cqMask_(0), cqes_(nullptr),
+      bufRing_(nullptr), bufRingSize_(0), bufPool_(nullptr), bufTail_(0) {
+}
+
+UringBackend::~UringBackend() {
+    if (bufRing_) {
+        munmap(bufRing_, bufRingSize_);
+    }
+    delete[] bufPool_;
+    if (sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (eventFd_ != -1) {
+        ::close(eventFd_);
+    }
+    if (ringFd_ != -1) {
+        ::close(ringFd_);
+    }
+}
+
+bool UringBackend::initialize() {
+    if (!setupRing() || !setupBuffers() || !probeMultishotRecv()) {
+        return false;
+    }
+
+    eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd_ == -1) {
+        std::cerr << "Failed to create io_uring eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ioUringRegister(ringFd_, IORING_REGISTER_EVENTFD, &eventFd_, 1) < 0) {
+        std::cerr << "Failed to register io_uring eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Completions wake the loop through the eventfd; queued SQEs go out in
+    // one batch right before the loop blocks again.
+    loop_->post([this]() {
+        loop_->add(eventFd_, EPOLLIN, [this](uint32_t) {
+            uint64_t value;
+            while (::read(eventFd_, &value, sizeof(value)) > 0) {
+            }
+            reapCompletions();
+        });
+    });
+    loop_->setPreWaitHook([this]() {
+        // Sends start here rather than at the first write, so everything
+        // written during this iteration goes in the connection's one SENDMSG
+        if (!pendingSend_.empty()) {
+            std::vector<int> fds;
+            fds.swap(pendingSend_);
+            for (int fd : fds) {
+                startSend(fd);
+            }
+        }
+        if (!pendingRecv_.empty()) {
+            std::vector<int> fds;
+            fds.swap(pendingRecv_);
+            for (int fd : fds) {
+                armRecv(fd);
+            }
+        }
+        submit();
+    });
+
+    return true;
+}
+
+bool UringBackend::setupRing() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+
+    ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+    if (ringFd_ < 0) {
+        std::cerr << "io_uring_setup failed: " << strerror(errno) << std::endl;
+        ringFd_ = -1;
+        return false;
+    }
+
+    // Multishot accept and buffer rings need 5.19+; multishot recv needs 6.0
+    // and is probed once the buffers are registered
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_FAST_POLL)) {
+        std::cerr << "io_uring is missing required features" << std::endl;
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        std::cerr << "Failed to map io_uring SQ ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            std::cerr << "Failed to map io_uring CQ ring: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        std::cerr << "Failed to map io_uring SQEs: " << strerror(errno) << std::endl;
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqFlags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sqLocalTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+bool UringBackend::setupBuffers() {
+    bufRingSize_ = BUFFER_COUNT * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        std::cerr << "Failed to allocate io_uring buffer ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+    bufRing_ = static_cast<io_uring_buf*>(ring);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (ioUringRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        std::cerr << "Failed to register io_uring buffer ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Buffers are only consumed by sockets that actually have data pending,
+    // so idle connections cost no receive memory at all
+    bufPool_ = new char[static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE];
+    bufTail_ = 0;
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) {
+        recycleBuffer(static_cast<uint16_t>(i));
+    }
+    return true;
+}
+
+bool UringBackend::probeMultishotRecv() {
+    // 5.19 sets up the ring and buffers but fails every multishot recv with
+    // EINVAL, so try one on a socketpair whose peer already shut down: a
+    // kernel that supports it completes the recv with EOF straight away
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        std::cerr << "Failed to create io_uring probe socketpair: " << strerror(errno) << std::endl;
+        return false;
+    }
+    ::shutdown(pair[1], SHUT_WR);
+
+    int32_t res = -EINVAL;
+    io_uring_sqe* sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = pair[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = makeUserData(pair[0], OP_RECV);
+        if (ioUringEnter(ringFd_, pendingSubmit_, 1, IORING_ENTER_GETEVENTS) >= 0) {
+            pendingSubmit_ = 0;
+            unsigned head = *cqHead_;
+            if (head != loadAcquire(cqTail_)) {
+                const io_uring_cqe& cqe = cqes_[head & cqMask_];
+                res = cqe.res;
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    recycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                storeRelease(cqHead_, head + 1);
+            }
+        }
+    }
+    ::close(pair[0]);
+    ::close(pair[1]);
+
+    if (res < 0) {
+        std::cerr << "io_uring multishot recv is unsupported: " << strerror(-res) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void UringBackend::recycleBuffer(uint16_t bufferId) {
+    io_uring_buf* buf = &bufRing_[bufTail_ & (BUFFER_COUNT - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(bufPool_ + static_cast<size_t>(bufferId) * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bufferId;
+    bufTail_++;
+    // The ring tail overlays bufs[0].resv
+    storeRelease(&bufRing_[0].resv, bufTail_);
+}
+
+io_uring_sqe* UringBackend::getSqe() {
+    if (sqLocalTail_ - loadAcquire(sqHead_) >= sqEntries_) {
+        // Ring full within one batch: push what we have to the kernel now
+        submit();
+        if (sqLocalTail_ - loadAcquire(sqHead_) >= sqEntries_) {
+            return nullptr;
+        }
+    }
+
+    unsigned index = sqLocalTail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    sqLocalTail_++;
+    storeRelease(sqTail_, sqLocalTail_);
+    pendingSubmit_++;
+    return sqe;
+}
+
+void UringBackend::submit() {
+    bool overflow = loadAcquire(sqFlags_) & IORING_SQ_CQ_OVERFLOW;
+    if (pendingSubmit_ == 0 && !overflow) {
+        return;
+    }
+
+    // GETEVENTS with min_complete 0 also flushes an overflowed CQ backlog
+    unsigned flags = overflow ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = ioUringEnter(ringFd_, pendingSubmit_, 0, flags);
+    if (submitted < 0) {
+        if (errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+            std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+    pendingSubmit_ -= std::min<unsigned>(pendingSubmit_, static_cast<unsigned>(submitted));
+
+    if (overflow) {
+        reapCompletions();
+    }
+}
+
+void UringBackend::reapCompletions() {
+    unsigned head = *cqHead_;
+    while (true) {
+        unsigned tail = loadAcquire(cqTail_);
+        if (head == tail) {
+            break;
+        }
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes_[head & cqMask_];
+            uint64_t userData = cqe.user_data;
+            int32_t res = cqe.res;
+            uint32_t flags = cqe.flags;
+            head++;
+            // Release the slot before handling so callbacks can't overflow the CQ
+            storeRelease(cqHead_, head);
+            handleCompletion(userData, res, flags);
+        }
+    }
+}
+
+void UringBackend::handleCompletion(uint64_t userData, int32_t res, uint32_t flags) {
+    int fd = static_cast<int>(userData >> 8);
+    switch (static_cast<OpType>(userData & 0xFF)) {
+        case OP_ACCEPT:
+            onAccept(fd, res, flags);
+            break;
+        case OP_RECV:
+            onRecv(fd, res, flags);
+            break;
+        case OP_SEND:
+            onSend(fd, res);
+            break;
+        case OP_CANCEL:
+            break;
+    }
+}
+
+bool UringBackend::addListener(int listenSocket, AcceptCallback onAccept) {
+    listeners_[listenSocket] = std::move(onAccept);
+    armAccept(listenSocket);
+    return true;
+}
+
+void UringBackend::armAccept(int listenSocket) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        std::cerr << "io_uring SQ full, cannot arm accept" << std::endl;
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = makeUserData(listenSocket, OP_ACCEPT);
+}
+
+void UringBackend::onAccept(int listenSocket, int32_t res, uint32_t flags) {
+    auto it = listeners_.find(listenSocket);
+    if (it == listeners_.end()) {
+        if (res >= 0) {
+            ::close(res);
+        }
+        return;
+    }
+
+    // The multishot request ends on errors (e.g. EMFILE); re-arm it unless
+    // the kernel rejected the request itself
+    if (!(flags & IORING_CQE_F_MORE) && res != -EINVAL) {
+        armAccept(listenSocket);
+    }
+
+    if (res < 0) {
+        if (res != -ECONNABORTED && res != -EINTR) {
+            std::cerr << "Failed to accept connection: " << strerror(-res) << std::endl;
+        }
+        return;
+    }
+
+    int clientSocket = res;
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(clientAddr);
+    std::string remoteAddress = "unknown";
+    if (getpeername(clientSocket, (struct sockaddr*)&clientAddr, &clientAddrLen) == 0) {
+        char clientIP[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
+        remoteAddress = std::string(clientIP) + ":" + std::to_string(ntohs(clientAddr.sin_port));
+    }
+
+    it->second(clientSocket, remoteAddress);
+}
+
+bool UringBackend::attach(const std::shared_ptr<WebSocketConnection>& conn) {
+    ConnectionOps& ops = connections_[conn->socket];
+    ops.conn = conn;
+    armRecv(conn->socket);
+    return true;
+}
+
+void UringBackend::armRecv(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end() || it->second.recvArmed || it->second.cancelRequested) {
+        return;
+    }
+
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        pendingRecv_.push_back(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = makeUserData(fd, OP_RECV);
+    it->second.recvArmed = true;
+}
+
+void UringBackend::onRecv(int fd, int32_t res, uint32_t flags) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) {
+        return;
+    }
+    ConnectionOps& ops = it->second;
+    std::shared_ptr<WebSocketConnection> conn = ops.conn;
+
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+        ops.recvArmed = false;
+    }
+
+    if (res > 0) {
+        uint16_t bufferId = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        // While closing, input is read and dropped so unread data does not turn
+        // our FIN into a RST
+        if (!ops.closing) {
+            conn->inbound.append(bufPool_ + static_cast<size_t>(bufferId) * BUFFER_SIZE, res);
+        }
+        recycleBuffer(bufferId);
+
+        if (!more) {
+            armRecv(fd);
+        }
+        if (!ops.closing) {
+            callbacks_.onData(conn);
+        }
+        maybeFinishClose(fd);
+        return;
+    }
+
+    if (res == -ENOBUFS) {
+        // Every registered buffer is queued in some connection; try again
+        // after this batch has handed them back
+        pendingRecv_.push_back(fd);
+        return;
+    }
+
+    // EOF, error or cancellation
+    if (!ops.closing && conn->active) {
+        callbacks_.onDisconnect(conn);
+    }
+    maybeFinishClose(fd);
+}
+
+bool UringBackend::writev(const std::shared_ptr<WebSocketConnection>& conn, const struct iovec* iov, int count) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        if (!conn->active) {
+            return false;
+        }
+        // The send SQE needs memory that outlives this call, so the pieces are
+        // copied into outbound here and sent from the loop
+        for (int i = 0; i < count; i++) {
+            conn->outbound.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+        schedule = !conn->writeScheduled;
+        conn->writeScheduled = true;
+    }
+
+    if (schedule) {
+        scheduleSend(conn->socket);
+    }
+    return true;
+}
+
+bool UringBackend::writeShared(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& buffer,
+                               uint64_t coalesceKey) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        if (!conn->active) {
+            return false;
+        }
+        // The reference keeps the buffer alive until the send completes
+        conn->outbound.append(buffer, 0, coalesceKey);
+        schedule = !conn->writeScheduled;
+        conn->writeScheduled = true;
+    }
+
+    if (schedule) {
+        scheduleSend(conn->socket);
+    }
+    return true;
+}
+
+void UringBackend::scheduleSend(int fd) {
+    if (loop_->isInLoopThread()) {
+        pendingSend_.push_back(fd);
+        return;
+    }
+    loop_->post([this, fd]() {
+        pendingSend_.push_back(fd);
+    });
+}
+
+void UringBackend::startSend(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end() || it->second.sendInFlight) {
+        return;
+    }
+    ConnectionOps& ops = it->second;
+    std::shared_ptr<WebSocketConnection> conn = ops.conn;
+
+    // A remainder the SQ had no room for goes first
+    if (ops.sending.empty()) {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        ops.sending.swap(conn->outbound);
+        if (ops.sending.empty()) {
+            conn->writeScheduled = false;
+        }
+    }
+
+    if (ops.sending.empty()) {
+        maybeFinishClose(fd);
+        return;
+    }
+    if (!submitSend(fd, ops)) {
+        // The kernel has yet to take the queued SQEs. Keep the batch and try
+        // again before the next wait, once their completions free the ring.
+        pendingSend_.push_back(fd);
+    }
+}
+
+bool UringBackend::submitSend(int fd, ConnectionOps& ops) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    memset(&ops.sendMsg, 0, sizeof(ops.sendMsg));
+    ops.sendMsg.msg_iov = ops.sendIov;
+    ops.sendMsg.msg_iovlen = ops.sending.gather(ops.sendIov, SEND_IOVECS);
+    ops.sendInFlight = true;
+    sendCalls_.fetch_add(1, std::memory_order_relaxed);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&ops.sendMsg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = makeUserData(fd, OP_SEND);
+    return true;
+}
+
+void UringBackend::onSend(int fd, int32_t res) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) {
+        return;
+    }
+    ConnectionOps& ops = it->second;
+    std::shared_ptr<WebSocketConnection> conn = ops.conn;
+    ops.sendInFlight = false;
+
+    if (res < 0) {
+        ops.sending.clear();
+        {
+            std::lock_guard<std::mutex> lock(conn->writeMutex);
+            conn->outbound.clear();
+            conn->writeScheduled = false;
+        }
+        if (!ops.closing && conn->active) {
+            callbacks_.onDisconnect(conn);
+        }
+        maybeFinishClose(fd);
+        return;
+    }
+
+    ops.sending.consume(static_cast<size_t>(res));
+    conn->bytesSent.fetch_add(static_cast<uint64_t>(res), std::memory_order_relaxed);
+    if (!ops.sending.empty() && submitSend(fd, ops)) {
+        return;
+    }
+
+    // Batch done; pick up whatever was queued meanwhile
+    startSend(fd);
+}
+
+void UringBackend::close(const std::shared_ptr<WebSocketConnection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->active = false;
+    }
+
+    auto it = connections_.find(conn->socket);
+    if (it == connections_.end()) {
+        // Never attached
+        if (!conn->socketClosed) {
+            conn->socketClosed = true;
+            ::close(conn->socket);
+        }
+        return;
+    }
+    it->second.closing = true;
+    maybeFinishClose(conn->socket);
+}
+
+void UringBackend::abort(const std::shared_ptr<WebSocketConnection>& conn) {
+    if (conn->socketClosed) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->active = false;
+        conn->outbound.clear();
+    }
+
+    // Zero linger makes the final close a RST. Shutting down both directions
+    // fails a send stuck on a full socket buffer, so close() does not wait on it.
+    struct linger reset = {1, 0};
+    setsockopt(conn->socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    auto it = connections_.find(conn->socket);
+    if (it != connections_.end()) {
+        ::shutdown(conn->socket, SHUT_RDWR);
+        if (!it->second.sendInFlight) {
+            it->second.sending.clear();
+        }
+    }
+    close(conn);
+}
+
+void UringBackend::cancelRecv(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end() || it->second.cancelRequested) {
+        return;
+    }
+    it->second.cancelRequested = true;
+    ::shutdown(fd, SHUT_WR);
+
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        // Fall back to shutdown, which also completes the pending recv
+        ::shutdown(fd, SHUT_RDWR);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = makeUserData(fd, OP_RECV);
+    sqe->user_data = makeUserData(fd, OP_CANCEL);
+}
+
+void UringBackend::maybeFinishClose(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end() || !it->second.closing) {
+        return;
+    }
+    ConnectionOps& ops = it->second;
+    std::shared_ptr<WebSocketConnection> conn = ops.conn;
+
+    // A batch the SQ had no room for is still held in sending, and its fd
+    // queued in pendingSend_
+    if (ops.sendInFlight || !ops.sending.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        if (!conn->outbound.empty()) {
+            return; // startSend is scheduled and will call back here
+        }
+    }
+
+    if (ops.recvArmed) {
+        // Send our FIN now; the fd is closed once the cancelled recv completes
+        cancelRecv(fd);
+        return;
+    }
+
+    // Nothing in flight references the fd any more
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        conn->outbound.clear();
+        conn->writeScheduled = false;
+    }
+    conn->socketClosed = true;
+    ::close(fd);
+    connections_.erase(it);
+    // A descriptor reused by a later accept must not inherit these
+    pendingSend_.erase(std::remove(pendingSend_.begin(), pendingSend_.end(), fd), pendingSend_.end());
+    pendingRecv_.erase(std::remove(pendingRecv_.begin(), pendingRecv_.end(), fd), pendingRecv_.end());
+}
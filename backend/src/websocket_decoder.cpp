@@ -0,0 +1,149 @@
+#include "websocket_decoder.h"
+
+namespace {
+
+constexpr size_t MAX_CONTROL_PAYLOAD = 125;
+
+bool isControl(uint8_t opcode) {
+    return opcode & 0x8;
+}
+
+} // namespace
+
+WebSocketDecoder::WebSocketDecoder(size_t maxMessageSize)
+    : maxMessageSize_(maxMessageSize), consumed_(0), opcode_(0), closeCode_(0), compressed_(false),
+      compressionAllowed_(false), fragmentOpcode_(WebSocketOpcode::CONTINUATION), fragmentCompressed_(false) {
+}
+
+void WebSocketDecoder::reset() {
+    consumed_ = 0;
+    opcode_ = 0;
+    payload_ = std::string_view();
+    closeCode_ = 0;
+    compressed_ = false;
+    compressionAllowed_ = false;
+    fragmentOpcode_ = WebSocketOpcode::CONTINUATION;
+    fragmentCompressed_ = false;
+    fragments_.clear();
+}
+
+WebSocketDecoder::Result WebSocketDecoder::fail(uint16_t code) {
+    closeCode_ = code;
+    fragments_.clear();
+    return Result::ERROR;
+}
+
+WebSocketDecoder::Result WebSocketDecoder::decode(char* data, size_t size) {
+    consumed_ = 0;
+    payload_ = std::string_view();
+    compressed_ = false;
+    // The previous call's reassembled message is no longer referenced
+    if (fragmentOpcode_ == WebSocketOpcode::CONTINUATION && !fragments_.empty()) {
+        fragments_.clear();
+    }
+
+    while (true) {
+        const uint8_t* frame = reinterpret_cast<const uint8_t*>(data + consumed_);
+        size_t available = size - consumed_;
+        if (available < 2) {
+            return Result::INCOMPLETE;
+        }
+
+        bool fin = frame[0] & 0x80;
+        uint8_t opcode = frame[0] & 0x0F;
+        bool masked = frame[1] & 0x80;
+        uint64_t length = frame[1] & 0x7F;
+        bool rsv1 = frame[0] & 0x40;
+
+        // RSV1 marks a deflated message (RFC 7692) and only goes on the first
+        // frame of a data message; RSV2 and RSV3 have no meaning here
+        if (frame[0] & 0x30) {
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+        if (rsv1 && (!compressionAllowed_ || isControl(opcode) || opcode == WebSocketOpcode::CONTINUATION)) {
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+        // Clients must mask every frame
+        if (!masked) {
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+        if (isControl(opcode)) {
+            if (opcode > WebSocketOpcode::PONG || !fin || length > MAX_CONTROL_PAYLOAD) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+        } else if (opcode > WebSocketOpcode::BINARY) {
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+
+        size_t headerLength = 2;
+        if (length == 126) {
+            if (available < 4) {
+                return Result::INCOMPLETE;
+            }
+            length = (static_cast<uint64_t>(frame[2]) << 8) | frame[3];
+            headerLength = 4;
+        } else if (length == 127) {
+            if (available < 10) {
+                return Result::INCOMPLETE;
+            }
+            length = 0;
+            for (int i = 0; i < 8; i++) {
+                length = (length << 8) | frame[2 + i];
+            }
+            if (length >> 63) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+            headerLength = 10;
+        }
+
+        // Checked before waiting for the payload, so an oversized message is
+        // refused without buffering it
+        if (!isControl(opcode) && length > maxMessageSize_ - fragments_.size()) {
+            return fail(WebSocketCloseCode::MESSAGE_TOO_BIG);
+        }
+
+        if (available < headerLength + 4 || available - headerLength - 4 < length) {
+            return Result::INCOMPLETE;
+        }
+        uint8_t key[4] = {frame[headerLength], frame[headerLength + 1], frame[headerLength + 2], frame[headerLength + 3]};
+        char* payload = data + consumed_ + headerLength + 4;
+        unmaskPayload(payload, length, key);
+        consumed_ += headerLength + 4 + length;
+
+        if (isControl(opcode)) {
+            opcode_ = opcode;
+            payload_ = std::string_view(payload, length);
+            return Result::CONTROL;
+        }
+
+        if (opcode == WebSocketOpcode::CONTINUATION) {
+            if (fragmentOpcode_ == WebSocketOpcode::CONTINUATION) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+            fragments_.append(payload, length);
+            if (!fin) {
+                continue;
+            }
+            opcode_ = fragmentOpcode_;
+            compressed_ = fragmentCompressed_;
+            fragmentOpcode_ = WebSocketOpcode::CONTINUATION;
+            payload_ = fragments_;
+            return Result::MESSAGE;
+        }
+
+        // A new data frame while a fragmented message is still open
+        if (fragmentOpcode_ != WebSocketOpcode::CONTINUATION) {
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+        if (!fin) {
+            fragmentOpcode_ = opcode;
+            fragmentCompressed_ = rsv1;
+            fragments_.assign(payload, length);
+            continue;
+        }
+        opcode_ = opcode;
+        compressed_ = rsv1;
+        payload_ = std::string_view(payload, length);
+        return Result::MESSAGE;
+    }
+}
@@ -0,0 +1,315 @@
+#include "websocket_deflate.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr int MIN_WINDOW_BITS = 9;  // zlib's raw deflate silently turns 8 into 9
+constexpr int MAX_WINDOW_BITS = 15;
+constexpr size_t INFLATE_OVERHEAD = 7 * 1024;
+const char FLUSH_TRAILER[] = {'\x00', '\x00', '\xff', '\xff'};
+
+struct ExtensionParam {
+    std::string_view name;
+    std::string_view value;
+    bool hasValue;
+};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// Splits "name; a; b=1" into the extension name and its parameters
+std::string_view splitOffer(std::string_view offer, std::vector<ExtensionParam>& params) {
+    params.clear();
+    size_t semi = offer.find(';');
+    std::string_view name = trim(offer.substr(0, semi));
+    while (semi != std::string_view::npos) {
+        offer.remove_prefix(semi + 1);
+        semi = offer.find(';');
+        std::string_view item = trim(offer.substr(0, semi));
+        ExtensionParam param{item, std::string_view(), false};
+        size_t eq = item.find('=');
+        if (eq != std::string_view::npos) {
+            param.name = trim(item.substr(0, eq));
+            param.value = trim(item.substr(eq + 1));
+            if (param.value.size() >= 2 && param.value.front() == '"' && param.value.back() == '"') {
+                param.value = param.value.substr(1, param.value.size() - 2);
+            }
+            param.hasValue = true;
+        }
+        params.push_back(param);
+    }
+    return name;
+}
+
+bool parseWindowBits(std::string_view value, int& bits) {
+    if (value.empty() || value.size() > 2) {
+        return false;
+    }
+    int parsed = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        parsed = parsed * 10 + (c - '0');
+    }
+    if (parsed < 8 || parsed > MAX_WINDOW_BITS) {
+        return false;
+    }
+    bits = parsed;
+    return true;
+}
+
+int memLevelFor(int windowBits) {
+    return std::clamp(windowBits - 7, 1, 8);
+}
+
+// Checks one offer against RFC 7692 section 7.1 and our config. On success
+// params holds what both sides will use and clientBitsOffered whether the
+// client can accept a client_max_window_bits in the response.
+bool acceptOffer(const std::vector<ExtensionParam>& offer, const DeflateConfig& config,
+                 PerMessageDeflate::Params& params, bool& clientBitsOffered) {
+    params = PerMessageDeflate::Params();
+    clientBitsOffered = false;
+    bool seenServerBits = false;
+    bool seenServerNoTakeover = false;
+    bool seenClientNoTakeover = false;
+
+    for (const ExtensionParam& param : offer) {
+        if (param.name == "server_no_context_takeover") {
+            if (seenServerNoTakeover || param.hasValue) {
+                return false;
+            }
+            seenServerNoTakeover = true;
+            params.serverNoContextTakeover = true;
+        } else if (param.name == "client_no_context_takeover") {
+            if (seenClientNoTakeover || param.hasValue) {
+                return false;
+            }
+            seenClientNoTakeover = true;
+            params.clientNoContextTakeover = true;
+        } else if (param.name == "server_max_window_bits") {
+            if (seenServerBits || !param.hasValue || !parseWindowBits(param.value, params.serverWindowBits)) {
+                return false;
+            }
+            seenServerBits = true;
+            // A raw deflate stream with a 256-byte window is not something zlib can produce
+            if (params.serverWindowBits < MIN_WINDOW_BITS) {
+                return false;
+            }
+        } else if (param.name == "client_max_window_bits") {
+            if (clientBitsOffered) {
+                return false;
+            }
+            clientBitsOffered = true;
+            if (param.hasValue && !parseWindowBits(param.value, params.clientWindowBits)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if (!config.contextTakeover) {
+        params.serverNoContextTakeover = true;
+    }
+
+    // Fit the memory limit: our compressor is the larger half, so shrink its
+    // window first, then ask the client for a smaller one if it let us
+    while (PerMessageDeflate::memoryFor(params.serverWindowBits, params.clientWindowBits) > config.memoryLimit) {
+        if (params.serverWindowBits > MIN_WINDOW_BITS) {
+            params.serverWindowBits--;
+        } else if (clientBitsOffered && params.clientWindowBits > MIN_WINDOW_BITS) {
+            params.clientWindowBits--;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+size_t PerMessageDeflate::memoryFor(int serverWindowBits, int clientWindowBits) {
+    size_t deflateMemory = (size_t(1) << (serverWindowBits + 2)) + (size_t(1) << (memLevelFor(serverWindowBits) + 9));
+    size_t inflateMemory = (size_t(1) << std::max(clientWindowBits, MIN_WINDOW_BITS)) + INFLATE_OVERHEAD;
+    return deflateMemory + inflateMemory;
+}
+
+std::unique_ptr<PerMessageDeflate> PerMessageDeflate::negotiate(std::string_view offers, const DeflateConfig& config,
+                                                                std::string& response) {
+    response.clear();
+    if (!config.enabled) {
+        return nullptr;
+    }
+
+    std::vector<ExtensionParam> offer;
+    while (!offers.empty()) {
+        size_t comma = offers.find(',');
+        std::string_view item = offers.substr(0, comma);
+        offers.remove_prefix(comma == std::string_view::npos ? offers.size() : comma + 1);
+
+        if (splitOffer(item, offer) != "permessage-deflate") {
+            continue;
+        }
+        Params params;
+        bool clientBitsOffered;
+        if (!acceptOffer(offer, config, params, clientBitsOffered)) {
+            continue;
+        }
+
+        response = "permessage-deflate";
+        if (params.serverNoContextTakeover) {
+            response += "; server_no_context_takeover";
+        }
+        if (params.clientNoContextTakeover) {
+            response += "; client_no_context_takeover";
+        }
+        if (params.serverWindowBits < MAX_WINDOW_BITS) {
+            response += "; server_max_window_bits=" + std::to_string(params.serverWindowBits);
+        }
+        if (clientBitsOffered && params.clientWindowBits < MAX_WINDOW_BITS) {
+            response += "; client_max_window_bits=" + std::to_string(params.clientWindowBits);
+        }
+        return std::make_unique<PerMessageDeflate>(params, config.minSize);
+    }
+    return nullptr;
+}
+
+PerMessageDeflate::PerMessageDeflate(const Params& params, size_t minSize)
+    : params_(params), minSize_(minSize), deflateReady_(false), inflateReady_(false) {
+    memset(&deflate_, 0, sizeof(deflate_));
+    memset(&inflate_, 0, sizeof(inflate_));
+}
+
+PerMessageDeflate::~PerMessageDeflate() {
+    if (deflateReady_) {
+        deflateEnd(&deflate_);
+    }
+    if (inflateReady_) {
+        inflateEnd(&inflate_);
+    }
+}
+
+bool PerMessageDeflate::ensureDeflate() {
+    if (!deflateReady_) {
+        // Negative window bits: raw deflate, no zlib header or checksum
+        deflateReady_ = deflateInit2(&deflate_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -params_.serverWindowBits,
+                                     memLevelFor(params_.serverWindowBits), Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    return deflateReady_;
+}
+
+bool PerMessageDeflate::ensureInflate() {
+    if (!inflateReady_) {
+        // A client granted 8 bits may still send with 9 if it uses zlib; a
+        // window wider than the sender's decodes its stream all the same
+        inflateReady_ = inflateInit2(&inflate_, -std::max(params_.clientWindowBits, MIN_WINDOW_BITS)) == Z_OK;
+    }
+    return inflateReady_;
+}
+
+bool PerMessageDeflate::compress(std::string_view payload, std::string& out) {
+    if (!worthCompressing(payload.size()) || !ensureDeflate()) {
+        return false;
+    }
+
+    out.resize(deflateBound(&deflate_, payload.size()) + 16);
+    deflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+    deflate_.avail_in = payload.size();
+    size_t produced = 0;
+    while (true) {
+        deflate_.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+        deflate_.avail_out = out.size() - produced;
+        int rc = deflate(&deflate_, Z_SYNC_FLUSH);
+        produced = out.size() - deflate_.avail_out;
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            deflateReset(&deflate_);
+            return false;
+        }
+        // Done once the flush fit with room to spare
+        if (deflate_.avail_in == 0 && deflate_.avail_out > 0) {
+            break;
+        }
+        out.resize(out.size() * 2);
+    }
+
+    // Section 7.2.1: the empty stored block a sync flush ends with is implied
+    if (produced >= sizeof(FLUSH_TRAILER) &&
+        memcmp(&out[produced - sizeof(FLUSH_TRAILER)], FLUSH_TRAILER, sizeof(FLUSH_TRAILER)) == 0) {
+        produced -= sizeof(FLUSH_TRAILER);
+    }
+    out.resize(produced);
+
+    // If it did not shrink the message goes out as is. The peer's window then
+    // never sees these bytes, so ours must forget them too.
+    if (produced >= payload.size()) {
+        deflateReset(&deflate_);
+        return false;
+    }
+    if (params_.serverNoContextTakeover) {
+        deflateReset(&deflate_);
+    }
+    return true;
+}
+
+PerMessageDeflate::InflateResult PerMessageDeflate::decompress(std::string_view payload, size_t maxSize,
+                                                               std::string& out) {
+    out.clear();
+    if (!ensureInflate()) {
+        return InflateResult::ERROR;
+    }
+
+    // Feed the message, then the trailer the sender stripped
+    std::string_view inputs[2] = {payload, std::string_view(FLUSH_TRAILER, sizeof(FLUSH_TRAILER))};
+    size_t produced = 0;
+    out.resize(std::min(std::max(payload.size() * 4, size_t(1024)), maxSize + 1));
+    for (std::string_view input : inputs) {
+        inflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        inflate_.avail_in = input.size();
+        while (true) {
+            if (produced == out.size()) {
+                if (out.size() > maxSize) {
+                    return InflateResult::TOO_BIG;
+                }
+                out.resize(std::min(out.size() * 2, maxSize + 1));
+            }
+            inflate_.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+            inflate_.avail_out = out.size() - produced;
+            int rc = inflate(&inflate_, Z_SYNC_FLUSH);
+            produced = out.size() - inflate_.avail_out;
+            if (rc == Z_STREAM_END) {
+                // A final block may end the message, but nothing may follow it
+                inflateReset(&inflate_);
+                if (inflate_.avail_in > 0 && input.data() == payload.data()) {
+                    return InflateResult::ERROR;
+                }
+                break;
+            }
+            if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                return InflateResult::ERROR;
+            }
+            // Input used up and output not full: nothing left pending
+            if (inflate_.avail_in == 0 && inflate_.avail_out > 0) {
+                break;
+            }
+        }
+    }
+    if (produced > maxSize) {
+        return InflateResult::TOO_BIG;
+    }
+    out.resize(produced);
+
+    if (params_.clientNoContextTakeover) {
+        inflateReset(&inflate_);
+    }
+    return InflateResult::OK;
+}
@@ -1,39 +1,267 @@
 #include "websocket_handler.h"
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <cstring>
 #include <openssl/sha.h>
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 #include <openssl/evp.h>
+#include "event_loop.h"
+#include "message_handler.h"
+#include "presence_service.h"
+
+namespace {
+
+// Sent straight from the accept path; short enough to fit any fresh socket buffer
+const char SERVICE_UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 19\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Service Unavailable";
+
+const char* httpStatusReason(int status) {
+    switch (status) {
+        case 400: return "Bad Request";
+        case 413: return "Request Entity Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Error";
+    }
+}
+
+// Coalesce key for one sender's signals of one type in one conversation. The
+// top bit keeps these apart from topic keys; ids are assumed below 2^30.
+uint64_t signalKey(uint32_t type, int from, const Topic& conversation) {
+    return uint64_t(1) << 63 |
+           uint64_t(type == MessageType::READ) << 62 |
+           (static_cast<uint64_t>(from) & 0x3fffffff) << 32 |
+           uint64_t(conversation.kind == Topic::Kind::GROUP) << 31 |
+           (static_cast<uint64_t>(conversation.id) & 0x7fffffff);
+}
+
+// HTTP/1.1 connections persist unless the client opts out; HTTP/1.0 ones
+// only when the client asks for it
+bool wantsKeepAlive(const HttpRequest& request) {
+    if (request.headerHasToken("Connection", "close")) {
+        return false;
+    }
+    return request.versionMinor >= 1 || request.headerHasToken("Connection", "keep-alive");
+}
+
+} // namespace
 
 WebSocketHandler::WebSocketHandler(std::shared_ptr<MessageHandler> msgHandler, 
-                                 std::shared_ptr<UserManager> userManager)
-    : messageHandler_(msgHandler), userManager_(userManager) {
+                                 std::shared_ptr<UserManager> userManager,
+                                 std::shared_ptr<PubSubHub> pubsub,
+                                 std::shared_ptr<PresenceService> presence)
+    : messageHandler_(msgHandler), userManager_(userManager), pubsub_(pubsub), presence_(presence),
+      signalsReceived_(0), signalsPublished_(0), signalsCoalesced_(0), signalsDropped_(0) {
+    pubsub_->setDelivery([this](const Topic& topic, const PubSubHub::Subscribers& subscribers,
+                                const Envelope& envelope, uint64_t coalesceKey) {
+        deliver(topic, subscribers, envelope, coalesceKey);
+    });
+    setupRoutes();
+}
+
+void WebSocketHandler::setupRoutes() {
+    router_.add(HttpMethod::GET, "/", [this](const std::shared_ptr<WebSocketConnection>& conn, const HttpRequest& request, const RouteParams&) {
+        handleStatusPage(conn, request);
+    });
+    router_.add(HttpMethod::GET, "/ws", [this](const std::shared_ptr<WebSocketConnection>& conn, const HttpRequest& request, const RouteParams&) {
+        handleWebSocketUpgrade(conn, request);
+    });
+    router_.add(HttpMethod::POST, "/api/auth/register", [this](const std::shared_ptr<WebSocketConnection>& conn, const HttpRequest& request, const RouteParams&) {
+        handleRegister(conn, request);
+    });
+    router_.add(HttpMethod::POST, "/api/auth/login", [this](const std::shared_ptr<WebSocketConnection>& conn, const HttpRequest& request, const RouteParams&) {
+        handleLogin(conn, request);
+    });
 }
 
 WebSocketHandler::~WebSocketHandler() {
     // Clean up connections
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    for (auto& [key, conn] : connections_) {
-        if (conn && conn->active) {
+    for (const auto& conn : registry_.allConnections()) {
+        if (conn->active) {
             ::close(conn->socket);
         }
     }
 }
 
-void WebSocketHandler::handleConnection(int clientSocket, const std::string& remoteAddress) {
-    auto connection = std::make_shared<WebSocketConnection>(clientSocket, remoteAddress);
+void WebSocketHandler::handleConnection(int clientSocket, const std::string& remoteAddress, IoBackend* io) {
+    AdmissionControl::Verdict verdict = admission_.admit(remoteAddress);
+    if (verdict != AdmissionControl::Verdict::ADMITTED) {
+        rejectConnection(clientSocket, remoteAddress, verdict, io->tls() == nullptr);
+        return;
+    }
     
-    // Start a new thread to handle this connection
-    connection->read_thread = std::thread([this, connection]() {
-        handleClient(connection);
+    auto connection = std::make_shared<WebSocketConnection>(clientSocket, remoteAddress, io);
+    connection->outbound.setLimits(outboundLimits_);
+    
+    // Indexed by user as well once it signs in (addConnection)
+    registry_.addSocket(clientSocket, connection);
+    
+    EventLoop* loop = connection->loop;
+    loop->runInLoop([this, connection, loop]() {
+        if (!connection->io->attach(connection)) {
+            closeSocket(connection);
+            return;
+        }
+        
+        // Drop clients that connect but never finish a request
+        armHttpTimer(connection, REQUEST_TIMEOUT_MS);
     });
-    connection->read_thread.detach(); // Detach the thread to avoid SIGABRT
+}
+
+void WebSocketHandler::rejectConnection(int clientSocket, const std::string& remoteAddress,
+                                        AdmissionControl::Verdict verdict, bool plaintext) {
+    // No connection object, timer or loop registration: one non-blocking send
+    // and the descriptor is gone. A client that sees nothing but the close is
+    // no worse off than one that was refused. TLS clients only get the close;
+    // a handshake is exactly the work being shed.
+    if (plaintext) {
+        ::send(clientSocket, SERVICE_UNAVAILABLE, sizeof(SERVICE_UNAVAILABLE) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    ::close(clientSocket);
+    
+    // Logged at powers of two so a storm does not turn into a logging storm
+    AdmissionControl::Stats stats = admission_.stats();
+    uint64_t rejected = stats.rejectedConnections + stats.rejectedPerIp + stats.rejectedPending;
+    if ((rejected & (rejected - 1)) == 0) {
+        std::cerr << "Rejected connection from " << remoteAddress << " (" << admissionVerdictName(verdict)
+                  << ", " << rejected << " rejected so far, " << stats.active << " active)" << std::endl;
+    }
+}
+
+IoCallbacks WebSocketHandler::ioCallbacks() {
+    IoCallbacks callbacks;
+    callbacks.onData = [this](const std::shared_ptr<WebSocketConnection>& conn) {
+        if (conn->state != ConnectionState::CLOSED) {
+            handleClient(conn);
+        }
+    };
+    callbacks.onDisconnect = [this](const std::shared_ptr<WebSocketConnection>& conn) {
+        closeSocket(conn);
+    };
+    return callbacks;
+}
+
+bool WebSocketHandler::writeRaw(std::shared_ptr<WebSocketConnection> conn, const std::string& data) {
+    return conn->io->write(conn, data);
+}
+
+void WebSocketHandler::sendHttpResponse(std::shared_ptr<WebSocketConnection> conn, HttpResponse& response) {
+    response.setKeepAlive(conn->keepAlive);
+    
+    struct iovec iov[HttpResponse::IOVEC_COUNT];
+    int count = response.toIovecs(iov);
+    conn->io->writev(conn, iov, count);
     
-    // Store connection (will be moved to authenticated connections after login)
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    connections_[clientSocket] = connection;
+    if (!conn->keepAlive) {
+        // The backend closes once the response is flushed
+        closeSocket(conn);
+    }
+}
+
+void WebSocketHandler::armHttpTimer(std::shared_ptr<WebSocketConnection> conn, int timeoutMs) {
+    conn->loop->cancelTimer(conn->timer);
+    
+    std::weak_ptr<WebSocketConnection> weak = conn;
+    conn->timer = conn->loop->runAfter(std::chrono::milliseconds(timeoutMs), [this, weak]() {
+        auto conn = weak.lock();
+        if (!conn || conn->state != ConnectionState::HTTP) {
+            return;
+        }
+        conn->timer = 0;
+        if (!conn->httpIdle) {
+            std::cerr << "Timeout waiting for request from " << conn->remote_address << std::endl;
+        }
+        closeSocket(conn);
+    });
+}
+
+void WebSocketHandler::closeSocket(std::shared_ptr<WebSocketConnection> conn, bool abortive) {
+    if (!conn->loop->isInLoopThread()) {
+        conn->loop->post([this, conn, abortive]() {
+            closeSocket(conn, abortive);
+        });
+        return;
+    }
+    
+    if (conn->state == ConnectionState::CLOSED) {
+        return;
+    }
+    conn->state = ConnectionState::CLOSED;
+    conn->inbound.clear();
+    conn->loop->cancelTimer(conn->timer);
+    conn->timer = 0;
+    if (abortive) {
+        conn->io->abort(conn);
+    } else {
+        conn->io->close(conn);
+        if (!conn->socketClosed) {
+            // Queued output is still draining; a peer that stopped reading
+            // must not hold the socket and its buffers forever
+            std::weak_ptr<WebSocketConnection> weak = conn;
+            conn->loop->runAfter(std::chrono::milliseconds(CLOSE_GRACE_MS), [weak]() {
+                auto conn = weak.lock();
+                if (conn && !conn->socketClosed) {
+                    conn->io->abort(conn);
+                }
+            });
+        }
+    }
+    admission_.release(conn->remote_address, conn->handshakePending);
+    conn->handshakePending = false;
+    
+    registry_.removeSocket(conn->socket, conn);
+    signOut(conn);
+    pubsub_->unsubscribeAll(conn);
+}
+
+void WebSocketHandler::armLivenessTimer(std::shared_ptr<WebSocketConnection> conn) {
+    conn->loop->cancelTimer(conn->timer);
+    
+    std::weak_ptr<WebSocketConnection> weak = conn;
+    conn->timer = conn->loop->runAfter(std::chrono::milliseconds(PING_INTERVAL_MS), [this, weak]() {
+        auto conn = weak.lock();
+        if (!conn || conn->state != ConnectionState::WEBSOCKET) {
+            return;
+        }
+        conn->timer = 0;
+        checkLiveness(conn);
+    });
+}
+
+void WebSocketHandler::checkLiveness(std::shared_ptr<WebSocketConnection> conn) {
+    // Any frame counts as a sign of life, so busy connections never wait on a pong
+    if (conn->awaitingPong) {
+        std::cerr << "No response to ping from " << conn->remote_address << ", dropping" << std::endl;
+        closeSocket(conn, true);
+        return;
+    }
+    
+    // Output that has been queued for a whole interval without the socket
+    // taking a single byte means the peer stopped reading
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        queued = !conn->outbound.empty();
+    }
+    uint64_t sent = conn->bytesSent.load(std::memory_order_relaxed);
+    if (queued && sent == conn->lastBytesSent) {
+        std::cerr << "Send queue stalled for " << conn->remote_address << ", dropping" << std::endl;
+        closeSocket(conn, true);
+        return;
+    }
+    conn->lastBytesSent = sent;
+    
+    conn->awaitingPong = true;
+    sendFrame(conn, "", WebSocketOpcode::PING);
+    armLivenessTimer(conn);
 }
 
 void WebSocketHandler::handleClient(std::shared_ptr<WebSocketConnection> conn) {
@@ -41,268 +269,290 @@ void WebSocketHandler::handleClient(std::shared_ptr<WebSocketConnection> conn) {
         std::cerr << "Invalid connection object" << std::endl;
         return;
     }
-
-    char buffer[4096];
-    std::string request;
     
     try {
-        // Read HTTP request with timeout
-        fd_set readfds;
-        struct timeval timeout;
-        timeout.tv_sec = 5;  // 5 second timeout
-        timeout.tv_usec = 0;
-        
-        FD_ZERO(&readfds);
-        FD_SET(conn->socket, &readfds);
-        
-        int select_result = select(conn->socket + 1, &readfds, NULL, NULL, &timeout);
-        if (select_result <= 0) {
-            std::cerr << "Timeout or error waiting for data" << std::endl;
-            ::close(conn->socket);
+        if (conn->state == ConnectionState::WEBSOCKET) {
+            handleWebSocketData(conn);
             return;
         }
         
-        // Read HTTP request
-        while (true) {
-            ssize_t bytesRead = recv(conn->socket, buffer, sizeof(buffer) - 1, 0);
-            if (bytesRead <= 0) {
-                if (bytesRead == 0) {
-                    std::cout << "Client disconnected" << std::endl;
-                } else {
-                    std::cerr << "Error reading from socket: " << strerror(errno) << std::endl;
-                }
-                ::close(conn->socket);
-                return;
+        // Handle every complete request in the buffer; responses go out in
+        // order because they are queued on this thread one after another
+        size_t offset = 0;
+        bool completed = false;
+        while (conn->state == ConnectionState::HTTP) {
+            HttpParser::Result result = conn->http.parse(conn->inbound.data() + offset, conn->inbound.size() - offset);
+            if (result == HttpParser::Result::INCOMPLETE) {
+                break; // Wait for the rest of the request
             }
-            
-            buffer[bytesRead] = '\0';
-            request += buffer;
-            
-            if (request.find("\r\n\r\n") != std::string::npos) {
-                break; // End of HTTP request
+            if (result == HttpParser::Result::ERROR) {
+                // The stream cannot be resynchronised after a malformed request
+                int status = conn->http.errorStatus();
+                std::cerr << "Rejected HTTP request from " << conn->remote_address << " (" << status << ")" << std::endl;
+                conn->keepAlive = false;
+                sendErrorResponse(conn, status, httpStatusReason(status));
+                return;
             }
             
-            // Prevent infinite loop
-            if (request.length() > 8192) {
-                std::cerr << "Request too large" << std::endl;
-                sendErrorResponse(conn, 413, "Request Entity Too Large");
-                return;
+            // The request views point into inbound, so it is only trimmed
+            // after the request has been handled
+            const HttpRequest& request = conn->http.request();
+            if (conn->handshakePending) {
+                conn->handshakePending = false;
+                admission_.handshakeDone();
             }
+            conn->requestCount++;
+            conn->keepAlive = wantsKeepAlive(request) && conn->requestCount < MAX_REQUESTS_PER_CONNECTION;
+            offset += conn->http.consumed();
+            handleHttpRequest(conn, request);
+            conn->http.reset();
+            completed = true;
         }
         
-        // Validate request format
-        if (request.empty() || request.find("HTTP/") == std::string::npos) {
-            std::cerr << "Invalid HTTP request format" << std::endl;
-            sendErrorResponse(conn, 400, "Bad Request");
+        if (conn->state == ConnectionState::CLOSED) {
             return;
         }
+        conn->inbound.erase(0, offset);
         
-        // Parse HTTP request
-        std::string method, path, version;
-        std::istringstream requestStream(request);
-        requestStream >> method >> path >> version;
-        
-        if (method.empty() || path.empty() || version.empty()) {
-            std::cerr << "Invalid HTTP request line" << std::endl;
-            sendErrorResponse(conn, 400, "Bad Request");
-            return;
-        }
-        
-        std::cout << "HTTP Request: " << method << " " << path << std::endl;
-        
-        // Check if this is a WebSocket upgrade request
-        if (request.find("Upgrade: websocket") != std::string::npos) {
-            if (performHandshake(conn->socket, request)) {
-                std::cout << "WebSocket handshake successful for " << conn->remote_address << std::endl;
-                
-                // Handle WebSocket messages
-                while (conn->active) {
-                    ssize_t bytesRead = recv(conn->socket, buffer, sizeof(buffer), 0);
-                    if (bytesRead <= 0) {
-                        break;
-                    }
-                    
-                    std::string data(buffer, bytesRead);
-                    WebSocketFrame frame = parseFrame(data);
-                    
-                    if (frame.opcode == OPCODE_TEXT) {
-                        processMessage(conn, frame.payload);
-                    } else if (frame.opcode == OPCODE_CLOSE) {
-                        break;
-                    } else if (frame.opcode == OPCODE_PING) {
-                        sendFrame(conn, "", OPCODE_PONG);
-                    }
-                }
+        if (conn->state == ConnectionState::WEBSOCKET) {
+            armLivenessTimer(conn);
+            // Frames the client sent right behind the upgrade stay buffered
+            if (!conn->inbound.empty()) {
+                handleWebSocketData(conn);
             }
             return;
         }
         
-        // Handle CORS preflight requests
-        if (method == "OPTIONS") {
-            handleCorsPreflight(conn);
-            return;
-        }
-        
-        // Handle different endpoints
-        if (method == "POST" && path == "/api/auth/register") {
-            handleRegister(conn, request);
-        } else if (method == "POST" && path == "/api/auth/login") {
-            handleLogin(conn, request);
-        } else if (method == "GET" && path == "/") {
-            // Serve a simple status page
-            std::string response = "HTTP/1.1 200 OK\r\n";
-            response += "Content-Type: text/plain\r\n";
-            response += "Content-Length: 13\r\n";
-            response += "Connection: close\r\n";
-            response += "\r\n";
-            response += "Hello, World!";
-            send(conn->socket, response.c_str(), response.length(), 0);
-            ::close(conn->socket);
-            return;
-        } else {
-            // 404 Not Found
-            std::string response = "HTTP/1.1 404 Not Found\r\n";
-            response += "Content-Type: text/plain\r\n";
-            response += "Content-Length: 13\r\n";
-            response += "Connection: close\r\n";
-            response += "\r\n";
-            response += "Not Found";
-            send(conn->socket, response.c_str(), response.length(), 0);
-            ::close(conn->socket);
-            return;
+        // Between requests the idle timeout applies; once the next request
+        // starts arriving it has REQUEST_TIMEOUT_MS to complete
+        if (completed || conn->httpIdle) {
+            conn->httpIdle = conn->inbound.empty();
+            armHttpTimer(conn, conn->httpIdle ? KEEPALIVE_IDLE_MS : REQUEST_TIMEOUT_MS);
         }
         
     } catch (const std::exception& e) {
         std::cerr << "Exception in handleClient: " << e.what() << std::endl;
+        conn->keepAlive = false;
         sendErrorResponse(conn, 500, "Internal Server Error");
     } catch (...) {
         std::cerr << "Unknown exception in handleClient" << std::endl;
+        conn->keepAlive = false;
         sendErrorResponse(conn, 500, "Internal Server Error");
     }
 }
 
-void WebSocketHandler::handleCorsPreflight(std::shared_ptr<WebSocketConnection> conn) {
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += "Access-Control-Allow-Origin: *\r\n";
-    response += "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n";
-    response += "Access-Control-Allow-Headers: Content-Type, Authorization\r\n";
-    response += "Access-Control-Max-Age: 86400\r\n";
-    response += "Content-Length: 0\r\n";
-    response += "Connection: close\r\n";
-    response += "\r\n";
+void WebSocketHandler::handleHttpRequest(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
+    std::cout << "HTTP Request: " << request.method << " " << request.target << std::endl;
     
-    send(conn->socket, response.c_str(), response.length(), 0);
-    ::close(conn->socket);
+    // Handle CORS preflight requests for any path
+    if (request.method == "OPTIONS") {
+        handleCorsPreflight(conn);
+        return;
+    }
+    
+    RouteParams params;
+    Router::Match match = router_.match(request.method, request.path, params);
+    switch (match.status) {
+        case Router::Status::FOUND:
+            (*match.handler)(conn, request, params);
+            break;
+        case Router::Status::METHOD_NOT_ALLOWED: {
+            HttpResponse response("405 Method Not Allowed", HttpHeaders::JSON);
+            response.addHeader("Allow", Router::allowHeaderValue(match.allowedMethods));
+            response.setStaticBody("{\"success\": false, \"error\": \"Method Not Allowed\"}");
+            sendHttpResponse(conn, response);
+            break;
+        }
+        case Router::Status::NOT_FOUND: {
+            HttpResponse response("404 Not Found", HttpHeaders::TEXT);
+            response.setStaticBody("Not Found");
+            sendHttpResponse(conn, response);
+            break;
+        }
+    }
 }
 
-void WebSocketHandler::handleRegister(std::shared_ptr<WebSocketConnection> conn, const std::string& request) {
-    try {
-        // Extract JSON body from request
-        size_t bodyStart = request.find("\r\n\r\n");
-        if (bodyStart == std::string::npos) {
-            sendErrorResponse(conn, 400, "Bad Request");
+void WebSocketHandler::handleWebSocketUpgrade(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
+    if (!request.headerHasToken("Upgrade", "websocket")) {
+        sendErrorResponse(conn, 426, "Upgrade Required");
+        return;
+    }
+    
+    if (performHandshake(conn, request)) {
+        std::cout << "WebSocket handshake successful for " << conn->remote_address << std::endl;
+        conn->state = ConnectionState::WEBSOCKET;
+    } else {
+        sendErrorResponse(conn, 400, "Bad Request");
+    }
+}
+
+void WebSocketHandler::handleStatusPage(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
+    // Older clients open the WebSocket on the root path
+    if (request.headerHasToken("Upgrade", "websocket")) {
+        handleWebSocketUpgrade(conn, request);
+        return;
+    }
+    
+    // Serve a simple status page
+    HttpResponse response("200 OK", HttpHeaders::TEXT);
+    response.setStaticBody("Hello, World!");
+    sendHttpResponse(conn, response);
+}
+
+void WebSocketHandler::handleWebSocketData(std::shared_ptr<WebSocketConnection> conn) {
+    conn->awaitingPong = false;
+    
+    // Every complete message in the buffer is handled; a frame still arriving
+    // stays in inbound untouched until the rest of it is in
+    size_t offset = 0;
+    while (conn->state == ConnectionState::WEBSOCKET) {
+        WebSocketDecoder::Result result = conn->frames.decode(&conn->inbound[offset], conn->inbound.size() - offset);
+        offset += conn->frames.consumed();
+        if (result == WebSocketDecoder::Result::INCOMPLETE) {
+            break;
+        }
+        if (result == WebSocketDecoder::Result::ERROR) {
+            std::cerr << "WebSocket protocol error from " << conn->remote_address
+                      << " (" << conn->frames.closeCode() << ")" << std::endl;
+            closeConnection(conn, conn->frames.closeCode());
             return;
         }
         
-        std::string body = request.substr(bodyStart + 4);
+        std::string_view payload = conn->frames.payload();
+        if (conn->frames.compressed()) {
+            // Reused across messages; only the loop thread inflates
+            thread_local std::string inflated;
+            PerMessageDeflate::InflateResult inflate =
+                conn->deflate->decompress(payload, conn->frames.maxMessageSize(), inflated);
+            if (inflate != PerMessageDeflate::InflateResult::OK) {
+                std::cerr << "WebSocket inflate failed for " << conn->remote_address << std::endl;
+                closeConnection(conn, inflate == PerMessageDeflate::InflateResult::TOO_BIG
+                                          ? WebSocketCloseCode::MESSAGE_TOO_BIG
+                                          : WebSocketCloseCode::INVALID_PAYLOAD);
+                return;
+            }
+            payload = inflated;
+        }
+        switch (conn->frames.opcode()) {
+            case WebSocketOpcode::TEXT:
+            case WebSocketOpcode::BINARY:
+                processMessage(conn, payload, conn->frames.opcode());
+                break;
+            case WebSocketOpcode::CLOSE: {
+                // Echo the peer's status code, as the closing handshake expects;
+                // codes reserved for local use never go on the wire
+                uint16_t code = WebSocketCloseCode::NORMAL;
+                if (payload.size() >= 2) {
+                    code = (static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1]);
+                    if (code < 1000 || code >= 5000 || code == 1005 || code == 1006 || code == 1015) {
+                        code = WebSocketCloseCode::PROTOCOL_ERROR;
+                    }
+                } else if (payload.size() == 1) {
+                    code = WebSocketCloseCode::PROTOCOL_ERROR;
+                }
+                closeConnection(conn, code);
+                return;
+            }
+            case WebSocketOpcode::PING:
+                sendFrame(conn, std::string(payload), WebSocketOpcode::PONG);
+                break;
+            default:
+                break;
+        }
+    }
+    
+    if (conn->state != ConnectionState::CLOSED) {
+        conn->inbound.erase(0, offset);
+    }
+}
+
+void WebSocketHandler::handleCorsPreflight(std::shared_ptr<WebSocketConnection> conn) {
+    HttpResponse response("200 OK", HttpHeaders::CORS);
+    sendHttpResponse(conn, response);
+}
+
+void WebSocketHandler::handleRegister(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
+    try {
+        // The parser has already collected the full Content-Length body
+        std::string body(request.body);
         
         // Simple JSON parsing (in production, use a proper JSON library)
         // Expected format: {"username": "user@cockpit.com", "email": "user@cockpit.com", "password": "password"}
         
         // For now, just return a success response
-        std::string response = "HTTP/1.1 200 OK\r\n";
-        response += "Content-Type: application/json\r\n";
-        response += "Access-Control-Allow-Origin: *\r\n";
-        response += "Access-Control-Allow-Methods: POST, OPTIONS\r\n";
-        response += "Access-Control-Allow-Headers: Content-Type\r\n";
-        response += "Connection: close\r\n";
-        response += "\r\n";
-        response += "{\"success\": true, \"message\": \"User registered successfully\", \"token\": \"demo-token-123\"}";
-        
-        send(conn->socket, response.c_str(), response.length(), 0);
-        ::close(conn->socket);
+        HttpResponse response("200 OK", HttpHeaders::JSON_CORS);
+        response.setStaticBody("{\"success\": true, \"message\": \"User registered successfully\", \"token\": \"demo-token-123\"}");
+        sendHttpResponse(conn, response);
     } catch (const std::exception& e) {
         std::cerr << "Exception in handleRegister: " << e.what() << std::endl;
         sendErrorResponse(conn, 500, "Internal Server Error");
     }
 }
 
-void WebSocketHandler::handleLogin(std::shared_ptr<WebSocketConnection> conn, const std::string& request) {
+void WebSocketHandler::handleLogin(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
     try {
-        // Extract JSON body from request
-        size_t bodyStart = request.find("\r\n\r\n");
-        if (bodyStart == std::string::npos) {
-            sendErrorResponse(conn, 400, "Bad Request");
-            return;
-        }
-        
-        std::string body = request.substr(bodyStart + 4);
+        // The parser has already collected the full Content-Length body
+        std::string body(request.body);
         
         // For now, just return a success response
-        std::string response = "HTTP/1.1 200 OK\r\n";
-        response += "Content-Type: application/json\r\n";
-        response += "Access-Control-Allow-Origin: *\r\n";
-        response += "Access-Control-Allow-Methods: POST, OPTIONS\r\n";
-        response += "Access-Control-Allow-Headers: Content-Type\r\n";
-        response += "Connection: close\r\n";
-        response += "\r\n";
-        response += "{\"success\": true, \"message\": \"Login successful\", \"token\": \"demo-token-123\", \"user\": {\"id\": 1, \"username\": \"demo@cockpit.com\", \"email\": \"demo@cockpit.com\"}}";
-        
-        send(conn->socket, response.c_str(), response.length(), 0);
-        ::close(conn->socket);
+        HttpResponse response("200 OK", HttpHeaders::JSON_CORS);
+        response.setStaticBody("{\"success\": true, \"message\": \"Login successful\", \"token\": \"demo-token-123\", \"user\": {\"id\": 1, \"username\": \"demo@cockpit.com\", \"email\": \"demo@cockpit.com\"}}");
+        sendHttpResponse(conn, response);
     } catch (const std::exception& e) {
         std::cerr << "Exception in handleLogin: " << e.what() << std::endl;
         sendErrorResponse(conn, 500, "Internal Server Error");
     }
 }
 
+void WebSocketHandler::sendJsonResponse(std::shared_ptr<WebSocketConnection> conn, std::string body,
+                                        const std::string& status) {
+    HttpResponse response(status, HttpHeaders::JSON);
+    response.setBody(std::move(body));
+    sendHttpResponse(conn, response);
+}
+
 void WebSocketHandler::sendErrorResponse(std::shared_ptr<WebSocketConnection> conn, int statusCode, const std::string& message) {
     try {
-        std::string response = "HTTP/1.1 " + std::to_string(statusCode) + " " + message + "\r\n";
-        response += "Content-Type: application/json\r\n";
-        response += "Access-Control-Allow-Origin: *\r\n";
-        response += "Connection: close\r\n";
-        response += "\r\n";
-        response += "{\"success\": false, \"error\": \"" + message + "\"}";
-        
-        send(conn->socket, response.c_str(), response.length(), 0);
-        ::close(conn->socket);
+        sendJsonResponse(conn, "{\"success\": false, \"error\": \"" + message + "\"}",
+                         std::to_string(statusCode) + " " + message);
     } catch (const std::exception& e) {
         std::cerr << "Exception in sendErrorResponse: " << e.what() << std::endl;
         // Last resort - just close the socket
-        if (conn && conn->socket > 0) {
-            ::close(conn->socket);
+        if (conn) {
+            closeSocket(conn);
         }
     }
 }
 
-bool WebSocketHandler::performHandshake(int socket, const std::string& request) {
+bool WebSocketHandler::performHandshake(std::shared_ptr<WebSocketConnection> conn, const HttpRequest& request) {
     try {
         // Extract WebSocket key
-        std::string key;
-        size_t keyStart = request.find("Sec-WebSocket-Key: ");
-        if (keyStart != std::string::npos) {
-            keyStart += 19;
-            size_t keyEnd = request.find("\r\n", keyStart);
-            if (keyEnd != std::string::npos) {
-                key = request.substr(keyStart, keyEnd - keyStart);
-            }
-        }
+        std::string key(request.header("Sec-WebSocket-Key"));
         
         if (key.empty()) {
             return false;
         }
         
+        // Offers the server cannot honour are simply left out of the response
+        std::string extensions;
+        conn->deflate = PerMessageDeflate::negotiate(request.header("Sec-WebSocket-Extensions"), deflateConfig_,
+                                                     extensions);
+        conn->frames.allowCompression(conn->deflate != nullptr);
+        
+        std::string protocol;
+        conn->format = negotiateWireFormat(request.header("Sec-WebSocket-Protocol"), protocol);
+        
         // Generate response
-        std::string response = createHandshakeResponse(key);
-        return send(socket, response.c_str(), response.length(), 0) > 0;
+        std::string response = createHandshakeResponse(key, extensions, protocol);
+        return writeRaw(conn, response);
     } catch (const std::exception& e) {
         std::cerr << "Exception in performHandshake: " << e.what() << std::endl;
         return false;
     }
 }
 
-std::string WebSocketHandler::createHandshakeResponse(const std::string& key) {
+std::string WebSocketHandler::createHandshakeResponse(const std::string& key, const std::string& extensions,
+                                                     const std::string& protocol) {
     std::string magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
     std::string concatenated = key + magic;
     std::string sha1Hash = sha1Base64(concatenated);
@@ -311,63 +561,23 @@ std::string WebSocketHandler::createHandshakeResponse(const std::string& key) {
     response += "Upgrade: websocket\r\n";
     response += "Connection: Upgrade\r\n";
     response += "Sec-WebSocket-Accept: " + sha1Hash + "\r\n";
-    response += "\r\n";
-    
-    return response;
-}
-
-WebSocketFrame WebSocketHandler::parseFrame(const std::string& data) {
-    WebSocketFrame frame;
-    
-    if (data.length() < 2) {
-        return frame;
-    }
-    
-    uint8_t firstByte = data[0];
-    uint8_t secondByte = data[1];
-    
-    frame.fin = (firstByte & 0x80) != 0;
-    frame.opcode = firstByte & 0x0F;
-    frame.masked = (secondByte & 0x80) != 0;
-    
-    uint64_t payloadLength = secondByte & 0x7F;
-    size_t headerLength = 2;
-    
-    if (payloadLength == 126) {
-        if (data.length() < 4) return frame;
-        payloadLength = (data[2] << 8) | data[3];
-        headerLength = 4;
-    } else if (payloadLength == 127) {
-        if (data.length() < 10) return frame;
-        payloadLength = 0;
-        for (int i = 0; i < 8; i++) {
-            payloadLength = (payloadLength << 8) | data[2 + i];
-        }
-        headerLength = 10;
+    if (!extensions.empty()) {
+        response += "Sec-WebSocket-Extensions: " + extensions + "\r\n";
     }
-    
-    if (frame.masked) {
-        if (data.length() < headerLength + 4) return frame;
-        frame.masking_key = data.substr(headerLength, 4);
-        headerLength += 4;
-    }
-    
-    if (data.length() < headerLength + payloadLength) return frame;
-    
-    frame.payload = data.substr(headerLength, payloadLength);
-    
-    if (frame.masked) {
-        frame.payload = maskData(frame.payload, frame.masking_key);
+    if (!protocol.empty()) {
+        response += "Sec-WebSocket-Protocol: " + protocol + "\r\n";
     }
+    response += "\r\n";
     
-    return frame;
+    return response;
 }
 
-std::string WebSocketHandler::createFrame(const std::string& payload, uint8_t opcode) {
+std::string WebSocketHandler::createFrame(const std::string& payload, uint8_t opcode, bool compressed) {
     std::string frame;
+    frame.reserve(payload.length() + 10);
     
-    // First byte: FIN + opcode
-    frame.push_back(0x80 | opcode);
+    // First byte: FIN + RSV1 for a deflated message + opcode
+    frame.push_back(0x80 | (compressed ? 0x40 : 0) | opcode);
     
     // Second byte: MASK + payload length
     if (payload.length() < 126) {
@@ -387,97 +597,547 @@ std::string WebSocketHandler::createFrame(const std::string& payload, uint8_t op
     return frame;
 }
 
-std::string WebSocketHandler::maskData(const std::string& data, const std::string& key) {
-    std::string masked;
-    for (size_t i = 0; i < data.length(); i++) {
-        masked.push_back(data[i] ^ key[i % 4]);
+void WebSocketHandler::processMessage(std::shared_ptr<WebSocketConnection> conn, std::string_view message,
+                                      uint8_t opcode) {
+    if (conn->format == WireFormat::PLAIN) {
+        if (opcode != WebSocketOpcode::TEXT) {
+            return;
+        }
+        std::cout << "Received message from " << conn->remote_address << ": " << message << std::endl;
+        
+        // Echo back for now
+        sendFrame(conn, "Echo: " + std::string(message), WebSocketOpcode::TEXT);
+        return;
+    }
+    
+    // Either encoding is accepted whichever was negotiated, so a binary
+    // client can still fall back to JSON; replies use the negotiated one
+    thread_local std::string scratch;
+    Envelope envelope;
+    WireFormat encoding = opcode == WebSocketOpcode::BINARY ? WireFormat::BINARY : WireFormat::JSON;
+    if (!decodeEnvelope(message, encoding, envelope, scratch)) {
+        sendError(conn, 0, "malformed message");
+        return;
+    }
+    handleEnvelope(conn, envelope);
+}
+
+void WebSocketHandler::handleEnvelope(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    switch (envelope.type) {
+        case MessageType::ECHO:
+            sendEnvelope(conn, envelope);
+            break;
+        case MessageType::AUTH:
+            handleAuth(conn, envelope);
+            break;
+        case MessageType::SUBSCRIBE:
+        case MessageType::UNSUBSCRIBE:
+            handleSubscription(conn, envelope);
+            break;
+        case MessageType::MESSAGE:
+        case MessageType::GROUP_MESSAGE:
+            handleSend(conn, envelope);
+            break;
+        case MessageType::TYPING:
+        case MessageType::READ:
+            handleSignal(conn, envelope);
+            break;
+        default:
+            sendError(conn, envelope.id, "unknown message type");
+            break;
+    }
+}
+
+void WebSocketHandler::handleAuth(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    int userId;
+    if (!userManager_->validateSessionToken(std::string(envelope.body), userId)) {
+        sendError(conn, envelope.id, "invalid session");
+        return;
+    }
+    signIn(conn, userId, &envelope);
+}
+
+void WebSocketHandler::handleSubscription(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    // Group and user topics follow membership and sign-in; clients only
+    // choose whose presence they watch
+    Topic topic;
+    if (!Topic::parse(envelope.body, topic) || topic.kind != Topic::Kind::PRESENCE) {
+        sendError(conn, envelope.id, "unknown topic");
+        return;
+    }
+    if (!conn->authenticated) {
+        sendError(conn, envelope.id, "not signed in");
+        return;
+    }
+    if (envelope.type == MessageType::SUBSCRIBE) {
+        subscribe(conn, topic);
+    } else {
+        pubsub_->unsubscribe(topic, conn);
+    }
+    
+    // Acknowledged with the request's type and id
+    Envelope reply;
+    reply.type = envelope.type;
+    reply.id = envelope.id;
+    reply.body = envelope.body;
+    sendEnvelope(conn, reply);
+    
+    // Then the current state, so the client does not wait for a change
+    if (envelope.type == MessageType::SUBSCRIBE) {
+        sendEnvelope(conn, presence_->snapshot(topic.id));
+    }
+}
+
+void WebSocketHandler::handleSend(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    if (!conn->authenticated) {
+        sendError(conn, envelope.id, "not signed in");
+        return;
     }
-    return masked;
+    int target = static_cast<int>(envelope.target);
+    if (target <= 0) {
+        sendError(conn, envelope.id, "no target");
+        return;
+    }
+    // The connection follows exactly the groups its user belongs to
+    if (envelope.type == MessageType::GROUP_MESSAGE && !pubsub_->isSubscribed(Topic::group(target), conn)) {
+        sendError(conn, envelope.id, "not a member");
+        return;
+    }
+    
+    // Called on the writer thread after the commit; the loop must never wait for it
+    std::weak_ptr<WebSocketConnection> weak = conn;
+    uint32_t type = envelope.type;
+    uint64_t requestId = envelope.id;
+    auto done = [this, weak, type, requestId](int messageId) {
+        std::shared_ptr<WebSocketConnection> conn = weak.lock();
+        if (!conn) {
+            return;
+        }
+        conn->loop->post([this, weak, type, requestId, messageId]() {
+            std::shared_ptr<WebSocketConnection> conn = weak.lock();
+            if (!conn) {
+                return;
+            }
+            if (messageId < 0) {
+                sendError(conn, requestId, "not stored");
+                return;
+            }
+            // Acknowledged with the request's type and id; the body is the stored message's id
+            std::string body = std::to_string(messageId);
+            Envelope reply;
+            reply.type = type;
+            reply.id = requestId;
+            reply.body = body;
+            sendEnvelope(conn, reply);
+        });
+    };
+    
+    int senderId = conn->user_id;
+    std::string content(envelope.body);
+    bool queued = type == MessageType::MESSAGE
+                      ? messageHandler_->sendMessage(senderId, target, content, "text", done)
+                      : messageHandler_->sendGroupMessage(senderId, target, content, "text", done);
+    if (!queued) {
+        sendError(conn, requestId, "rejected");
+    }
+}
+
+void WebSocketHandler::handleSignal(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    Topic conversation;
+    if (!Topic::parse(envelope.body, conversation) || conversation.kind == Topic::Kind::PRESENCE) {
+        sendError(conn, envelope.id, "unknown conversation");
+        return;
+    }
+    if (!conn->authenticated) {
+        sendError(conn, envelope.id, "not signed in");
+        return;
+    }
+    // The connection follows exactly the groups its user belongs to
+    if (conversation.kind == Topic::Kind::GROUP) {
+        if (!pubsub_->isSubscribed(conversation, conn)) {
+            sendError(conn, envelope.id, "not a member");
+            return;
+        }
+    }
+    signalsReceived_++;
+    
+    uint64_t slotKey = uint64_t(envelope.type) << 40 | conversation.key();
+    auto now = std::chrono::steady_clock::now();
+    auto it = conn->signals.find(slotKey);
+    if (it == conn->signals.end()) {
+        if (conn->signals.size() >= MAX_SIGNAL_SLOTS) {
+            // Forget conversations that have gone quiet
+            for (auto slot = conn->signals.begin(); slot != conn->signals.end();) {
+                if (!slot->second.held && slot->second.nextAllowed <= now) {
+                    slot = conn->signals.erase(slot);
+                } else {
+                    ++slot;
+                }
+            }
+            if (conn->signals.size() >= MAX_SIGNAL_SLOTS) {
+                signalsDropped_++;
+                return;
+            }
+        }
+        it = conn->signals.emplace(slotKey, SignalSlot()).first;
+    }
+    
+    SignalSlot& slot = it->second;
+    slot.target = envelope.target;
+    if (now >= slot.nextAllowed) {
+        slot.nextAllowed = now + std::chrono::milliseconds(SIGNAL_INTERVAL_MS);
+        publishSignal(conn, envelope.type, conversation, slot.target);
+        return;
+    }
+    if (slot.held) {
+        signalsCoalesced_++;
+        return;
+    }
+    
+    // Held until the interval is up, so the last signal of a burst (a
+    // typing pause, the final read position) is never lost
+    slot.held = true;
+    uint32_t type = envelope.type;
+    std::weak_ptr<WebSocketConnection> weak = conn;
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(slot.nextAllowed - now);
+    conn->loop->runAfter(delay, [this, weak, slotKey, type, conversation]() {
+        auto conn = weak.lock();
+        if (!conn || conn->state == ConnectionState::CLOSED) {
+            return;
+        }
+        auto it = conn->signals.find(slotKey);
+        if (it == conn->signals.end() || !it->second.held) {
+            return;
+        }
+        it->second.held = false;
+        it->second.nextAllowed = std::chrono::steady_clock::now() + std::chrono::milliseconds(SIGNAL_INTERVAL_MS);
+        publishSignal(conn, type, conversation, it->second.target);
+    });
 }
 
-void WebSocketHandler::processMessage(std::shared_ptr<WebSocketConnection> conn, const std::string& message) {
-    // TODO: Parse JSON message and handle different message types
-    std::cout << "Received message from " << conn->remote_address << ": " << message << std::endl;
+void WebSocketHandler::publishSignal(const std::shared_ptr<WebSocketConnection>& conn, uint32_t type,
+                                     const Topic& conversation, uint64_t target) {
+    int userId = conn->user_id;
+    if (userId < 0) {
+        return;
+    }
     
-    // Echo back for now
-    sendFrame(conn, "Echo: " + message, OPCODE_TEXT);
+    // Named as the recipients see the conversation: for a direct one, that
+    // is the sender
+    std::string name = conversation.kind == Topic::Kind::USER ? Topic::user(userId).name() : conversation.name();
+    Envelope signal;
+    signal.type = type;
+    signal.from = userId;
+    signal.target = type == MessageType::READ ? target : 0;
+    signal.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    signal.body = name;
+    pubsub_->publish(conversation, signal, signalKey(type, userId, conversation));
+    signalsPublished_++;
 }
 
-void WebSocketHandler::sendFrame(std::shared_ptr<WebSocketConnection> conn, const std::string& payload, uint8_t opcode) {
+WebSocketHandler::SignalStats WebSocketHandler::signalStats() const {
+    return {signalsReceived_.load(), signalsPublished_.load(), signalsCoalesced_.load(), signalsDropped_.load()};
+}
+
+void WebSocketHandler::sendError(const std::shared_ptr<WebSocketConnection>& conn, uint64_t id,
+                                 std::string_view reason) {
+    Envelope error;
+    error.type = MessageType::ERROR;
+    error.id = id;
+    error.body = reason;
+    sendEnvelope(conn, error);
+}
+
+void WebSocketHandler::sendEnvelope(const std::shared_ptr<WebSocketConnection>& conn, const Envelope& envelope) {
+    // Reused, so encoding costs no allocation once it has grown
+    thread_local std::string encoded;
+    encoded.clear();
+    encodeEnvelope(envelope, conn->format, encoded);
+    sendFrame(conn, encoded, conn->format == WireFormat::BINARY ? WebSocketOpcode::BINARY : WebSocketOpcode::TEXT);
+}
+
+void WebSocketHandler::sendFrame(std::shared_ptr<WebSocketConnection> conn, const std::string& payload, uint8_t opcode,
+                                 uint64_t coalesceKey) {
     if (!conn || !conn->active) {
         return;
     }
     
     try {
-        std::string frame = createFrame(payload, opcode);
-        send(conn->socket, frame.c_str(), frame.length(), 0);
+        // Control frames are never compressed. The lock spans compress and
+        // enqueue so messages reach the peer in the order their bytes entered
+        // the compression window.
+        if (conn->deflate && !(opcode & 0x8)) {
+            std::lock_guard<std::mutex> lock(conn->deflateMutex);
+            std::string compressed;
+            if (conn->deflate->compress(payload, compressed)) {
+                // Never droppable: the peer's inflater has to see every compressed message
+                writeRaw(conn, createFrame(compressed, opcode, true));
+            } else {
+                queueFrame(conn, createFrame(payload, opcode), coalesceKey);
+            }
+        } else {
+            queueFrame(conn, createFrame(payload, opcode), coalesceKey);
+        }
+        checkOverflow(conn);
     } catch (const std::exception& e) {
         std::cerr << "Exception in sendFrame: " << e.what() << std::endl;
     }
 }
 
+void WebSocketHandler::queueFrame(const std::shared_ptr<WebSocketConnection>& conn, std::string frame,
+                                  uint64_t coalesceKey) {
+    if (coalesceKey) {
+        conn->io->writeShared(conn, std::make_shared<const std::string>(std::move(frame)), coalesceKey);
+    } else {
+        writeRaw(conn, frame);
+    }
+}
+
+void WebSocketHandler::checkOverflow(const std::shared_ptr<WebSocketConnection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        if (!conn->outbound.overflowed()) {
+            return;
+        }
+        // Nothing behind the frame on the wire is worth sending any more;
+        // the close frame goes out right after it
+        conn->outbound.dropUnsent();
+    }
+    
+    std::cerr << "Send queue over " << outboundLimits_.highWatermark << " bytes for " << conn->remote_address
+              << " (" << overflowPolicyName(outboundLimits_.policy) << "), closing" << std::endl;
+    // A peer this far behind may never read the close frame either;
+    // closeSocket gives it CLOSE_GRACE_MS before the connection is reset
+    closeConnection(conn, WebSocketCloseCode::POLICY_VIOLATION);
+}
+
 void WebSocketHandler::closeConnection(std::shared_ptr<WebSocketConnection> conn, uint16_t code) {
     if (!conn) {
         return;
     }
     
     try {
-        conn->active = false;
-        
-        // Send close frame if socket is still valid
-        if (conn->socket > 0) {
+        // Send close frame if socket is still valid, then tear down on the loop
+        if (conn->active) {
             std::string closePayload;
             closePayload.push_back((code >> 8) & 0xFF);
             closePayload.push_back(code & 0xFF);
-            sendFrame(conn, closePayload, OPCODE_CLOSE);
-            
-            ::close(conn->socket);
+            sendFrame(conn, closePayload, WebSocketOpcode::CLOSE);
         }
         
-        // Remove from connections using socket as key
-        std::lock_guard<std::mutex> lock(connectionsMutex_);
-        connections_.erase(conn->socket);
+        closeSocket(conn);
     } catch (const std::exception& e) {
         std::cerr << "Exception in closeConnection: " << e.what() << std::endl;
     }
 }
 
 void WebSocketHandler::addConnection(int userId, std::shared_ptr<WebSocketConnection> conn) {
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    connections_[userId] = conn;
+    signIn(conn, userId, nullptr);
 }
 
 void WebSocketHandler::removeConnection(int userId) {
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    connections_.erase(userId);
+    for (const auto& conn : registry_.connectionsOf(userId)) {
+        signOut(conn);
+    }
+}
+
+void WebSocketHandler::signIn(const std::shared_ptr<WebSocketConnection>& conn, int userId, const Envelope* request) {
+    signOut(conn);
+    // Membership is read once here, so publishing to a group never has to,
+    // and before the journal is locked
+    std::vector<Group> groups = messageHandler_->getUserGroups(userId);
+    
+    // Everything recorded for the user either is in missed or reaches this
+    // connection after it, as the journal stays locked until the replay is queued
+    journal_.attach(userId, request ? request->seq : 0,
+                    [&](uint64_t lastSeq, bool resumed, const std::vector<Envelope>& missed) {
+        conn->user_id = userId;
+        conn->authenticated = true;
+        registry_.addUser(userId, conn);
+        subscribe(conn, Topic::user(userId));
+        for (const Group& group : groups) {
+            subscribe(conn, Topic::group(group.id));
+        }
+        if (!request) {
+            return;
+        }
+        
+        Envelope reply;
+        reply.type = MessageType::AUTH;
+        reply.id = request->id;
+        reply.target = userId;
+        reply.seq = lastSeq;
+        if (request->seq) {
+            reply.body = resumed ? "resumed" : "sync";
+        }
+        sendEnvelope(conn, reply);
+        for (const Envelope& event : missed) {
+            sendEnvelope(conn, event);
+        }
+    });
+    presence_->connected(userId);
+}
+
+void WebSocketHandler::signOut(const std::shared_ptr<WebSocketConnection>& conn) {
+    int userId = conn->user_id.exchange(-1);
+    if (userId < 0) {
+        return;
+    }
+    conn->authenticated = false;
+    registry_.removeUser(userId, conn);
+    std::vector<uint64_t> topics = pubsub_->topicsOf(conn);
+    pubsub_->unsubscribeAll(conn);
+    
+    // Posted: a close can start while the journal or presence is locked for
+    // this user (an overflow while queueing a replay or an update)
+    conn->loop->post([this, userId, topics = std::move(topics)]() mutable {
+        journal_.detach(userId, std::move(topics));
+        presence_->disconnected(userId);
+    });
+}
+
+void WebSocketHandler::subscribe(const std::shared_ptr<WebSocketConnection>& conn, const Topic& topic) {
+    conn->loop->runInLoop([this, conn, topic]() {
+        // closeSocket runs on this loop too and drops every subscription
+        if (conn->state != ConnectionState::CLOSED) {
+            pubsub_->subscribe(topic, conn);
+        }
+    });
+}
+
+void WebSocketHandler::joinGroup(int userId, int groupId) {
+    for (const auto& conn : registry_.connectionsOf(userId)) {
+        subscribe(conn, Topic::group(groupId));
+    }
+}
+
+void WebSocketHandler::leaveGroup(int userId, int groupId) {
+    for (const auto& conn : registry_.connectionsOf(userId)) {
+        conn->loop->runInLoop([this, conn, groupId]() {
+            pubsub_->unsubscribe(Topic::group(groupId), conn);
+        });
+    }
 }
 
 std::shared_ptr<WebSocketConnection> WebSocketHandler::getConnection(int userId) {
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    auto it = connections_.find(userId);
-    return (it != connections_.end()) ? it->second : nullptr;
+    auto devices = registry_.connectionsOf(userId);
+    return devices.empty() ? nullptr : devices.back();
+}
+
+void WebSocketHandler::broadcastMessage(const std::string& message, const std::set<int>& userIds,
+                                        uint64_t coalesceKey) {
+    // Snapshot every device of every recipient so connects and disconnects
+    // are not held up while the frames are queued
+    std::vector<std::shared_ptr<WebSocketConnection>> recipients;
+    recipients.reserve(userIds.size());
+    registry_.collect(std::vector<int>(userIds.begin(), userIds.end()), recipients);
+    if (recipients.empty()) {
+        return;
+    }
+    
+    // Framed once; every recipient queues a reference to the same bytes
+    SharedBuffer frame = std::make_shared<const std::string>(createFrame(message, WebSocketOpcode::TEXT));
+    for (const auto& conn : recipients) {
+        sendSharedFrame(conn, frame, message, WebSocketOpcode::TEXT, coalesceKey);
+    }
+}
+
+void WebSocketHandler::deliver(const Topic& topic, const PubSubHub::Subscribers& subscribers,
+                               const Envelope& envelope, uint64_t coalesceKey) {
+    if (coalesceKey) {
+        deliverShared(subscribers, envelope, coalesceKey);
+        return;
+    }
+    
+    // Users rather than connections: each of a user's devices gets the same
+    // sequence number, and users whose last device just dropped still get
+    // the event recorded for when they resume
+    std::vector<int> users;
+    users.reserve(subscribers.size());
+    for (const auto& conn : subscribers) {
+        int userId = conn->user_id;
+        if (userId >= 0) {
+            users.push_back(userId);
+        }
+    }
+    journal_.parkedOn(topic.key(), users);
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    
+    for (int userId : users) {
+        journal_.record(userId, envelope, [&](const Envelope& stamped) {
+            deliverShared(registry_.connectionsOf(userId), stamped, 0);
+        });
+    }
 }
 
-void WebSocketHandler::broadcastMessage(const std::string& message, const std::set<int>& userIds) {
-    std::lock_guard<std::mutex> lock(connectionsMutex_);
-    for (int userId : userIds) {
-        auto it = connections_.find(userId);
-        if (it != connections_.end() && it->second && it->second->active) {
-            sendFrame(it->second, message, OPCODE_TEXT);
+void WebSocketHandler::deliverShared(const std::vector<std::shared_ptr<WebSocketConnection>>& conns,
+                                     const Envelope& envelope, uint64_t coalesceKey) {
+    // Each format is encoded and framed at most once, on first use
+    std::string payloads[2];
+    SharedBuffer frames[2];
+    for (const auto& conn : conns) {
+        bool binary = conn->format == WireFormat::BINARY;
+        int index = binary ? 1 : 0;
+        uint8_t opcode = binary ? WebSocketOpcode::BINARY : WebSocketOpcode::TEXT;
+        if (!frames[index]) {
+            encodeEnvelope(envelope, conn->format, payloads[index]);
+            frames[index] = std::make_shared<const std::string>(createFrame(payloads[index], opcode));
         }
+        sendSharedFrame(conn, frames[index], payloads[index], opcode, coalesceKey);
+    }
+}
+
+void WebSocketHandler::sendSharedFrame(const std::shared_ptr<WebSocketConnection>& conn, const SharedBuffer& frame,
+                                       const std::string& payload, uint8_t opcode, uint64_t coalesceKey) {
+    if (!conn->active) {
+        return;
     }
+    if (!conn->deflate) {
+        conn->io->writeShared(conn, frame, coalesceKey);
+        checkOverflow(conn);
+        return;
+    }
+    // Compression state is per connection, so a message worth compressing is
+    // framed for this peer alone. A small one goes out as the shared plain
+    // frame, in order with this connection's compressed frames.
+    if (conn->deflate->worthCompressing(payload.size())) {
+        sendFrame(conn, payload, opcode, coalesceKey);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->deflateMutex);
+        conn->io->writeShared(conn, frame, coalesceKey);
+    }
+    checkOverflow(conn);
+}
+
+std::vector<WebSocketHandler::QueueInfo> WebSocketHandler::queueStats() {
+    std::vector<std::shared_ptr<WebSocketConnection>> conns = registry_.allConnections();
+    std::vector<QueueInfo> queues;
+    queues.reserve(conns.size());
+    for (const auto& conn : conns) {
+        std::lock_guard<std::mutex> lock(conn->writeMutex);
+        queues.push_back({conn->remote_address, conn->user_id, conn->outbound.stats()});
+    }
+    return queues;
 }
 
 void WebSocketHandler::sendToUser(int userId, const std::string& message) {
-    auto conn = getConnection(userId);
-    if (conn && conn->active) {
-        sendFrame(conn, message, OPCODE_TEXT);
+    auto devices = registry_.connectionsOf(userId);
+    if (devices.empty()) {
+        return;
+    }
+    // Framed once for all of the user's devices, as in broadcastMessage
+    SharedBuffer frame = std::make_shared<const std::string>(createFrame(message, WebSocketOpcode::TEXT));
+    for (const auto& conn : devices) {
+        sendSharedFrame(conn, frame, message, WebSocketOpcode::TEXT, 0);
     }
 }
 
 void WebSocketHandler::disconnectUser(int userId) {
-    auto conn = getConnection(userId);
-    if (conn) {
+    for (const auto& conn : registry_.connectionsOf(userId)) {
         closeConnection(conn);
     }
 }
@@ -0,0 +1,122 @@
+#include "websocket_mask.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_MASK_X86 1
+#endif
+
+namespace {
+
+using UnmaskKernel = void (*)(char* data, size_t size, uint32_t key);
+
+// The kernels take the key already rotated to the first byte's position and
+// packed in memory order, so every 4-byte step starts at key byte 0
+void finishBytes(char* data, size_t size, uint32_t key) {
+    uint8_t bytes[4];
+    memcpy(bytes, &key, sizeof(bytes));
+    for (size_t i = 0; i < size; i++) {
+        data[i] ^= bytes[i & 3];
+    }
+}
+
+void unmaskScalar(char* data, size_t size, uint32_t key) {
+    // The key twice in memory order, whatever the byte order of uint64_t
+    char pattern[8];
+    memcpy(pattern, &key, sizeof(key));
+    memcpy(pattern + 4, &key, sizeof(key));
+    uint64_t wide;
+    memcpy(&wide, pattern, sizeof(wide));
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        word ^= wide;
+        memcpy(data + i, &word, sizeof(word));
+    }
+    finishBytes(data + i, size - i, key);
+}
+
+#ifdef WEBSOCKET_MASK_X86
+__attribute__((target("sse2")))
+void unmaskSse2(char* data, size_t size, uint32_t key) {
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(key));
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask));
+        _mm_storeu_si128(p + 1, _mm_xor_si128(_mm_loadu_si128(p + 1), mask));
+        _mm_storeu_si128(p + 2, _mm_xor_si128(_mm_loadu_si128(p + 2), mask));
+        _mm_storeu_si128(p + 3, _mm_xor_si128(_mm_loadu_si128(p + 3), mask));
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask));
+    }
+    unmaskScalar(data + i, size - i, key);
+}
+
+__attribute__((target("avx2")))
+void unmaskAvx2(char* data, size_t size, uint32_t key) {
+    const __m256i mask = _mm256_set1_epi32(static_cast<int>(key));
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask));
+        _mm256_storeu_si256(p + 1, _mm256_xor_si256(_mm256_loadu_si256(p + 1), mask));
+        _mm256_storeu_si256(p + 2, _mm256_xor_si256(_mm256_loadu_si256(p + 2), mask));
+        _mm256_storeu_si256(p + 3, _mm256_xor_si256(_mm256_loadu_si256(p + 3), mask));
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask));
+    }
+    unmaskSse2(data + i, size - i, key);
+}
+#endif
+
+struct Dispatch {
+    UnmaskKernel kernel;
+    const char* name;
+};
+
+Dispatch selectKernel() {
+#ifdef WEBSOCKET_MASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {unmaskAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {unmaskSse2, "sse2"};
+    }
+#endif
+    return {unmaskScalar, "scalar"};
+}
+
+const Dispatch& dispatch() {
+    static const Dispatch selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+void unmaskPayload(char* data, size_t size, const uint8_t key[4], size_t keyOffset) {
+    uint8_t rotated[4];
+    for (size_t i = 0; i < 4; i++) {
+        rotated[i] = key[(keyOffset + i) & 3];
+    }
+    uint32_t packed;
+    memcpy(&packed, rotated, sizeof(packed));
+
+    // Short payloads (most chat lines) are not worth the vector setup
+    if (size < 16) {
+        finishBytes(data, size, packed);
+        return;
+    }
+    dispatch().kernel(data, size, packed);
+}
+
+const char* unmaskImplementation() {
+    return dispatch().name;
+}
@@ -0,0 +1,503 @@
+#include "wire_protocol.h"
+#include <charconv>
+
+namespace {
+
+constexpr uint8_t BINARY_VERSION = 1;
+constexpr size_t MAX_VARINT_BYTES = 10;
+
+constexpr uint8_t FIELD_SEQ = 0x1;
+constexpr uint8_t FIELD_ID = 0x2;
+constexpr uint8_t FIELD_TARGET = 0x4;
+constexpr uint8_t FIELD_TIMESTAMP = 0x8;
+constexpr uint8_t FIELD_FROM = 0x10;
+constexpr uint8_t KNOWN_FIELDS = FIELD_SEQ | FIELD_ID | FIELD_TARGET | FIELD_TIMESTAMP | FIELD_FROM;
+
+struct TypeName {
+    uint32_t type;
+    const char* name;
+};
+
+constexpr TypeName TYPE_NAMES[] = {
+    {MessageType::ERROR, "error"},
+    {MessageType::ECHO, "echo"},
+    {MessageType::AUTH, "auth"},
+    {MessageType::SUBSCRIBE, "subscribe"},
+    {MessageType::UNSUBSCRIBE, "unsubscribe"},
+    {MessageType::MESSAGE, "message"},
+    {MessageType::GROUP_MESSAGE, "group_message"},
+    {MessageType::PRESENCE, "presence"},
+    {MessageType::TYPING, "typing"},
+    {MessageType::READ, "read"},
+};
+
+std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+void putVarint(uint64_t value, std::string& out) {
+    char bytes[MAX_VARINT_BYTES];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    out.append(bytes, size);
+}
+
+bool getVarint(std::string_view& data, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; i < data.size() && i < MAX_VARINT_BYTES; i++) {
+        uint8_t byte = static_cast<uint8_t>(data[i]);
+        // The tenth byte only has room for the top bit
+        if (i == MAX_VARINT_BYTES - 1 && byte > 1) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            data.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void putNumber(uint64_t value, std::string& out) {
+    char digits[20];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr - digits);
+}
+
+void putJsonString(std::string_view value, std::string& out) {
+    static const char HEX[] = "0123456789abcdef";
+    out.push_back('"');
+    size_t plain = 0;  // start of the run not yet copied
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(value.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char escape[] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xF]};
+                out.append(escape, sizeof(escape));
+            }
+        }
+    }
+    out.append(value.data() + plain, value.size() - plain);
+    out.push_back('"');
+}
+
+void putJsonField(const char* name, uint64_t value, std::string& out) {
+    if (value == 0) {
+        return;
+    }
+    out += ",\"";
+    out += name;
+    out += "\":";
+    putNumber(value, out);
+}
+
+// A minimal reader for the flat JSON objects clients send: string keys,
+// string or integer values. Unknown keys with other values are skipped.
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view data) : data_(data), pos_(0) {}
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos_ < data_.size() && data_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c) {
+        skipSpace();
+        return pos_ < data_.size() && data_[pos_] == c;
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return pos_ == data_.size();
+    }
+
+    // A string without escapes is returned as a view into the input; one
+    // with escapes is decoded into scratch, which is reused by the next call
+    bool string(std::string_view& value, std::string& scratch) {
+        if (!consume('"')) {
+            return false;
+        }
+        size_t start = pos_;
+        while (pos_ < data_.size() && data_[pos_] != '"' && data_[pos_] != '\\') {
+            if (static_cast<unsigned char>(data_[pos_]) < 0x20) {
+                return false;
+            }
+            pos_++;
+        }
+        if (pos_ == data_.size()) {
+            return false;
+        }
+        if (data_[pos_] == '"') {
+            value = data_.substr(start, pos_ - start);
+            pos_++;
+            return true;
+        }
+
+        scratch.assign(data_.data() + start, pos_ - start);
+        while (pos_ < data_.size()) {
+            char c = data_[pos_++];
+            if (c == '"') {
+                value = scratch;
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) {
+                return false;
+            }
+            if (c != '\\') {
+                scratch.push_back(c);
+                continue;
+            }
+            if (pos_ == data_.size()) {
+                return false;
+            }
+            switch (data_[pos_++]) {
+                case '"': scratch.push_back('"'); break;
+                case '\\': scratch.push_back('\\'); break;
+                case '/': scratch.push_back('/'); break;
+                case 'b': scratch.push_back('\b'); break;
+                case 'f': scratch.push_back('\f'); break;
+                case 'n': scratch.push_back('\n'); break;
+                case 'r': scratch.push_back('\r'); break;
+                case 't': scratch.push_back('\t'); break;
+                case 'u': {
+                    uint32_t code;
+                    if (!hex4(code)) {
+                        return false;
+                    }
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        uint32_t low;
+                        if (data_.substr(pos_, 2) != "\\u") {
+                            return false;
+                        }
+                        pos_ += 2;
+                        if (!hex4(low) || low < 0xDC00 || low >= 0xE000) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (code >= 0xDC00 && code < 0xE000) {
+                        return false;
+                    }
+                    putUtf8(code, scratch);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    bool number(uint64_t& value) {
+        skipSpace();
+        const char* begin = data_.data() + pos_;
+        const char* end = data_.data() + data_.size();
+        auto result = std::from_chars(begin, end, value);
+        if (result.ec != std::errc() || result.ptr == begin) {
+            return false;
+        }
+        pos_ += result.ptr - begin;
+        // Fractions and exponents are not ids
+        return pos_ == data_.size() || (data_[pos_] != '.' && data_[pos_] != 'e' && data_[pos_] != 'E');
+    }
+
+    // Skips any value, nested or not
+    bool skipValue(std::string& scratch) {
+        skipSpace();
+        if (pos_ == data_.size()) {
+            return false;
+        }
+        char c = data_[pos_];
+        if (c == '"') {
+            std::string_view ignored;
+            return string(ignored, scratch);
+        }
+        if (c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            pos_++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (c == '{') {
+                    std::string_view key;
+                    if (!string(key, scratch) || !consume(':')) {
+                        return false;
+                    }
+                }
+                if (!skipValue(scratch)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        // A number or literal: up to the next delimiter
+        size_t start = pos_;
+        while (pos_ < data_.size() && data_[pos_] != ',' && data_[pos_] != '}' && data_[pos_] != ']' &&
+               data_[pos_] != ' ' && data_[pos_] != '\t' && data_[pos_] != '\r' && data_[pos_] != '\n') {
+            pos_++;
+        }
+        return pos_ > start;
+    }
+
+private:
+    std::string_view data_;
+    size_t pos_;
+
+    void skipSpace() {
+        while (pos_ < data_.size() &&
+               (data_[pos_] == ' ' || data_[pos_] == '\t' || data_[pos_] == '\r' || data_[pos_] == '\n')) {
+            pos_++;
+        }
+    }
+
+    bool hex4(uint32_t& code) {
+        if (data_.size() - pos_ < 4) {
+            return false;
+        }
+        auto result = std::from_chars(data_.data() + pos_, data_.data() + pos_ + 4, code, 16);
+        if (result.ptr != data_.data() + pos_ + 4) {
+            return false;
+        }
+        pos_ += 4;
+        return true;
+    }
+
+    static void putUtf8(uint32_t code, std::string& out) {
+        if (code < 0x80) {
+            out.push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else if (code < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+};
+
+void encodeBinary(const Envelope& envelope, std::string& out) {
+    uint8_t fields = (envelope.seq ? FIELD_SEQ : 0) | (envelope.id ? FIELD_ID : 0) |
+                     (envelope.from ? FIELD_FROM : 0) | (envelope.target ? FIELD_TARGET : 0) |
+                     (envelope.timestamp ? FIELD_TIMESTAMP : 0);
+    out.reserve(out.size() + 2 + 5 + 5 * MAX_VARINT_BYTES + 5 + envelope.body.size());
+    out.push_back(static_cast<char>(BINARY_VERSION));
+    putVarint(envelope.type, out);
+    out.push_back(static_cast<char>(fields));
+    if (fields & FIELD_SEQ) {
+        putVarint(envelope.seq, out);
+    }
+    if (fields & FIELD_ID) {
+        putVarint(envelope.id, out);
+    }
+    if (fields & FIELD_FROM) {
+        putVarint(envelope.from, out);
+    }
+    if (fields & FIELD_TARGET) {
+        putVarint(envelope.target, out);
+    }
+    if (fields & FIELD_TIMESTAMP) {
+        putVarint(envelope.timestamp, out);
+    }
+    putVarint(envelope.body.size(), out);
+    out.append(envelope.body.data(), envelope.body.size());
+}
+
+bool decodeBinary(std::string_view data, Envelope& envelope) {
+    if (data.size() < 2 || static_cast<uint8_t>(data[0]) != BINARY_VERSION) {
+        return false;
+    }
+    data.remove_prefix(1);
+
+    uint64_t type;
+    if (!getVarint(data, type) || type > UINT32_MAX || data.empty()) {
+        return false;
+    }
+    envelope.type = static_cast<uint32_t>(type);
+    uint8_t fields = static_cast<uint8_t>(data[0]);
+    data.remove_prefix(1);
+    if (fields & ~KNOWN_FIELDS) {
+        return false;
+    }
+
+    if ((fields & FIELD_SEQ) && !getVarint(data, envelope.seq)) {
+        return false;
+    }
+    if ((fields & FIELD_ID) && !getVarint(data, envelope.id)) {
+        return false;
+    }
+    if ((fields & FIELD_FROM) && !getVarint(data, envelope.from)) {
+        return false;
+    }
+    if ((fields & FIELD_TARGET) && !getVarint(data, envelope.target)) {
+        return false;
+    }
+    if ((fields & FIELD_TIMESTAMP) && !getVarint(data, envelope.timestamp)) {
+        return false;
+    }
+
+    uint64_t length;
+    if (!getVarint(data, length) || length != data.size()) {
+        return false;
+    }
+    envelope.body = data;
+    return true;
+}
+
+void encodeJson(const Envelope& envelope, std::string& out) {
+    out.reserve(out.size() + 96 + envelope.body.size());
+    out += "{\"type\":";
+    if (const char* name = messageTypeName(envelope.type)) {
+        out.push_back('"');
+        out += name;
+        out.push_back('"');
+    } else {
+        putNumber(envelope.type, out);
+    }
+    putJsonField("seq", envelope.seq, out);
+    putJsonField("id", envelope.id, out);
+    putJsonField("from", envelope.from, out);
+    putJsonField("target", envelope.target, out);
+    putJsonField("ts", envelope.timestamp, out);
+    out += ",\"body\":";
+    putJsonString(envelope.body, out);
+    out.push_back('}');
+}
+
+bool decodeJson(std::string_view data, Envelope& envelope, std::string& scratch) {
+    JsonReader reader(data);
+    if (!reader.consume('{')) {
+        return false;
+    }
+    bool hasType = false;
+    // Keys are short and escape-free in practice; the body gets scratch
+    std::string keyScratch;
+    if (!reader.consume('}')) {
+        do {
+            std::string_view key;
+            if (!reader.string(key, keyScratch) || !reader.consume(':')) {
+                return false;
+            }
+            bool ok;
+            if (key == "type") {
+                if (reader.peek('"')) {
+                    std::string_view name;
+                    ok = reader.string(name, keyScratch) && parseMessageType(name, envelope.type);
+                } else {
+                    uint64_t type;
+                    ok = reader.number(type) && type <= UINT32_MAX;
+                    envelope.type = static_cast<uint32_t>(type);
+                }
+                hasType = ok;
+            } else if (key == "seq") {
+                ok = reader.number(envelope.seq);
+            } else if (key == "id") {
+                ok = reader.number(envelope.id);
+            } else if (key == "from") {
+                ok = reader.number(envelope.from);
+            } else if (key == "target") {
+                ok = reader.number(envelope.target);
+            } else if (key == "ts") {
+                ok = reader.number(envelope.timestamp);
+            } else if (key == "body") {
+                ok = reader.string(envelope.body, scratch);
+            } else {
+                ok = reader.skipValue(keyScratch);
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (reader.consume(','));
+        if (!reader.consume('}')) {
+            return false;
+        }
+    }
+    return hasType && reader.atEnd();
+}
+
+} // namespace
+
+const char* messageTypeName(uint32_t type) {
+    for (const TypeName& entry : TYPE_NAMES) {
+        if (entry.type == type) {
+            return entry.name;
+        }
+    }
+    return nullptr;
+}
+
+bool parseMessageType(std::string_view name, uint32_t& type) {
+    for (const TypeName& entry : TYPE_NAMES) {
+        if (name == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+WireFormat negotiateWireFormat(std::string_view offers, std::string& protocol) {
+    WireFormat format = WireFormat::PLAIN;
+    protocol.clear();
+    while (!offers.empty()) {
+        size_t comma = offers.find(',');
+        std::string_view token = trim(offers.substr(0, comma));
+        offers = comma == std::string_view::npos ? std::string_view() : offers.substr(comma + 1);
+        if (token == WireSubprotocol::BINARY) {
+            protocol = WireSubprotocol::BINARY;
+            return WireFormat::BINARY;
+        }
+        if (token == WireSubprotocol::JSON && format == WireFormat::PLAIN) {
+            format = WireFormat::JSON;
+            protocol = WireSubprotocol::JSON;
+        }
+    }
+    return format;
+}
+
+void encodeEnvelope(const Envelope& envelope, WireFormat format, std::string& out) {
+    if (format == WireFormat::BINARY) {
+        encodeBinary(envelope, out);
+    } else {
+        encodeJson(envelope, out);
+    }
+}
+
+bool decodeEnvelope(std::string_view data, WireFormat format, Envelope& envelope, std::string& scratch) {
+    envelope = Envelope();
+    if (format == WireFormat::BINARY) {
+        return decodeBinary(data, envelope);
+    }
+    return decodeJson(data, envelope, scratch);
+}